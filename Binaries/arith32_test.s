@@ -0,0 +1,95 @@
+//ADD32, SUB32, CMP32, SAL32 and SAR32 on register pairs: carries and borrows across the words, overflow and
+//shift counts of 32 and more. Prints the low word, the high word and then MOVF (Z=1 O=2 C=4 N=8) for each
+//expected output: 0 1 0  0 0 5  0 -32768 10  -1 -1 12  -1 0 0  12 0  0 1 0  0 0 5  -1 -1 12  -1 -1 8  1 -32768 0
+		MOV R0, #-1
+		MOV R1, #0 //0x0000FFFF
+		ADD32 R1:R0, #1 //carry from the low word into the high one
+		OUT R0 //0
+		OUT R1 //1
+		MOVF R14
+		OUT R14 //0
+
+		MOV R0, #-1
+		MOV R1, #-1
+		ADD32 R1:R0, #1 //carry out of the pair, Z only when both words are 0
+		OUT R0 //0
+		OUT R1 //0
+		MOVF R14
+		OUT R14 //5, Z and C
+
+		MOV R0, #-1
+		MOV R1, #0x7FFF
+		MOV R2, #1
+		MOV R3, #0
+		ADD32 R1:R0, R3:R2 //signed overflow into bit 31
+		OUT R0 //0
+		OUT R1 //-32768
+		MOVF R14
+		OUT R14 //10, O and N
+
+		MOV R0, #0
+		MOV R1, #0
+		SUB32 R1:R0, #1 //borrow out of the pair
+		OUT R0 //-1
+		OUT R1 //-1
+		MOVF R14
+		OUT R14 //12, C and N
+
+		MOV R0, #0
+		MOV R1, #1 //0x00010000
+		SUB32 R1:R0, #1 //borrow from the high word only
+		OUT R0 //-1
+		OUT R1 //0
+		MOVF R14
+		OUT R14 //0
+
+		MOV R0, #0
+		MOV R1, #1
+		MOV R2, #1
+		MOV R3, #1
+		CMP32 R1:R0, R3:R2 //high words are equal, the low word decides
+		MOVF R14
+		OUT R14 //12, C and N
+		OUT R0 //0, CMP32 doesn't store
+
+		MOV R0, #0x8000
+		MOV R1, #0
+		SAL32 R1:R0, #1 //across the words
+		OUT R0 //0
+		OUT R1 //1
+		MOVF R14
+		OUT R14 //0
+
+		MOV R12, #32
+		SAL32 R1:R0, R12 //32 or more shifts everything out, and C says something was lost
+		OUT R0 //0
+		OUT R1 //0
+		MOVF R14
+		OUT R14 //5, Z and C
+
+		MOV R0, #0
+		MOV R1, #-32768
+		MOV R12, #40
+		SAR32 R1:R0, R12 //leaves only copies of the sign
+		OUT R0 //-1
+		OUT R1 //-1
+		MOVF R14
+		OUT R14 //12, C and N
+
+		MOV R0, #0
+		MOV R1, #-32768
+		SAR32 R1:R0, #31
+		OUT R0 //-1
+		OUT R1 //-1
+		MOVF R14
+		OUT R14 //8, only N: shifting back gives 0x80000000 again, so no C
+
+		MOV R0, #1
+		MOV R1, #-32768
+		SAL32 R1:R0, #0 //nothing moves, nothing is lost
+		OUT R0 //1
+		OUT R1 //-32768
+		MOVF R14
+		AND R14, R14, #4
+		OUT R14 //0, no C
+		HLT
@@ -0,0 +1,74 @@
+//MEMCPY, MEMSET and MEMCMP: overlapping copies both ways, partial fills, counts of 0 and a range that would
+//wrap past the end of memory, which faults with nothing done. MEMCMP results are MOVF masked to Z=1 and N=8
+//expected output: 1 6 8  1 6 6  52 4  52  8 0 1 1  7 7  then a memory fault at the last MEMCPY
+		MOV R0, _BUF
+		MOV R1, R0+1
+		MOV R2, #6
+		MEMCPY R1, R0, R2 //up by one, overlapping: copies like memmove, not byte by byte
+		LDRB R5, R0+1
+		OUT R5 //1
+		LDRB R5, R0+6
+		OUT R5 //6
+		LDRB R5, R0+7
+		OUT R5 //8, past the count
+		MEMCPY R0, R1, R2 //and back down
+		LDRB R5, R0+0
+		OUT R5 //1
+		LDRB R5, R0+5
+		OUT R5 //6
+		LDRB R5, R0+6
+		OUT R5 //6
+
+		MOV R4, #0x1234
+		MOV R2, #3
+		MEMSET R0, R4, R2 //the low byte of the value
+		LDRB R5, R0+2
+		OUT R5 //52
+		LDRB R5, R0+3
+		OUT R5 //4, past the count
+
+		MOV R2, #0
+		MOV R6, #-1
+		MEMSET R0, R2, R2 //a count of 0 writes nothing
+		MEMCPY R0, R6, R2 //and doesn't fault even right at the end of memory
+		LDRB R5, R0+0
+		OUT R5 //52, what the MEMSET above left
+
+		MOV R6, _CMPA
+		MOV R7, _CMPB
+		MOV R8, #4
+		MEMCMP R6, R7, R8 //3 < 9 in the third byte
+		MOVF R9
+		AND R9, R9, #9
+		OUT R9 //8, N
+		MEMCMP R7, R6, R8
+		MOVF R9
+		AND R9, R9, #9
+		OUT R9 //0
+		MOV R8, #2 //the first two match
+		MEMCMP R6, R7, R8
+		MOVF R9
+		AND R9, R9, #9
+		OUT R9 //1, Z
+		MOV R8, #0
+		MEMCMP R6, R7, R8 //nothing to compare is equal
+		MOVF R9
+		AND R9, R9, #9
+		OUT R9 //1, Z
+
+		MOV R10, #0xFFFC
+		MOV R2, #4
+		MOV R4, #7
+		MEMSET R10, R4, R2 //right up to the last byte is fine
+		LDRB R5, #0xFFFC
+		OUT R5 //7
+		LDRB R5, #0xFFFF
+		OUT R5 //7
+		MOV R2, #5
+		MEMCPY R10, R0, R2 //one more would wrap around to 0, so it faults instead
+		OUT R2 //never printed
+		HLT
+
+_BUF:		DB #1, #2, #3, #4, #5, #6, #7, #8
+_CMPA:		DB #1, #2, #3, #4
+_CMPB:		DB #1, #2, #9, #0
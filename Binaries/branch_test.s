@@ -0,0 +1,116 @@
+//conditional branches, on their own: each case prints its number times 10, plus 1 if the branch was taken
+//every instruction that sets Z and N from its result clears O, unless it works O out too (ADD, SUB, CMP and the 32 bit ones)
+//expected output: 11 20 31 40 51 60 71 81 91 101 110 120 130 140 4 1
+		MOV R1, #11
+		MOV R0, #-32768
+		CMP R0, #1 //-32768 - 1 overflows to positive, so N is clear but O is set
+		JLT _C1
+		MOV R1, #10
+_C1:		OUT R1 //11
+
+		MOV R1, #21
+		CMP R0, #1
+		JGE _C2
+		MOV R1, #20
+_C2:		OUT R1 //20
+
+		MOV R1, #31
+		MOV R0, #0x7FFF
+		CMP R0, #-1 //32767 + 1 overflows to negative
+		JGT _C3
+		MOV R1, #30
+_C3:		OUT R1 //31
+
+		MOV R1, #41
+		CMP R0, #-1
+		JLE _C4
+		MOV R1, #40
+_C4:		OUT R1 //40
+
+		MOV R1, #51
+		MOV R0, #5
+		CMP R0, #5
+		JLE _C5 //equal counts
+		MOV R1, #50
+_C5:		OUT R1 //51
+
+		MOV R1, #61
+		CMP R0, #5
+		JNZ _C6
+		MOV R1, #60
+_C6:		OUT R1 //60
+
+		MOV R1, #71
+		MOV R0, #1
+		CMP R0, #2 //unsigned borrow
+		JC _C7
+		MOV R1, #70
+_C7:		OUT R1 //71
+
+		MOV R1, #81
+		MOV R0, #-1
+		CMP R0, #1 //0xFFFF is above 1 unsigned, no borrow
+		JNC _C8
+		MOV R1, #80
+_C8:		OUT R1 //81
+
+		MOV R1, #91
+		MOV R0, #0x7FFF
+		CLC
+		ADD R0, R0, #1 //signed overflow
+		JO _C9
+		MOV R1, #90
+_C9:		OUT R1 //91
+
+		MOV R1, #101
+		CLC
+		ADD R0, R0, #0 //still 0x8000
+		JN _C10
+		MOV R1, #100
+_C10:		OUT R1 //101
+
+		MOV R1, #111
+		MOV R0, #5
+		CMP R0, #3 //no overflow
+		JO _C11
+		MOV R1, #110
+_C11:		OUT R1 //110
+
+		MOV R1, #121
+		MOV R0, #-32768
+		CMP R0, #1
+		JN _C12 //JN is the sign of the result alone, which overflowed
+		MOV R1, #120
+_C12:		OUT R1 //120
+
+		MOV R1, #131
+		MOV R0, #-32768
+		CMP R0, #1 //leaves O set
+		MOV R2, #3
+		MUL R2, #2 //6, and O cleared with it
+		JLT _C13 //6 < 0 would be N from the MUL against O from the CMP
+		MOV R1, #130
+_C13:		OUT R1 //130
+
+		MOV R1, #141
+		MOV R0, #-32768
+		CMP R0, #1
+		AND R0, R0, #-1 //same with a plain logic op
+		JO _C14
+		MOV R1, #140
+_C14:		OUT R1 //140
+
+		MOV R2, #4 //LOOP counts down and goes back until it reaches 0
+		MOV R3, #0
+_LOOP1:		CLC
+		ADD R3, R3, #1
+		LOOP R2, _LOOP1
+		OUT R3 //4
+
+		MOV R2, #1 //a count of 1 runs the body once
+		MOV R3, #0
+_LOOP2:		CLC
+		ADD R3, R3, #1
+		LOOP R2, _LOOP2
+		OUT R3 //1
+		HLT
@@ -0,0 +1,42 @@
+//LDRB, LDRSB and STRB: zero and sign extension, storing into half a word and the last byte of memory
+//expected output: 127 127 128 -128 255 -1 -128 -21708 240 -16 -16
+		LDRB R1, _BYTES //0x7F
+		OUT R1 //127
+		LDRSB R1, _BYTES
+		OUT R1 //127
+		MOV R2, _BYTES
+		LDRB R1, R2+1 //0x80
+		OUT R1 //128
+		LDRSB R1, R2+1
+		OUT R1 //-128
+		LDRB R1, R2+2 //0xFF
+		OUT R1 //255
+		LDRSB R1, R2+2
+		OUT R1 //-1
+
+		MOV R3, #-128
+		LDRSB R1, R2+1 //sets N like any other load
+		JN _NEG
+		MOV R3, #0
+_NEG:		OUT R3 //-128
+
+		MOV R2, _WORD
+		MOV R4, #0x77AB
+		STRB R2+1, R4 //only the low byte goes out, into the high half of the word
+		LDR R1, _WORD
+		OUT R1 //-21708 (0xAB34)
+
+		MOV R0, #0
+		MOV R4, #0x12F0
+		STRB R0+0xFFFF, R4 //the last byte of memory, a word access there would fault
+		LDRB R1, #0xFFFF
+		OUT R1 //240
+		LDRSB R1, R0+0xFFFF
+		OUT R1 //-16
+		LDR R1, #0xFFFE //the same byte as the high half of the last word
+		SAR R1, R1, #8
+		OUT R1 //-16
+		HLT
+
+_WORD:		DW #0x1234
+_BYTES:		DB #0x7F, #0x80, #0xFF
@@ -0,0 +1,8 @@
+//for timing the emulator: computes FACT(first input) as many times as the second input says
+		IN R5 //number to factor
+		IN R4 //repeat count
+_AGAIN:		MOV R1, R5
+		CALL FACT
+		LOOP R4, _AGAIN //until the count runs out
+		OUT R0
+		HLT
@@ -0,0 +1,8 @@
+//for timing the emulator: fills the array with first input fibonacci numbers as many times as the second input says
+		MOV R0, _FIBOARR
+		IN R1 //number of values
+		IN R4 //repeat count
+_AGAIN:		CALL FIBO
+		LOOP R4, _AGAIN //until the count runs out
+		HLT
+_FIBOARR: DW #0 DUP 1000 //space for values
@@ -0,0 +1,8 @@
+//for timing the emulator: multiplies the first two inputs as many times as the third input says
+		IN R1
+		IN R2
+		IN R4 //repeat count
+_AGAIN:		CALL MULT
+		LOOP R4, _AGAIN //until the count runs out
+		OUT R0
+		HLT
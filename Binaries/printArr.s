@@ -4,9 +4,7 @@
 
 PRINTARR:	MOV R14, #0 //i
 		MOV R13, R0 //memory pointer
-_REPEAT:	SAL R12, R14, #1 //*2 for word size
-		ADD R13, R0, R12 //memptr = &dest[i]
-		LDR R12, R13 //val = *memptr
+_REPEAT:	LDR R12, R13++ //val = *memptr, memptr to the next one
 		OUT R12 //print val
 		ADD R14, R14, #1 //i++
 		CMP R1, R14 // if (num > i)
@@ -0,0 +1,56 @@
+//PUSHM and POPM ordering, against PUSH and POP and across a CALL
+//expected output: 1 2 3 1 2 3 1 2 3 100 200 51 11 0
+		MOV R1, #1
+		MOV R2, #2
+		MOV R3, #3
+		PUSHM {R1, R2, R3} //highest register first, so R1 ends up on top
+		POP R4
+		POP R5
+		POP R6
+		OUT R4 //1
+		OUT R5 //2
+		OUT R6 //3
+
+		PUSH R3 //the same layout by hand
+		PUSH R2
+		PUSH R1
+		POPM {R7, R8, R9} //lowest register first
+		OUT R7 //1
+		OUT R8 //2
+		OUT R9 //3
+
+		PUSHM {R1, R2, R3}
+		MOV R1, #0
+		MOV R2, #0
+		MOV R3, #0
+		POPM {R1, R2, R3} //the exact inverse
+		OUT R1 //1
+		OUT R2 //2
+		OUT R3 //3
+
+		MOV R4, #100
+		MOV R5, #200
+		CALL _TRASH
+		OUT R4 //100, put back by the callee
+		OUT R5 //200
+		OUT R0 //51
+
+		MOV R1, #11
+		CMP R4, #100 //sets Z
+		PUSHM {R4, R5} //neither touches the flags
+		POPM {R4, R5}
+		JZ _FLAGS
+		MOV R1, #10
+_FLAGS:		OUT R1 //11, 10 if Z got lost
+		MOVFSP R2
+		OUT R2 //0, the stack is empty again
+		HLT
+
+//saves what it uses like a function prologue/epilogue would, leaves 51 in R0
+_TRASH:		PUSHM {R4, R5}
+		MOV R4, #25
+		MOV R5, #26
+		CLC
+		ADD R0, R4, R5
+		POPM {R4, R5}
+		RET
@@ -10,6 +10,17 @@ namespace phx=boost::phoenix;
 
 namespace
 {
+	//mask bits of first to last, either way around
+	i32 RegisterSpan(Registers::RegisterType first, const boost::optional<Registers::RegisterType>& last)
+	{
+		int from = first;
+		int to = last.is_initialized() ? *last : first;
+		if (from > to)
+			std::swap(from,to);
+
+		return ((1 << (to + 1)) - 1) & ~((1 << from) - 1);
+	}
+
 	template <typename Iterator, typename Skipper>
 	struct AsmLineParser : qi::grammar<Iterator, AsmLine(), Skipper>
 	{
@@ -38,14 +49,10 @@ namespace
 			constant.name("constant");
 			//qi::debug(constant);
 
-			ops.name("operation_code");
-			{
-				auto types = OpCodes::getTypes();
-				for (auto it=types.cbegin();it!=types.cend();++it)
-					ops.add(it->second,it->first);
-			}
+			mnemonic = qi::lexeme[+qi::alnum];
+			mnemonic.name("operation_code");
 
-			op_rule = qi::lexeme[qi::no_case[ops]];
+			op_rule = mnemonic[ _pass = phx::bind(&OpCodes::fromString,_1,_val) ];
 			op_rule.name("operation_mnem");
 			//qi::debug(op_rule);
 			qi::on_error<qi::fail>( op_rule, 
@@ -71,6 +78,28 @@ namespace
 			regoffs_rule.name("register+offset");
 			//qi::debug(regoffs_rule);
 
+			reg_span = (reg_rule >> -(lit('-') > reg_rule))[ _val = phx::bind(&RegisterSpan,_1,_2) ];
+			reg_span.name("register or range");
+			//qi::debug(reg_span);
+
+			//for PUSHM/POPM, {R1,R3-R5} is just the constant with those bits set
+			reg_list = qi::eps[ _val = 0 ] >> lit('{') > (reg_span[ _val |= _1 ] % ',') > lit('}');
+			reg_list.name("register list");
+			//qi::debug(reg_list);
+
+			//these go before register+offset, which would take the index register for a symbol
+			regindex_rule %= reg_rule >> lit('+') >> lexeme[reg_rule >> !(qi::alnum | char_('_'))] >> -(lit('*') > number);
+			regindex_rule.name("register+register*scale");
+			//qi::debug(regindex_rule);
+
+			postinc_rule = (reg_rule >> lit("++"))[ phx::bind(&AsmLine::PostInc::reg,_val) = _1 ];
+			postinc_rule.name("register++");
+			//qi::debug(postinc_rule);
+
+			regpair_rule %= reg_rule >> lit(':') >> reg_rule;
+			regpair_rule.name("register:register");
+			//qi::debug(regpair_rule);
+
 			duplication = qi::lexeme[qi::no_case[lit("dup")] > &qi::blank] > number;
 			duplication.name("duplication");
 			//qi::debug(duplication);
@@ -79,7 +108,7 @@ namespace
 				<< phx::val("Error! DUP expecting ") <<  _4	<<  phx::val(" here: '") <<  phx::construct<std::string>(_3,_2) <<  phx::val("'\n")
 				);
 
-			operands = (constant | regoffs_rule | reg_rule | identifier) % char_(',');
+			operands = (constant | reg_list | regpair_rule | postinc_rule | regindex_rule | regoffs_rule | reg_rule | identifier) % char_(',');
 			operands.name("operands");
 			//qi::debug(operands);
 
@@ -97,11 +126,16 @@ namespace
 		qi::rule<Iterator, string(), Skipper>					label;
 		qi::rule<Iterator, i32()>								number;
 		qi::rule<Iterator, i32()>								constant;
-		qi::symbols<char, OpCodes::OpCodeType>					ops;
+		qi::rule<Iterator, string()>							mnemonic;
 		qi::rule<Iterator, OpCodes::OpCodeType()>				op_rule;
 		qi::symbols<char, Registers::RegisterType>				regs;
 		qi::rule<Iterator,Registers::RegisterType()>			reg_rule;
 		qi::rule<Iterator,AsmLine::RegOffs(),Skipper>			regoffs_rule;
+		qi::rule<Iterator,AsmLine::RegIndex(),Skipper>			regindex_rule;
+		qi::rule<Iterator,AsmLine::PostInc(),Skipper>			postinc_rule;
+		qi::rule<Iterator,AsmLine::RegPair(),Skipper>			regpair_rule;
+		qi::rule<Iterator,i32(),Skipper>						reg_span;
+		qi::rule<Iterator,i32(),Skipper>						reg_list;
 		qi::rule<Iterator,vector<AsmLine::Operand>(),Skipper>	operands;
 		qi::rule<Iterator, int(), Skipper>						duplication;
 		qi::rule<Iterator, AsmLine(), Skipper>					start;
@@ -36,6 +36,14 @@ string AsmLine::toString() const
 			(*this)(val.first);
 			boost::apply_visitor(offsetVis,val.second);
 		}
+		void operator()(const AsmLine::RegIndex& val) const
+		{
+			out << Registers::toString(val.base) << "+" << Registers::toString(val.index);
+			if (val.scale.is_initialized())
+				out << "*" << *val.scale;
+		}
+		void operator()(const AsmLine::PostInc& val) const { out << Registers::toString(val.reg) << "++"; }
+		void operator()(const AsmLine::RegPair& val) const { out << Registers::toString(val.high) << ":" << Registers::toString(val.low); }
 		void operator()(const i32 val) const { out << "#" << val; }
 		void operator()(const string& val) const { out << val; }
 	private:
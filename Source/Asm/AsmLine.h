@@ -26,7 +26,20 @@ struct AsmLine
 	OpCodes::OpCodeType operation;
 	typedef boost::variant<i32,string> OffsType;
 	typedef std::pair<Registers::RegisterType,OffsType> RegOffs;
-	typedef boost::variant<i32,RegOffs,Registers::RegisterType,string> Operand;
+	struct RegIndex //base+index*scale
+	{
+		Registers::RegisterType base, index;
+		boost::optional<i32> scale; //1 if not given
+	};
+	struct PostInc //reg++
+	{
+		Registers::RegisterType reg;
+	};
+	struct RegPair //high:low
+	{
+		Registers::RegisterType high, low;
+	};
+	typedef boost::variant<i32,RegOffs,Registers::RegisterType,string,RegIndex,PostInc,RegPair> Operand;
 	vector<Operand> operands;
 	boost::optional<int> dupCount;
 	boost::optional<size_t> insPos;
@@ -62,6 +75,21 @@ struct AsmLine
 
 #include <boost/fusion/adapted.hpp>
 
+BOOST_FUSION_ADAPT_STRUCT
+(
+	AsmLine::RegIndex,
+	(Registers::RegisterType, base)
+	(Registers::RegisterType, index)
+	(boost::optional<i32>, scale)
+);
+
+BOOST_FUSION_ADAPT_STRUCT
+(
+	AsmLine::RegPair,
+	(Registers::RegisterType, high)
+	(Registers::RegisterType, low)
+);
+
 BOOST_FUSION_ADAPT_STRUCT
 (
 	AsmLine,
@@ -120,65 +120,128 @@ void BinaryFile::verifyInteger( i32 val, size_t size )
 	}	
 }
 
-u8 BinaryFile::evalOperand( const AsmLine::Operand& op, size_t num, boost::optional<u16>* remainder /*= nullptr*/, bool dst /*= false*/, bool rel /*= false*/, size_t currIP /*= 0*/ )
+u8 BinaryFile::evalOperand( const AsmLine::Operand& op, const string& name, OpCodes::Arg arg, boost::optional<u16>& word, size_t currIP )
 {
-	string regName = "src";
-	if (dst)
-		regName = "dst";
-	else
-		regName += lexical_cast<string>(num+1);
+	const bool addressed = (arg == OpCodes::ARG_ADDRESS || arg == OpCodes::ARG_TARGET);
+	const bool rel = (arg == OpCodes::ARG_TARGET);
+	if (arg == OpCodes::ARG_MASK && op.type() != typeid(i32)) //the parser turns {R1,R3-R5} into one
+		throw InstructionException(name + " must be a register list !");
+	else if (arg == OpCodes::ARG_INDEXED && op.type() != typeid(AsmLine::RegIndex))
+		throw InstructionException(name + " must be Register+Register*Scale !");
+	else if (arg == OpCodes::ARG_POSTINC && op.type() != typeid(AsmLine::PostInc))
+		throw InstructionException(name + " must be Register++ !");
+	else if (op.type() == typeid(AsmLine::RegIndex) && arg != OpCodes::ARG_INDEXED)
+		throw InstructionException("Register+Register*Scale addressing is only for LDR and STR addresses");
+	else if (op.type() == typeid(AsmLine::PostInc) && arg != OpCodes::ARG_POSTINC)
+		throw InstructionException("Register++ addressing is only for LDR and STR addresses");
+	else if (arg == OpCodes::ARG_PAIR && op.type() != typeid(AsmLine::RegPair))
+		throw InstructionException(name + " must be a register pair like R3:R2 !");
+	else if (arg == OpCodes::ARG_PAIR_VALUE && op.type() != typeid(AsmLine::RegPair) && op.type() != typeid(i32))
+		throw InstructionException(name + " must be a register pair like R3:R2 or a constant !");
+	else if (op.type() == typeid(AsmLine::RegPair) && arg != OpCodes::ARG_PAIR && arg != OpCodes::ARG_PAIR_VALUE)
+		throw InstructionException("Register pairs can only be the 32 bit operands of ADD32, SUB32, CMP32, SAL32 and SAR32");
+	else if (arg == OpCodes::ARG_COUNT) //there's no field left for it, the word has the register
+	{
+		if (op.type() != typeid(Registers::RegisterType))
+			throw InstructionException(name + " must be a register !");
+
+		auto countReg = boost::get<Registers::RegisterType>(op);
+		verifyRegister(countReg,name);
+		word = static_cast<u16>(countReg);
+		return 0;
+	}
+	else if (op.type() == typeid(AsmLine::RegPair))
+	{
+		auto srcPair = boost::get<const AsmLine::RegPair&>(op);
+		verifyRegister(srcPair.high,name + " high");
+		verifyRegister(srcPair.low,name + " low");
+		if ((srcPair.low & 1) || srcPair.high != srcPair.low + 1)
+			throw InstructionException(name + " must be an odd register and the even one below it, like R3:R2");
 
-	if (op.type() == typeid(Registers::RegisterType))
+		return static_cast<u8>(srcPair.low);
+	}
+	else if (arg == OpCodes::ARG_PAIR_VALUE) //a constant, which the word holds sign extended
+	{
+		auto srcConst = boost::get<i32>(op);
+		if (srcConst < -32768 || srcConst > 32767)
+			throw InstructionException("32 bit constants are sign extended from a word, it has to be -32768 to 32767, have " + lexical_cast<string>(srcConst));
+
+		word = static_cast<u16>(srcConst);
+		return static_cast<u8>(Registers::REG_CONSTANT);
+	}
+	else if (op.type() == typeid(AsmLine::RegIndex))
+	{
+		auto srcIndex = boost::get<const AsmLine::RegIndex&>(op);
+		verifyRegister(srcIndex.base,name);
+		verifyRegister(srcIndex.index,name + " index");
+		i32 scale = srcIndex.scale.is_initialized() ? *srcIndex.scale : 1;
+		u16 shift = 0;
+		while (shift < 4 && (1 << shift) != scale)
+			shift++;
+		if (shift == 4)
+			throw InstructionException("Index can only be scaled by 1, 2, 4 or 8, have " + lexical_cast<string>(scale));
+
+		word = static_cast<u16>(srcIndex.index | (shift << 4));
+		return static_cast<u8>(srcIndex.base);
+	}
+	else if (op.type() == typeid(AsmLine::PostInc))
+	{
+		auto srcReg = boost::get<const AsmLine::PostInc&>(op).reg;
+		verifyRegister(srcReg,name);
+		return static_cast<u8>(srcReg);
+	}
+	else if (op.type() == typeid(Registers::RegisterType))
 	{
 		auto srcReg = boost::get<Registers::RegisterType>(op);
-		verifyRegister(srcReg,regName);
-		return static_cast<u8>(srcReg) << ((1-num)*4);
+		verifyRegister(srcReg,name);
+		if (addressed) //if we have memory, we must be 4 bytes even its just register
+			word = 0;
+
+		return static_cast<u8>(srcReg);
 	}
-	else
+	else if (arg == OpCodes::ARG_REG)
+		throw InstructionException(name + " must be a register !");
+	else if (op.type() == typeid(i32))
 	{
-		if (remainder == nullptr)
-			assert(0 && "Remainder null when we need it");
+		auto srcConst = boost::get<i32>(op);
+		verifyInteger(srcConst,sizeof(u16));
+		word = static_cast<u16>(srcConst);
+		return static_cast<u8>(Registers::REG_CONSTANT);
+	}
+	else if (op.type() == typeid(string))
+	{
+		auto srcSymbol = boost::get<const string&>(op);
+		word = resolveSymbol(currIP,srcSymbol,rel,nullptr);
+		return static_cast<u8>(Registers::REG_CONSTANT);
+	}
+	else if (op.type() == typeid(AsmLine::RegOffs))
+	{
+		if (!addressed)
+			throw InstructionException("Register+Offset addressing not allowed in arithmetic instructions");
 
-		if (op.type() == typeid(i32))
+		auto srcRegOffs = boost::get<const AsmLine::RegOffs&>(op);
+		auto srcReg = srcRegOffs.first;
+		verifyRegister(srcReg,name);
+		if (srcRegOffs.second.type() == typeid(i32))
 		{
-			auto srcConst = boost::get<i32>(op);
-			verifyInteger(srcConst,sizeof(u16));
-			*remainder = static_cast<u16>(srcConst);
-			return static_cast<u8>(Registers::REG_CONSTANT) << ((1-num)*4);
+			auto offsInt = boost::get<i32>(srcRegOffs.second);
+			verifyInteger(offsInt,sizeof(u16));
+			word = static_cast<u16>(offsInt);
 		}
-		else if (op.type() == typeid(string))
+		else if (srcRegOffs.second.type() == typeid(string))
 		{
-			auto srcSymbol = boost::get<const string&>(op);
-			*remainder = resolveSymbol(currIP,srcSymbol,rel,nullptr);
-			return static_cast<u8>(Registers::REG_CONSTANT) << ((1-num)*4);
-		}
-		else if (op.type() == typeid(AsmLine::RegOffs))
-		{
-			auto srcRegOffs = boost::get<const AsmLine::RegOffs&>(op);
-			auto srcReg = srcRegOffs.first;
-			verifyRegister(srcReg,regName);
-			u8 operand = static_cast<u8>(srcReg) << ((1-num)*4);
-			if (srcRegOffs.second.type() == typeid(i32))
-			{
-				auto offsInt = boost::get<i32>(srcRegOffs.second);
-				verifyInteger(offsInt,sizeof(u16));
-				*remainder = static_cast<u16>(offsInt);
-			}
-			else if (srcRegOffs.second.type() == typeid(string))
-			{
-				auto offsSym = boost::get<const string&>(srcRegOffs.second);
-				*remainder = resolveSymbol(currIP,offsSym,rel,nullptr);
-			}
-			else
-				assert(0 && "Unimplemented offset type");
-
-			return operand;
+			auto offsSym = boost::get<const string&>(srcRegOffs.second);
+			word = resolveSymbol(currIP,offsSym,rel,nullptr);
 		}
 		else
-		{
-			assert(0 && "Unimplemented operand type");
-			return 0;
-		}
+			assert(0 && "Unimplemented offset type");
+
+		return static_cast<u8>(srcReg);
+	}
+	else
+	{
+		assert(0 && "Unimplemented operand type");
+		return 0;
 	}
 }
 
@@ -202,7 +265,9 @@ size_t BinaryFile::synthesizeLine( const AsmLine& line )
 
 	if (line.directive())
 	{
-		if (line.countOperandType<Registers::RegisterType>() > 0 || line.countOperandType<AsmLine::RegOffs>() > 0)
+		if (line.countOperandType<Registers::RegisterType>() > 0 || line.countOperandType<AsmLine::RegOffs>() > 0 ||
+			line.countOperandType<AsmLine::RegIndex>() > 0 || line.countOperandType<AsmLine::PostInc>() > 0 ||
+			line.countOperandType<AsmLine::RegPair>() > 0)
 			throw InstructionException("Cannot use register addressing in directives");
 
 		int dups = 1;
@@ -253,132 +318,35 @@ size_t BinaryFile::synthesizeLine( const AsmLine& line )
 		size_t numConstants = line.countOperandType<i32>() + line.countOperandType<AsmLine::RegOffs>() + line.countOperandType<string>();
 		if (numConstants > 1)
 			throw InstructionException("Only one constant or offset is allowed per instruction, have " + lexical_cast<string>(numConstants));
-		
-		u8 firstByte = static_cast<u32>(line.operation) & 0xFF;
-		u8 secondByte = 0;
-		boost::optional<u16> offset;
 
-		size_t opi = 0;
-		if (line.basic())
+		//the other addressing modes of an instruction are opcodes of their own
+		OpCodes::OpCodeType operation = line.operation;
+		if (line.countOperandType<AsmLine::RegIndex>() > 0)
+			operation = OpCodes::withAddressing(operation,OpCodes::ARG_INDEXED);
+		else if (line.countOperandType<AsmLine::PostInc>() > 0)
+			operation = OpCodes::withAddressing(operation,OpCodes::ARG_POSTINC);
+
+		//every operand goes into the field the table says, checked the way the decoder will
+		const OpCodes::Info& info = *OpCodes::info(operation);
+		u8 fields[OpCodes::FIELD_COUNT] = {0,0,0};
+		boost::optional<u16> word;
+		for (size_t i=0;i<line.operands.size();i++)
 		{
-			size_t numRegOffs = line.countOperandType<AsmLine::RegOffs>();
-			if (numRegOffs > 0)
-				throw InstructionException("Register+Offset addressing not allowed in arithmetic instructions");
-
-			//get dst
-			if (line.operation != OpCodes::OP_CMP)
-			{
-				try
-				{
-					auto dstReg = line.getOperand<Registers::RegisterType>(opi++);
-					verifyRegister(dstReg,"dst");
-					firstByte |= static_cast<u32>(dstReg) & 0xF;
-				}
-				catch(const boost::bad_get&)
-				{
-					throw InstructionException("Destination must be a register !");
-				}
-			}
-
-			//get srcs
-			for (size_t i=0;i<line.operands.size()-opi;i++)
-			{
-				size_t opOffs = opi+i;
-				secondByte |= evalOperand(line.operands.at(opOffs),i,&offset);
-			}
+			auto field = static_cast<OpCodes::Field>(info.operands[i]);
+			fields[field] = evalOperand(line.operands.at(i),OpCodes::fieldName(info,field),static_cast<OpCodes::Arg>(info.args[field]),word,currIP);
 		}
-		else
-		{
-			bool rel = false;
-			bool transferMem[] = {false,false}; //default for mov
-			bool oneIsDst = false;
-			switch (line.operation)
-			{
-				//no-operand
-			case OpCodes::OP_CLC:
-			case OpCodes::OP_STC:
-			case OpCodes::OP_NC:
-			case OpCodes::OP_RET:
-			case OpCodes::OP_HLT:
-				assert(secondByte == 0);
-				assert(!offset.is_initialized());
-				break;
-				//branching
-			case OpCodes::OP_JZ:
-			case OpCodes::OP_JGT:
-				rel = true; //for jz and jgt
-			case OpCodes::OP_JMP:
-			case OpCodes::OP_CALL:
-				//memory instruction, must have offset, even if only using direct register
-				offset = 0;
-				//no dst, so no OR
-				secondByte = evalOperand(line.operands.at(0),1,&offset,false,rel,currIP);
-				assert(offset.is_initialized());
-				break;
-				//transfers
-			case OpCodes::OP_LDR:
-			case OpCodes::OP_STR:
-				if (line.operation == OpCodes::OP_LDR)
-				{
-					transferMem[0] = false; //dst must be reg
-					transferMem[1] = true; //src must be mem
-				}
-				else //str
-				{
-					transferMem[0] = true; //dst must be mem
-					transferMem[1] = false; //src must be reg
-				}
-			case OpCodes::OP_MOV: //and ldr and str
-				for (size_t i=0;i<line.operands.size();i++)
-				{
-					bool isDst = true;
-					if (i > 0)
-						isDst = false;
 
-					if (transferMem[i] == false && (line.operation != OpCodes::OP_MOV || isDst)) //operand must be register (except in MOV reg, reg+offs, which is like LEA)
-					{
-						try
-						{
-							auto opReg = line.getOperand<Registers::RegisterType>(i);
-							secondByte |= evalOperand(line.operands.at(i),i,nullptr,isDst);
-						}
-						catch(const boost::bad_get&)
-						{
-							throw InstructionException((isDst?(string("dst")):(string("src")+lexical_cast<string>(i+1))) + " must be a register !");
-						}
-					}
-					else //operand is memory (or effective memory address)
-					{
-						//if we have memory, we must be 4 bytes even its just register
-						offset = 0;
-						secondByte |= evalOperand(line.operands.at(i),i,&offset,isDst);
-					}
-				}
-				break;
-				//one register
-			case OpCodes::OP_IN:
-			case OpCodes::OP_MOVF:
-			case OpCodes::OP_MOVFSP:
-				oneIsDst = true;
-			case OpCodes::OP_OUT:			
-			case OpCodes::OP_MOVTSP:
-				//operand must be register
-				try	{ auto opReg = line.getOperand<Registers::RegisterType>(0);	}
-				catch(const boost::bad_get&) { throw InstructionException((oneIsDst?string("dst"):string("src")) + " must be a register !"); }
-				//only one active, so no OR
-				secondByte = evalOperand(line.operands.at(0),(oneIsDst?0:1),nullptr,oneIsDst);
-				assert(!offset.is_initialized());
-				break;
-			default:
-				assert(0 && "Unknown opcode in synthesizer!");
-				break;
-			}
-		}
+		string error;
+		if (!OpCodes::checkFields(info,fields,error) || (word.is_initialized() && !OpCodes::checkWord(info,*word,error)))
+			throw InstructionException(error);
+		assert(word.is_initialized() == OpCodes::hasWord(info,fields));
 
+		u8 firstByte, secondByte;
+		OpCodes::encodeFields(info,fields,firstByte,secondByte);
 		byteCode << firstByte;
 		byteCode << secondByte;
-		if (offset.is_initialized())
-			byteCode << *offset;
+		if (word.is_initialized())
+			byteCode << *word;
 	}
 
 	return byteCode.pos() - currIP;
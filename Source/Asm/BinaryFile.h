@@ -81,7 +81,8 @@ private:
 
 	static void verifyRegister(Registers::RegisterType reg, string name, int num = -1);
 	static void verifyInteger(i32 val, size_t size);
-	u8 evalOperand(const AsmLine::Operand& op, size_t num, boost::optional<u16>* remainder = nullptr, bool dst = false, bool rel = false, size_t currIP = 0);
+	//register field value for op, a constant, address or offset in it goes to word
+	u8 evalOperand(const AsmLine::Operand& op, const string& name, OpCodes::Arg arg, boost::optional<u16>& word, size_t currIP);
 
 	BufferPtr& byteCode;
 
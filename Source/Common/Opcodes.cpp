@@ -1,91 +1,356 @@
 #include "Opcodes.h"
+#include "Registers.h"
+#include <cassert>
+#include <cctype>
+#include <cstring>
 
-map<OpCodes::OpCodeType,string> OpCodes::types;
+const OpCodes::Info OpCodes::Table[OpCodes::TABLE_SIZE] =
+{
+	//op		name		form				dst, src1, src2								operands in source order				flags
+	{ OP_ADD,	"add",		FORM_ARITHMETIC,	{ ARG_REG, ARG_VALUE, ARG_VALUE },		{ FIELD_DST, FIELD_SRC1, FIELD_SRC2 },	FLAG_WRITES_DST },
+	{ OP_SUB,	"sub",		FORM_ARITHMETIC,	{ ARG_REG, ARG_VALUE, ARG_VALUE },		{ FIELD_DST, FIELD_SRC1, FIELD_SRC2 },	FLAG_WRITES_DST },
+	{ OP_CMP,	"cmp",		FORM_ARITHMETIC,	{ ARG_NONE, ARG_VALUE, ARG_VALUE },		{ FIELD_SRC1, FIELD_SRC2, NO_FIELD },	0 },
+	{ OP_SAR,	"sar",		FORM_ARITHMETIC,	{ ARG_REG, ARG_VALUE, ARG_VALUE },		{ FIELD_DST, FIELD_SRC1, FIELD_SRC2 },	FLAG_WRITES_DST },
+	{ OP_SAL,	"sal",		FORM_ARITHMETIC,	{ ARG_REG, ARG_VALUE, ARG_VALUE },		{ FIELD_DST, FIELD_SRC1, FIELD_SRC2 },	FLAG_WRITES_DST },
+	{ OP_AND,	"and",		FORM_ARITHMETIC,	{ ARG_REG, ARG_VALUE, ARG_VALUE },		{ FIELD_DST, FIELD_SRC1, FIELD_SRC2 },	FLAG_WRITES_DST },
+	{ OP_OR,	"or",		FORM_ARITHMETIC,	{ ARG_REG, ARG_VALUE, ARG_VALUE },		{ FIELD_DST, FIELD_SRC1, FIELD_SRC2 },	FLAG_WRITES_DST },
+	{ OP_NOT,	"not",		FORM_ARITHMETIC,	{ ARG_REG, ARG_VALUE, ARG_NONE },		{ FIELD_DST, FIELD_SRC1, NO_FIELD },	FLAG_WRITES_DST },
+
+	{ OP_JMP,	"jmp",		FORM_EXTENDED,		{ ARG_NONE, ARG_ADDRESS, ARG_NONE },	{ FIELD_SRC1, NO_FIELD, NO_FIELD },		0 },
+	{ OP_JZ,	"jz",		FORM_EXTENDED,		{ ARG_NONE, ARG_TARGET, ARG_NONE },		{ FIELD_SRC1, NO_FIELD, NO_FIELD },		FLAG_CONDITIONAL },
+	{ OP_JGT,	"jgt",		FORM_EXTENDED,		{ ARG_NONE, ARG_TARGET, ARG_NONE },		{ FIELD_SRC1, NO_FIELD, NO_FIELD },		FLAG_CONDITIONAL },
+	{ OP_MOV,	"mov",		FORM_EXTENDED,		{ ARG_REG, ARG_ADDRESS, ARG_NONE },		{ FIELD_DST, FIELD_SRC1, NO_FIELD },	FLAG_WRITES_DST }, //reg+offset is like LEA
+	{ OP_LDR,	"ldr",		FORM_EXTENDED,		{ ARG_REG, ARG_ADDRESS, ARG_NONE },		{ FIELD_DST, FIELD_SRC1, NO_FIELD },	FLAG_WRITES_DST | FLAG_LOAD },
+	{ OP_STR,	"str",		FORM_EXTENDED,		{ ARG_ADDRESS, ARG_REG, ARG_NONE },		{ FIELD_DST, FIELD_SRC1, NO_FIELD },	FLAG_STORE },
+	{ OP_IN,	"in",		FORM_EXTENDED,		{ ARG_REG, ARG_NONE, ARG_NONE },		{ FIELD_DST, NO_FIELD, NO_FIELD },		FLAG_WRITES_DST },
+	{ OP_OUT,	"out",		FORM_EXTENDED,		{ ARG_NONE, ARG_REG, ARG_NONE },		{ FIELD_SRC1, NO_FIELD, NO_FIELD },		0 },
+	{ OP_CLC,	"clc",		FORM_EXTENDED,		{ ARG_NONE, ARG_NONE, ARG_NONE },		{ NO_FIELD, NO_FIELD, NO_FIELD },		0 },
+	{ OP_STC,	"stc",		FORM_EXTENDED,		{ ARG_NONE, ARG_NONE, ARG_NONE },		{ NO_FIELD, NO_FIELD, NO_FIELD },		0 },
+	{ OP_NC,	"nc",		FORM_EXTENDED,		{ ARG_NONE, ARG_NONE, ARG_NONE },		{ NO_FIELD, NO_FIELD, NO_FIELD },		0 },
+	{ OP_MOVF,	"movf",		FORM_EXTENDED,		{ ARG_REG, ARG_NONE, ARG_NONE },		{ FIELD_DST, NO_FIELD, NO_FIELD },		FLAG_WRITES_DST },
+	{ OP_MOVTSP,"movtsp",	FORM_EXTENDED,		{ ARG_NONE, ARG_REG, ARG_NONE },		{ FIELD_SRC1, NO_FIELD, NO_FIELD },		0 },
+	{ OP_MOVFSP,"movfsp",	FORM_EXTENDED,		{ ARG_REG, ARG_NONE, ARG_NONE },		{ FIELD_DST, NO_FIELD, NO_FIELD },		FLAG_WRITES_DST },
+	{ OP_CALL,	"call",		FORM_EXTENDED,		{ ARG_NONE, ARG_ADDRESS, ARG_NONE },	{ FIELD_SRC1, NO_FIELD, NO_FIELD },		0 },
+	{ OP_RET,	"ret",		FORM_EXTENDED,		{ ARG_NONE, ARG_NONE, ARG_NONE },		{ NO_FIELD, NO_FIELD, NO_FIELD },		0 },
+	{ OP_HLT,	"hlt",		FORM_EXTENDED,		{ ARG_NONE, ARG_NONE, ARG_NONE },		{ NO_FIELD, NO_FIELD, NO_FIELD },		0 },
+	//dst op= src, like MOV these are two operand
+	{ OP_MUL,	"mul",		FORM_EXTENDED,		{ ARG_REG, ARG_VALUE, ARG_NONE },		{ FIELD_DST, FIELD_SRC1, NO_FIELD },	FLAG_WRITES_DST },
+	{ OP_MULH,	"mulh",		FORM_EXTENDED,		{ ARG_REG, ARG_VALUE, ARG_NONE },		{ FIELD_DST, FIELD_SRC1, NO_FIELD },	FLAG_WRITES_DST },
+	{ OP_IMULH,	"imulh",	FORM_EXTENDED,		{ ARG_REG, ARG_VALUE, ARG_NONE },		{ FIELD_DST, FIELD_SRC1, NO_FIELD },	FLAG_WRITES_DST },
+	{ OP_DIV,	"div",		FORM_EXTENDED,		{ ARG_REG, ARG_VALUE, ARG_NONE },		{ FIELD_DST, FIELD_SRC1, NO_FIELD },	FLAG_WRITES_DST },
+	{ OP_IDIV,	"idiv",		FORM_EXTENDED,		{ ARG_REG, ARG_VALUE, ARG_NONE },		{ FIELD_DST, FIELD_SRC1, NO_FIELD },	FLAG_WRITES_DST },
+	{ OP_MOD,	"mod",		FORM_EXTENDED,		{ ARG_REG, ARG_VALUE, ARG_NONE },		{ FIELD_DST, FIELD_SRC1, NO_FIELD },	FLAG_WRITES_DST },
+	{ OP_IMOD,	"imod",		FORM_EXTENDED,		{ ARG_REG, ARG_VALUE, ARG_NONE },		{ FIELD_DST, FIELD_SRC1, NO_FIELD },	FLAG_WRITES_DST },
+	//the stack CALL and RET use, PUSHM goes from the highest register down so POPM takes them back lowest first
+	{ OP_PUSH,	"push",		FORM_EXTENDED,		{ ARG_NONE, ARG_REG, ARG_NONE },		{ FIELD_SRC1, NO_FIELD, NO_FIELD },		FLAG_STORE },
+	{ OP_POP,	"pop",		FORM_EXTENDED,		{ ARG_REG, ARG_NONE, ARG_NONE },		{ FIELD_DST, NO_FIELD, NO_FIELD },		FLAG_WRITES_DST | FLAG_LOAD },
+	{ OP_PUSHM,	"pushm",	FORM_EXTENDED,		{ ARG_NONE, ARG_MASK, ARG_NONE },		{ FIELD_SRC1, NO_FIELD, NO_FIELD },		FLAG_STORE },
+	{ OP_POPM,	"popm",		FORM_EXTENDED,		{ ARG_NONE, ARG_MASK, ARG_NONE },		{ FIELD_SRC1, NO_FIELD, NO_FIELD },		FLAG_LOAD },
+	//the other addressing modes of LDR and STR, which is what the assembler uses for R1+R2*2 and R1++ operands
+	{ OP_LDRX,	"ldrx",		FORM_EXTENDED,		{ ARG_REG, ARG_INDEXED, ARG_NONE },		{ FIELD_DST, FIELD_SRC1, NO_FIELD },	FLAG_WRITES_DST | FLAG_LOAD },
+	{ OP_STRX,	"strx",		FORM_EXTENDED,		{ ARG_INDEXED, ARG_REG, ARG_NONE },		{ FIELD_DST, FIELD_SRC1, NO_FIELD },	FLAG_STORE },
+	{ OP_LDRP,	"ldrp",		FORM_EXTENDED,		{ ARG_REG, ARG_POSTINC, ARG_NONE },		{ FIELD_DST, FIELD_SRC1, NO_FIELD },	FLAG_WRITES_DST | FLAG_LOAD },
+	{ OP_STRP,	"strp",		FORM_EXTENDED,		{ ARG_POSTINC, ARG_REG, ARG_NONE },		{ FIELD_DST, FIELD_SRC1, NO_FIELD },	FLAG_STORE },
+	//the rest of the conditions, signed ones compare N with O like JGT does. Only ADD, SUB, CMP and the 32 bit ones
+	//set O, anything else that sets N clears it, so after those JLT is just N
+	{ OP_JNZ,	"jnz",		FORM_EXTENDED,		{ ARG_NONE, ARG_TARGET, ARG_NONE },		{ FIELD_SRC1, NO_FIELD, NO_FIELD },		FLAG_CONDITIONAL },
+	{ OP_JLT,	"jlt",		FORM_EXTENDED,		{ ARG_NONE, ARG_TARGET, ARG_NONE },		{ FIELD_SRC1, NO_FIELD, NO_FIELD },		FLAG_CONDITIONAL },
+	{ OP_JGE,	"jge",		FORM_EXTENDED,		{ ARG_NONE, ARG_TARGET, ARG_NONE },		{ FIELD_SRC1, NO_FIELD, NO_FIELD },		FLAG_CONDITIONAL },
+	{ OP_JLE,	"jle",		FORM_EXTENDED,		{ ARG_NONE, ARG_TARGET, ARG_NONE },		{ FIELD_SRC1, NO_FIELD, NO_FIELD },		FLAG_CONDITIONAL },
+	{ OP_JC,	"jc",		FORM_EXTENDED,		{ ARG_NONE, ARG_TARGET, ARG_NONE },		{ FIELD_SRC1, NO_FIELD, NO_FIELD },		FLAG_CONDITIONAL },
+	{ OP_JNC,	"jnc",		FORM_EXTENDED,		{ ARG_NONE, ARG_TARGET, ARG_NONE },		{ FIELD_SRC1, NO_FIELD, NO_FIELD },		FLAG_CONDITIONAL },
+	{ OP_JO,	"jo",		FORM_EXTENDED,		{ ARG_NONE, ARG_TARGET, ARG_NONE },		{ FIELD_SRC1, NO_FIELD, NO_FIELD },		FLAG_CONDITIONAL },
+	{ OP_JN,	"jn",		FORM_EXTENDED,		{ ARG_NONE, ARG_TARGET, ARG_NONE },		{ FIELD_SRC1, NO_FIELD, NO_FIELD },		FLAG_CONDITIONAL },
+	//dst--, then jumps unless that made it 0. Leaves the flags alone
+	{ OP_LOOP,	"loop",		FORM_EXTENDED,		{ ARG_REG, ARG_TARGET, ARG_NONE },		{ FIELD_DST, FIELD_SRC1, NO_FIELD },	FLAG_WRITES_DST | FLAG_CONDITIONAL },
+	//a single byte at any address, LDRB zero extends it and LDRSB sign extends it. STRB stores the low byte
+	{ OP_LDRB,	"ldrb",		FORM_EXTENDED,		{ ARG_REG, ARG_ADDRESS, ARG_NONE },		{ FIELD_DST, FIELD_SRC1, NO_FIELD },	FLAG_WRITES_DST | FLAG_LOAD },
+	{ OP_LDRSB,	"ldrsb",	FORM_EXTENDED,		{ ARG_REG, ARG_ADDRESS, ARG_NONE },		{ FIELD_DST, FIELD_SRC1, NO_FIELD },	FLAG_WRITES_DST | FLAG_LOAD },
+	{ OP_STRB,	"strb",		FORM_EXTENDED,		{ ARG_ADDRESS, ARG_REG, ARG_NONE },		{ FIELD_DST, FIELD_SRC1, NO_FIELD },	FLAG_STORE },
+	//32 bit values in register pairs, written R3:R2. Z and N are of the whole result, C is the carry (or borrow) out of it
+	//without one going in, so CMP32 followed by JC is an unsigned compare. Shifts set C like SAL and SAR do
+	{ OP_ADD32,	"add32",	FORM_EXTENDED,		{ ARG_PAIR, ARG_PAIR_VALUE, ARG_NONE },	{ FIELD_DST, FIELD_SRC1, NO_FIELD },	FLAG_WRITES_DST },
+	{ OP_SUB32,	"sub32",	FORM_EXTENDED,		{ ARG_PAIR, ARG_PAIR_VALUE, ARG_NONE },	{ FIELD_DST, FIELD_SRC1, NO_FIELD },	FLAG_WRITES_DST },
+	{ OP_CMP32,	"cmp32",	FORM_EXTENDED,		{ ARG_PAIR, ARG_PAIR_VALUE, ARG_NONE },	{ FIELD_DST, FIELD_SRC1, NO_FIELD },	0 },
+	{ OP_SAL32,	"sal32",	FORM_EXTENDED,		{ ARG_PAIR, ARG_VALUE, ARG_NONE },		{ FIELD_DST, FIELD_SRC1, NO_FIELD },	FLAG_WRITES_DST },
+	{ OP_SAR32,	"sar32",	FORM_EXTENDED,		{ ARG_PAIR, ARG_VALUE, ARG_NONE },		{ FIELD_DST, FIELD_SRC1, NO_FIELD },	FLAG_WRITES_DST },
+	//count bytes at the address in dst, all of them have to be in memory. MEMCPY copies from the address in src as if
+	//through a buffer, so the two can overlap. MEMSET fills with the low byte of src. MEMCMP sets Z if they're the same,
+	//otherwise N if dst has the lower byte where they first differ
+	{ OP_MEMCPY,"memcpy",	FORM_EXTENDED,		{ ARG_REG, ARG_REG, ARG_COUNT },		{ FIELD_DST, FIELD_SRC1, FIELD_SRC2 },	FLAG_STORE },
+	{ OP_MEMSET,"memset",	FORM_EXTENDED,		{ ARG_REG, ARG_REG, ARG_COUNT },		{ FIELD_DST, FIELD_SRC1, FIELD_SRC2 },	FLAG_STORE },
+	{ OP_MEMCMP,"memcmp",	FORM_EXTENDED,		{ ARG_REG, ARG_REG, ARG_COUNT },		{ FIELD_DST, FIELD_SRC1, FIELD_SRC2 },	FLAG_LOAD },
+
+	{ DIR_DB,	"db",		FORM_DIRECTIVE,		{ ARG_NONE, ARG_NONE, ARG_NONE },		{ NO_FIELD, NO_FIELD, NO_FIELD },		0 },
+	{ DIR_DW,	"dw",		FORM_DIRECTIVE,		{ ARG_NONE, ARG_NONE, ARG_NONE },		{ NO_FIELD, NO_FIELD, NO_FIELD },		0 }
+};
 
-void OpCodes::populate()
+namespace
 {
-	if (!types.size())
-	{
-		using std::make_pair;
-
-		types.insert(make_pair(OP_ADD, "add"));
-		types.insert(make_pair(OP_SUB, "sub"));
-		types.insert(make_pair(OP_CMP, "cmp"));
-		types.insert(make_pair(OP_SAR, "sar"));
-		types.insert(make_pair(OP_SAL, "sal"));
-		types.insert(make_pair(OP_AND, "and"));
-		types.insert(make_pair(OP_OR,	"or"));
-		types.insert(make_pair(OP_NOT, "not"));
-
-		types.insert(make_pair(OP_JMP, "jmp"));
-		types.insert(make_pair(OP_JZ,	"jz"));
-		types.insert(make_pair(OP_JGT, "jgt"));
-		types.insert(make_pair(OP_MOV, "mov"));
-		types.insert(make_pair(OP_LDR, "ldr"));
-		types.insert(make_pair(OP_STR, "str"));
-		types.insert(make_pair(OP_IN,	"in"));
-		types.insert(make_pair(OP_OUT, "out"));
-		types.insert(make_pair(OP_CLC, "clc"));
-		types.insert(make_pair(OP_STC, "stc"));
-		types.insert(make_pair(OP_NC,	"nc"));
-		types.insert(make_pair(OP_MOVF, "movf"));
-		types.insert(make_pair(OP_MOVTSP, "movtsp"));
-		types.insert(make_pair(OP_MOVFSP, "movfsp"));
-		types.insert(make_pair(OP_CALL, "call"));
-		types.insert(make_pair(OP_RET, "ret"));
-		types.insert(make_pair(OP_HLT, "hlt"));
-
-		types.insert(make_pair(DIR_DB, "db"));
-		types.insert(make_pair(DIR_DW, "dw"));
+	enum
+	{
+		HASH_SLOTS = 512 //power of two, enough bigger than the table that a seed without collisions turns up quickly
+	};
+
+	//FNV-1a of the lowercase name, mixed with seed
+	u32 HashName(const char* name, size_t len, u32 seed)
+	{
+		u32 hash = 2166136261u ^ seed;
+		for (size_t i=0;i<len;i++)
+		{
+			hash ^= static_cast<u8>(tolower(static_cast<u8>(name[i])));
+			hash *= 16777619u;
+		}
+		return (hash ^ (hash >> 16)) & (HASH_SLOTS - 1);
 	}
-}
 
+	//what gets derived from the table, built during static initialization and only read after
+	struct Derived
+	{
+		Derived();
 
-string OpCodes::toString( OpCodeType type )
+		u32 seed; //the one that hashes every name to a different slot
+		u8 slots[HASH_SLOTS]; //Table index + 1 of the name in that slot, 0 if none
+		u8 decode[256]; //Table index for each first byte of an instruction
+	} Tables;
+
+	Derived::Derived()
+	{
+		for (size_t i=0;i<OpCodes::TABLE_SIZE;i++)
+			assert(OpCodes::index(OpCodes::Table[i].op) == i && "Table has to be in index order");
+
+		//perfect hash, try seeds until no two names share a slot
+		for (seed=0;;seed++)
+		{
+			memset(slots,0,sizeof(slots));
+			size_t i;
+			for (i=0;i<OpCodes::TABLE_SIZE;i++)
+			{
+				const char* name = OpCodes::Table[i].name;
+				u8& slot = slots[HashName(name,strlen(name),seed)];
+				if (slot != 0)
+					break;
+
+				slot = static_cast<u8>(i + 1);
+			}
+			if (i == OpCodes::TABLE_SIZE)
+				break;
+		}
+
+		memset(decode,OpCodes::INVALID_INDEX,sizeof(decode));
+		for (size_t i=0;i<OpCodes::INSTRUCTION_COUNT;i++)
+		{
+			const OpCodes::Info& info = OpCodes::Table[i];
+			if (info.form == OpCodes::FORM_ARITHMETIC) //low nibble is dst
+			{
+				for (size_t dst=0;dst<0x10;dst++)
+					decode[info.op | dst] = static_cast<u8>(i);
+			}
+			else
+				decode[info.op] = static_cast<u8>(i);
+		}
+	}
+};
+
+int OpCodes::Info::numOperands() const
 {
-	populate();
-	auto it = types.find(type);
+	if (form == FORM_DIRECTIVE)
+		return -1;
 
-	if (it == types.end())
+	int num = 0;
+	while (num < FIELD_COUNT && operands[num] != NO_FIELD)
+		num++;
+	return num;
+}
+
+string OpCodes::toString( OpCodeType type )
+{
+	const Info* found = info(type);
+	if (found == nullptr)
 		return "UNKNOWN";
-	else 
-		return it->second;
+	else
+		return found->name;
 }
 
-int OpCodes::numOperands( OpCodeType operation )
+bool OpCodes::fromString( const string& name, OpCodeType& op )
+{
+	u8 slot = Tables.slots[HashName(name.c_str(),name.length(),Tables.seed)];
+	if (slot == 0)
+		return false;
+
+	const Info& found = Table[slot - 1];
+	if (strlen(found.name) != name.length())
+		return false;
+	for (size_t i=0;i<name.length();i++)
+	{
+		if (tolower(static_cast<u8>(name[i])) != found.name[i])
+			return false;
+	}
+
+	op = found.op;
+	return true;
+}
+
+u8 OpCodes::decodeIndex( u8 firstByte )
+{
+	return Tables.decode[firstByte];
+}
+
+void OpCodes::decodeFields( const Info& info, u8 firstByte, u8 secondByte, u8 fields[FIELD_COUNT] )
+{
+	if (info.form == FORM_ARITHMETIC)
+	{
+		fields[FIELD_DST] = firstByte & 0x0F;
+		fields[FIELD_SRC1] = (secondByte >> 4) & 0x0F;
+		fields[FIELD_SRC2] = (secondByte >> 0) & 0x0F;
+	}
+	else
+	{
+		fields[FIELD_DST] = (secondByte >> 4) & 0x0F;
+		fields[FIELD_SRC1] = (secondByte >> 0) & 0x0F;
+		fields[FIELD_SRC2] = 0;
+	}
+}
+
+void OpCodes::encodeFields( const Info& info, const u8 fields[FIELD_COUNT], u8& firstByte, u8& secondByte )
 {
-	switch (operation)
-	{
-	case OP_ADD:
-	case OP_SUB:
-	case OP_SAR:
-	case OP_SAL:
-	case OP_AND:
-	case OP_OR:
-		return 3;
-	case OP_NOT:
-	case OP_CMP:
-	case OP_MOV:
-	case OP_LDR:
-	case OP_STR:
-		return 2;
-	case OP_JMP:
-	case OP_JZ:
-	case OP_JGT:
-	case OP_IN:
-	case OP_OUT:
-	case OP_MOVF:
-	case OP_MOVTSP:
-	case OP_MOVFSP:
-	case OP_CALL:
-		return 1;
-	case OP_CLC:
-	case OP_STC:
-	case OP_NC:
-	case OP_RET:
-	case OP_HLT:
-		return 0;
+	if (info.form == FORM_ARITHMETIC)
+	{
+		firstByte = static_cast<u8>(info.op | fields[FIELD_DST]);
+		secondByte = static_cast<u8>((fields[FIELD_SRC1] << 4) | fields[FIELD_SRC2]);
+	}
+	else
+	{
+		firstByte = static_cast<u8>(info.op);
+		secondByte = static_cast<u8>((fields[FIELD_DST] << 4) | fields[FIELD_SRC1]);
+	}
+}
+
+bool OpCodes::checkFields( const Info& info, const u8 fields[FIELD_COUNT], string& error )
+{
+	for (size_t i=0;i<FIELD_COUNT;i++)
+	{
+		const Field field = static_cast<Field>(i);
+		const char* wrong = nullptr;
+		switch (info.args[field])
+		{
+		case ARG_NONE:
+		case ARG_COUNT:
+			if (fields[field] != 0)
+				wrong = " must be zero!";
+			break;
+		case ARG_REG:
+		case ARG_INDEXED:
+		case ARG_POSTINC:
+			if (fields[field] >= Registers::REG_CONSTANT)
+				wrong = " must be a register!";
+			break;
+		case ARG_MASK:
+			if (fields[field] != Registers::REG_CONSTANT)
+				wrong = " must be a register list!";
+			break;
+		case ARG_PAIR:
+		case ARG_PAIR_VALUE:
+			if (info.args[field] == ARG_PAIR_VALUE && fields[field] == Registers::REG_CONSTANT)
+				break;
+			if ((fields[field] & 1) || fields[field] + 1 >= Registers::REG_CONSTANT)
+				wrong = " must be a register pair!";
+			break;
+		default: //REG_CONSTANT means the word, but there's no constant destination
+			if (field == FIELD_DST && fields[field] >= Registers::REG_CONSTANT)
+				wrong = " must be a register!";
+			break;
+		}
+
+		if (wrong)
+		{
+			error = fieldName(info,field) + string(wrong);
+			return false;
+		}
+	}
+
+	if (fields[FIELD_SRC1] == Registers::REG_CONSTANT && fields[FIELD_SRC2] == Registers::REG_CONSTANT)
+	{
+		error = "Only src1 or src2 can be memory addresses, not both";
+		return false;
+	}
+	return true;
+}
+
+bool OpCodes::hasWord( const Info& info, const u8 fields[FIELD_COUNT] )
+{
+	for (size_t i=0;i<FIELD_COUNT;i++)
+	{
+		if (info.args[i] == ARG_ADDRESS || info.args[i] == ARG_TARGET || info.args[i] == ARG_MASK || info.args[i] == ARG_INDEXED ||
+			info.args[i] == ARG_COUNT)
+			return true;
+		if ((info.args[i] == ARG_VALUE || info.args[i] == ARG_PAIR_VALUE) && fields[i] == Registers::REG_CONSTANT)
+			return true;
+	}
+	return false;
+}
+
+bool OpCodes::checkWord( const Info& info, u16 word, string& error )
+{
+	for (size_t i=0;i<FIELD_COUNT;i++)
+	{
+		if (info.args[i] == ARG_MASK && (word >> Registers::REG_CONSTANT) != 0)
+		{
+			error = "Register list can't have the constant in it";
+			return false;
+		}
+		if (info.args[i] == ARG_INDEXED && ((word & 0x0F) >= Registers::REG_CONSTANT || (word >> 4) > 3))
+		{
+			error = "Index must be a register scaled by 1, 2, 4 or 8";
+			return false;
+		}
+		if (info.args[i] == ARG_COUNT && word >= Registers::REG_CONSTANT)
+		{
+			error = "Count must be a register";
+			return false;
+		}
+	}
+	return true;
+}
+
+OpCodes::OpCodeType OpCodes::withAddressing( OpCodeType op, Arg arg )
+{
+	struct Mode
+	{
+		OpCodeType op;
+		u8 arg; //Arg
+		OpCodeType with;
+	};
+	static const Mode Modes[] =
+	{
+		{ OP_LDR, ARG_INDEXED, OP_LDRX },
+		{ OP_STR, ARG_INDEXED, OP_STRX },
+		{ OP_LDR, ARG_POSTINC, OP_LDRP },
+		{ OP_STR, ARG_POSTINC, OP_STRP }
+	};
+	for (size_t i=0;i<lengthof(Modes);i++)
+	{
+		if (Modes[i].op == op && Modes[i].arg == arg)
+			return Modes[i].with;
+	}
+	return op;
+}
+
+const char* OpCodes::fieldName( const Info& info, Field field )
+{
+	switch (field)
+	{
+	case FIELD_DST:
+		return "dst";
+	case FIELD_SRC1:
+		return (info.form == FORM_ARITHMETIC) ? "src1" : "src";
 	default:
-		return -1;
+		return (info.args[field] == ARG_COUNT) ? "count" : "src2";
 	}
 }
+
+int OpCodes::numOperands( OpCodeType operation )
+{
+	const Info* found = info(operation);
+	return found ? found->numOperands() : -1;
+}
@@ -2,6 +2,8 @@
 
 #include "Types.h"
 
+//the instruction set. What the assembler, the emulator's decoder and the trace printer know about an instruction is
+//its row in Table (Opcodes.cpp), a new one is a row there plus what executes it
 struct OpCodes
 {
 	enum OpCodeType
@@ -34,6 +36,41 @@ struct OpCodes
 		OP_CALL,
 		OP_RET,
 		OP_HLT,
+		OP_MUL,
+		OP_MULH,
+		OP_IMULH,
+		OP_DIV,
+		OP_IDIV,
+		OP_MOD,
+		OP_IMOD,
+		OP_PUSH,
+		OP_POP,
+		OP_PUSHM,
+		OP_POPM,
+		OP_LDRX,
+		OP_STRX,
+		OP_LDRP,
+		OP_STRP,
+		OP_JNZ,
+		OP_JLT,
+		OP_JGE,
+		OP_JLE,
+		OP_JC,
+		OP_JNC,
+		OP_JO,
+		OP_JN,
+		OP_LOOP,
+		OP_LDRB,
+		OP_LDRSB,
+		OP_STRB,
+		OP_ADD32,
+		OP_SUB32,
+		OP_CMP32,
+		OP_SAL32,
+		OP_SAR32,
+		OP_MEMCPY,
+		OP_MEMSET,
+		OP_MEMCMP,
 		OP_COUNT,
 
 		//directives
@@ -42,19 +79,111 @@ struct OpCodes
 		DIR_COUNT
 	};
 
+	//how the bytes of an instruction are laid out
+	enum Form
+	{
+		FORM_ARITHMETIC, //[op | dst] [src1 | src2], plus the constant word if a source is REG_CONSTANT
+		FORM_EXTENDED, //[op] [dst | src1], plus the word for an address, a constant source, a register mask, an index or a count
+		FORM_DIRECTIVE //data, not an instruction
+	};
+	//the register fields of an encoded instruction
+	enum Field
+	{
+		FIELD_DST,
+		FIELD_SRC1,
+		FIELD_SRC2,
+		FIELD_COUNT,
+		NO_FIELD = FIELD_COUNT
+	};
+	//what a field holds, which is both what the assembler takes for that operand and what the decoder accepts
+	enum Arg
+	{
+		ARG_NONE, //unused, zero
+		ARG_REG, //a register
+		ARG_VALUE, //a register or a constant (REG_CONSTANT, with the value in the word)
+		ARG_ADDRESS, //register+offset or a constant, the offset or address always in the word
+		ARG_TARGET, //same, but a symbol in it is relative to the instruction
+		ARG_MASK, //always REG_CONSTANT, the word has a bit per register (R0 is bit 0)
+		ARG_INDEXED, //base register, the word has the index register in its low nibble and log2 of the scale above that
+		ARG_POSTINC, //a register that steps past the word once it's been accessed
+		ARG_PAIR, //an even register, which has the low word of a 32 bit value and the one after it the high word
+		ARG_PAIR_VALUE, //a pair or a constant (REG_CONSTANT, sign extended from the word)
+		ARG_COUNT //zero, the extended form has no src2 so the word has this register in its low nibble instead
+	};
+	enum Flags
+	{
+		FLAG_WRITES_DST = 1, //result goes to the dst register
+		FLAG_CONDITIONAL = 2, //branch that isn't always taken
+		FLAG_LOAD = 4, //reads memory at its address, or the top of the stack
+		FLAG_STORE = 8 //writes memory at its address, or the new top of the stack
+	};
+
+	struct Info
+	{
+		OpCodeType op;
+		const char* name;
+		u8 form; //Form
+		u8 args[FIELD_COUNT]; //Arg of each field
+		u8 operands[FIELD_COUNT]; //field each assembler operand goes into in source order, NO_FIELD after the last
+		u8 flags; //Flags
+
+		int numOperands() const; //-1 for directives, which take any number
+	};
+
+	enum
+	{
+		EXTENDED_INDEX = (OP_NOT >> 4) + 1, //Table index of the first non arithmetic op
+		INSTRUCTION_COUNT = EXTENDED_INDEX + (OP_COUNT - OP_JMP), //Table entries before the directives
+		TABLE_SIZE = INSTRUCTION_COUNT + (DIR_COUNT - DIR_DB),
+		INVALID_INDEX = 0xFF
+	};
+	//arithmetic ops (opcode >> 4), then extended ones (EXTENDED_INDEX + opcode - OP_JMP), then directives.
+	//Constant, everything derived from it gets built before main, so all of this is safe from any thread
+	static const Info Table[TABLE_SIZE];
+
+	static size_t index(OpCodeType op)
+	{
+		if (basic(op))
+			return op >> 4;
+		else if (extended(op))
+			return EXTENDED_INDEX + (op - OP_JMP);
+		else if (directive(op))
+			return INSTRUCTION_COUNT + (op - DIR_DB);
+		else
+			return TABLE_SIZE;
+	}
+	//past the instructions it's OP_COUNT and up, never a valid opcode
+	static OpCodeType fromIndex(size_t index)
+	{
+		if (index < EXTENDED_INDEX)
+			return static_cast<OpCodeType>(index << 4);
+		else
+			return static_cast<OpCodeType>(OP_JMP + (index - EXTENDED_INDEX));
+	}
+	static const Info* info(OpCodeType op) { return valid(op) ? &Table[index(op)] : nullptr; }
+
 	static string toString(OpCodeType type);
+	static bool fromString(const string& name, OpCodeType& op); //any case, false if it's not a mnemonic
+
+	//Table index of the instruction an encoding starting with firstByte is, INVALID_INDEX if none
+	static u8 decodeIndex(u8 firstByte);
+	static void decodeFields(const Info& info, u8 firstByte, u8 secondByte, u8 fields[FIELD_COUNT]);
+	static void encodeFields(const Info& info, const u8 fields[FIELD_COUNT], u8& firstByte, u8& secondByte);
+	//false with why in error if the fields aren't a valid encoding of info
+	static bool checkFields(const Info& info, const u8 fields[FIELD_COUNT], string& error);
+	//if the constant/offset word follows the first two bytes
+	static bool hasWord(const Info& info, const u8 fields[FIELD_COUNT]);
+	//false with why in error if the word isn't one info can have, only register masks, indexes and counts are restricted
+	static bool checkWord(const Info& info, u16 word, string& error);
+	//op for an address operand of kind arg (LDR with ARG_INDEXED is LDRX), op if it has no such form
+	static OpCodeType withAddressing(OpCodeType op, Arg arg);
+	static const char* fieldName(const Info& info, Field field);
 
 	static bool directive(OpCodeType operation) { return operation >= DIR_DB && operation < DIR_COUNT; }
-	static bool basic(OpCodeType operation) { return operation >= OP_ADD && operation <= OP_NOT; }
+	static bool basic(OpCodeType operation) { return operation >= OP_ADD && operation <= OP_NOT && (operation & 0x0F) == 0; }
 	static bool extended(OpCodeType operation) { return operation >= OP_JMP && operation < OP_COUNT; }
 	static bool opcode(OpCodeType operation) { return basic(operation) || extended(operation); }
 	static bool valid(OpCodeType operation) { return opcode(operation) || directive(operation); }
 
 	static int numOperands(OpCodeType operation);
-
-	static const map<OpCodeType,string>& getTypes() { populate(); return types; }
-
-private:
-	static void populate();
-	static map<OpCodeType,string> types;
-};
\ No newline at end of file
+};
@@ -7,6 +7,8 @@ typedef std::int16_t	i16;
 typedef std::uint16_t	u16;
 typedef std::int32_t	i32;
 typedef std::uint32_t	u32;
+typedef std::int64_t	i64;
+typedef std::uint64_t	u64;
 
 #include <vector>
 using std::vector;
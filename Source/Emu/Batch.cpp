@@ -0,0 +1,310 @@
+#include "Batch.h"
+#include "IoDevice.h"
+#include "Lanes.h"
+#include <fstream>
+#include <sstream>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <cstdlib>
+#include <stdio.h>
+
+namespace
+{
+	//every worker starts with its own slice of the jobs, takes from the back of it
+	//and steals from the front of the others once it runs dry
+	class WorkQueues
+	{
+	public:
+		WorkQueues(size_t numQueues, size_t numJobs)
+		{
+			for (size_t i=0;i<numQueues;i++)
+			{
+				queues.push_back(std::unique_ptr<Queue>(new Queue));
+				for (size_t job=i*numJobs/numQueues;job<(i+1)*numJobs/numQueues;job++)
+					queues.back()->jobs.push_back(job);
+			}
+		}
+
+		bool next(size_t worker, size_t& job)
+		{
+			for (size_t i=0;i<queues.size();i++)
+			{
+				Queue& queue = *queues[(worker + i) % queues.size()];
+				std::lock_guard<std::mutex> guard(queue.lock);
+				if (queue.jobs.empty())
+					continue;
+
+				if (i == 0)
+				{
+					job = queue.jobs.back();
+					queue.jobs.pop_back();
+				}
+				else
+				{
+					job = queue.jobs.front();
+					queue.jobs.pop_front();
+				}
+				return true;
+			}
+			return false; //nothing gets added while running, so everything is taken
+		}
+	private:
+		struct Queue
+		{
+			std::mutex lock;
+			std::deque<size_t> jobs;
+		};
+		vector<std::unique_ptr<Queue>> queues;
+	};
+
+	const char* StopName(u8 reason)
+	{
+		switch (reason)
+		{
+		case Cpu::Stop::STOP_BUDGET: return "budget";
+		case Cpu::Stop::STOP_HALT: return "halt";
+		case Cpu::Stop::STOP_FAULT: return "fault";
+		case Cpu::Stop::STOP_IO_WAIT: return "io_wait";
+		case Cpu::Stop::STOP_BREAKPOINT: return "breakpoint";
+		case Cpu::Stop::STOP_WATCHPOINT: return "watchpoint";
+		}
+		return "unknown";
+	}
+
+	string JsonString(const string& str)
+	{
+		string quoted = "\"";
+		for (auto it=str.begin();it!=str.end();++it)
+		{
+			u8 c = static_cast<u8>(*it);
+			if (c == '"' || c == '\\')
+			{
+				quoted += '\\';
+				quoted += *it;
+			}
+			else if (c < 0x20)
+			{
+				char escaped[8] = {0};
+				sprintf(escaped,"\\u%04x",static_cast<u32>(c));
+				quoted += escaped;
+			}
+			else
+				quoted += *it;
+		}
+		return quoted + "\"";
+	}
+};
+
+struct Batch::Worker
+{
+	Worker() : startProgram(nullptr) { cpu.io = &io; }
+
+	Cpu cpu;
+	VectorIo io;
+	Cpu::Snapshot start; //cpu with startProgram loaded, before it ran
+	const ByteVector* startProgram;
+	std::unique_ptr<Lanes> lanes;
+};
+
+bool Batch::load( std::istream& manifest, std::ostream& errors )
+{
+	string line;
+	for (size_t lineNum=1;std::getline(manifest,line);lineNum++)
+	{
+		std::istringstream words(line);
+		Job job;
+		string budgetStr;
+		if (!(words >> job.fileName) || job.fileName[0] == '#')
+			continue;
+
+		if (!(words >> budgetStr))
+		{
+			errors << "Line " << lineNum << ": budget (or - for none) missing" << std::endl;
+			return false;
+		}
+		if (budgetStr == "-")
+			job.budget = Cpu::NO_BUDGET;
+		else
+		{
+			char* end = nullptr;
+			job.budget = strtoull(budgetStr.c_str(),&end,0);
+			if (*end != 0)
+			{
+				errors << "Line " << lineNum << ": bad budget " << budgetStr << std::endl;
+				return false;
+			}
+		}
+
+		//anything that fits in 16 bits, like TextIo takes
+		string valueStr;
+		while (words >> valueStr)
+		{
+			char* end = nullptr;
+			long value = strtol(valueStr.c_str(),&end,0);
+			if (*end != 0 || value < -0x8000 || value > 0xFFFF)
+			{
+				errors << "Line " << lineNum << ": bad input value " << valueStr << std::endl;
+				return false;
+			}
+			job.input.push_back(static_cast<i16>(value));
+		}
+
+		auto found = programs.find(job.fileName);
+		if (found == programs.end())
+		{
+			std::ifstream inFile(job.fileName,std::ios::binary);
+			if (!inFile.is_open())
+			{
+				errors << "Line " << lineNum << ": error opening " << job.fileName << std::endl;
+				return false;
+			}
+
+			ByteVector objectCode((std::istreambuf_iterator<char>(inFile)),std::istreambuf_iterator<char>());
+			if (objectCode.empty() || objectCode.size() > Cpu::Memory::SIZE)
+			{
+				errors << "Line " << lineNum << ": " << job.fileName << " is empty or bigger than " << Cpu::Memory::SIZE << " bytes" << std::endl;
+				return false;
+			}
+			found = programs.insert(std::make_pair(job.fileName,objectCode)).first;
+		}
+		job.program = &found->second;
+		jobs.push_back(job);
+	}
+	return true;
+}
+
+void Batch::run( Engine engine, size_t numThreads, size_t laneWidth )
+{
+	//for lanes a work item is a group of jobs instead of a single one
+	size_t numItems = jobs.size();
+	if (engine == ENGINE_LANES)
+	{
+		laneWidth = std::max<size_t>(laneWidth,1);
+		groupJobs(laneWidth);
+		numItems = groups.size();
+	}
+
+	if (numThreads == 0)
+		numThreads = std::max<size_t>(std::thread::hardware_concurrency(),1);
+	numThreads = std::max<size_t>(std::min(numThreads,numItems),1);
+
+	results.clear();
+	results.resize(jobs.size());
+	WorkQueues queues(numThreads,numItems);
+
+	auto worker = [&](size_t workerNum)
+	{
+		//only the first job pays for allocating memory and the decode cache
+		Worker state;
+		size_t item;
+		while (queues.next(workerNum,item))
+		{
+			if (engine == ENGINE_LANES)
+			{
+				if (!state.lanes)
+					state.lanes.reset(new Lanes(laneWidth));
+				state.lanes->run(&jobs[groups[item].first],&results[groups[item].first],groups[item].second);
+			}
+			else
+				runJob(state,engine,item);
+		}
+	};
+
+	vector<std::thread> threads;
+	for (size_t i=1;i<numThreads;i++)
+		threads.push_back(std::thread(worker,i));
+	worker(0);
+	for (auto it=threads.begin();it!=threads.end();++it)
+		it->join();
+}
+
+void Batch::groupJobs( size_t laneWidth )
+{
+	groups.clear();
+	for (size_t i=0;i<jobs.size();i++)
+	{
+		if (!groups.empty())
+		{
+			std::pair<size_t,size_t>& last = groups.back();
+			const Job& first = jobs[last.first];
+			if (last.second < laneWidth && first.program == jobs[i].program && first.budget == jobs[i].budget)
+			{
+				last.second++;
+				continue;
+			}
+		}
+		groups.push_back(std::make_pair(i,static_cast<size_t>(1)));
+	}
+}
+
+void Batch::runJob( Worker& worker, Engine engine, size_t index )
+{
+	const Job& job = jobs[index];
+	Result& result = results[index];
+	Cpu& cpu = worker.cpu;
+	VectorIo& io = worker.io;
+
+	//the same program again only needs the pages the last job wrote put back, and keeps its decodes
+	if (worker.startProgram == job.program)
+		cpu.restore(worker.start);
+	else
+	{
+		cpu.reset();
+		cpu.mem.init(&(*job.program)[0],job.program->size());
+		cpu.snapshot(worker.start);
+		worker.startProgram = job.program;
+	}
+	io.input = job.input;
+	io.inputPos = 0;
+	io.output.clear();
+
+	if (engine == ENGINE_JIT)
+		result.stop = cpu.runJit(job.budget);
+	else if (engine == ENGINE_THREADED)
+	{
+		Cpu::NoInstrument none;
+		result.stop = cpu.runWith<Cpu::BatchPolicy>(job.budget,none); //io is always the worker's VectorIo
+	}
+	else if (engine == ENGINE_UNCHECKED)
+		result.stop = cpu.runUnchecked(job.budget); //verifies once per program, restore() only undoes stores to data
+	else
+		result.stop = cpu.runStepped(job.budget);
+
+	if (result.stop.reason == Cpu::Stop::STOP_FAULT)
+	{
+		try
+		{
+			cpu.throwIfFault(result.stop);
+		}
+		catch(const Cpu::CpuException& e)
+		{
+			result.error = e.toString();
+		}
+	}
+
+	for (size_t i=0;i<lengthof(result.regs);i++)
+		result.regs[i] = cpu.regs[i].u;
+	result.sp = cpu.mem.sp;
+	result.output.swap(io.output);
+}
+
+void Batch::write( std::ostream& out ) const
+{
+	for (size_t i=0;i<results.size();i++)
+	{
+		const Result& result = results[i];
+		out << "{\"job\":" << i << ",\"file\":" << JsonString(jobs[i].fileName) << ",\"stop\":\"" << StopName(result.stop.reason) << "\"" <<
+			",\"count\":" << result.stop.count << ",\"iep\":" << result.stop.iep << ",\"sp\":" << result.sp << ",\"regs\":[";
+		for (size_t r=0;r<lengthof(result.regs);r++)
+			out << (r ? "," : "") << static_cast<i16>(result.regs[r]);
+		out << "],\"out\":[";
+		for (size_t o=0;o<result.output.size();o++)
+			out << (o ? "," : "") << result.output[o];
+		out << "]";
+		if (!result.error.empty())
+			out << ",\"error\":" << JsonString(result.error);
+		out << "}\n";
+	}
+	out.flush();
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "Cpu.h"
+#include <istream>
+#include <ostream>
+
+class VectorIo;
+
+//runs lots of small jobs in one process, on a work stealing pool of threads that each reuse one Cpu,
+//going back to a snapshot of it when the next job has the same program
+class Batch
+{
+public:
+	enum Engine
+	{
+		ENGINE_THREADED,
+		ENGINE_JIT,
+		ENGINE_REFERENCE,
+		ENGINE_UNCHECKED, //threaded without per instruction checks, for programs Cpu::verify() passes
+		ENGINE_LANES //jobs with the same program and budget run together on Lanes
+	};
+	enum { DEFAULT_LANES = 64 };
+
+	struct Job
+	{
+		string fileName;
+		const ByteVector* program; //shared by every job with the same file
+		u64 budget;
+		vector<i16> input;
+	};
+
+	struct Result
+	{
+		Cpu::Stop stop;
+		u16 regs[Registers::REG_COUNT];
+		size_t sp;
+		vector<i16> output;
+		string error; //what the fault was, if it was one
+	};
+
+	//manifest lines are: objectFile budget|- [IN values...], blank lines and ones starting with # are skipped
+	bool load(std::istream& manifest, std::ostream& errors);
+	void run(Engine engine, size_t numThreads = 0, size_t laneWidth = DEFAULT_LANES); //0 is one per hardware thread
+	void write(std::ostream& out) const; //one JSON object per job, in manifest order
+
+	size_t size() const { return jobs.size(); }
+private:
+	struct Worker;
+	void runJob(Worker& worker, Engine engine, size_t index);
+	void groupJobs(size_t laneWidth); //fills groups with runs of consecutive jobs Lanes can take together
+
+	map<string,ByteVector> programs;
+	vector<Job> jobs;
+	vector<Result> results;
+	vector<std::pair<size_t,size_t>> groups; //first job and how many, for ENGINE_LANES
+};
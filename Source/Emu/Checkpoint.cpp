@@ -0,0 +1,306 @@
+#include "Checkpoint.h"
+#include <fstream>
+#include <chrono>
+#include <cstdio>
+
+namespace
+{
+	const char Magic[4] = {'S','C','K','1'};
+
+	//followed by the pages set in pages[], each a u16 length and that many bytes of EncodePage() output
+	struct Header
+	{
+		char magic[4];
+		u32 programHash;
+		u64 count, inputs;
+		u16 regs[Registers::REG_COUNT];
+		u16 zn;
+		u8 c, o;
+		u32 iep, sp;
+		u8 pages[Checkpointer::PAGES/8]; //bit per page that differs from the program image
+	};
+
+	//FNV-1a, to tell checkpoints of a different program apart
+	u32 HashBytes(const ByteVector& bytes)
+	{
+		u32 hash = 2166136261u;
+		for (auto it=bytes.begin();it!=bytes.end();++it)
+		{
+			hash ^= *it;
+			hash *= 16777619u;
+		}
+		return hash;
+	}
+
+	u64 NanosSince(std::chrono::steady_clock::time_point start)
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	//page XOR base as alternating runs: [zero bytes u8][literal bytes u8][the literals], a stored or zeroed
+	//word costs a few bytes and the rest of the page nothing
+	void EncodePage(const u8* page, const u8* base, ByteVector& out)
+	{
+		size_t i = 0;
+		while (i < Checkpointer::PAGE_SIZE)
+		{
+			size_t zeros = 0;
+			while (i < Checkpointer::PAGE_SIZE && zeros < 0xFF && page[i] == base[i])
+			{
+				zeros++;
+				i++;
+			}
+
+			size_t start = i;
+			while (i < Checkpointer::PAGE_SIZE && i-start < 0xFF && page[i] != base[i])
+				i++;
+
+			out.push_back(static_cast<u8>(zeros));
+			out.push_back(static_cast<u8>(i-start));
+			for (size_t j=start;j<i;j++)
+				out.push_back(page[j] ^ base[j]);
+		}
+	}
+
+	bool DecodePage(const u8* data, size_t len, u8* page)
+	{
+		size_t i = 0, at = 0;
+		while (at + 2 <= len)
+		{
+			size_t zeros = data[at++];
+			size_t literals = data[at++];
+			if (i + zeros + literals > Checkpointer::PAGE_SIZE || at + literals > len)
+				return false;
+
+			i += zeros;
+			for (size_t j=0;j<literals;j++)
+				page[i++] ^= data[at++];
+		}
+		return at == len;
+	}
+};
+
+Checkpointer::Checkpointer( const ByteVector& program, const string& fileName ) : image(program), fileName(fileName)
+{
+	programHash = HashBytes(program);
+	image.resize(Cpu::Memory::SIZE,0);
+
+	busy = quit = false;
+	written = skipped = failed = 0;
+	captureNanos = writeNanos = bytesWritten = 0;
+	thread = std::thread(&Checkpointer::writer,this);
+}
+
+Checkpointer::~Checkpointer()
+{
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		quit = true;
+	}
+	wake.notify_all();
+	thread.join();
+}
+
+void Checkpointer::capture( const Cpu& cpu, u64 count, u64 inputs, bool wait )
+{
+	auto start = std::chrono::steady_clock::now();
+
+	std::unique_lock<std::mutex> guard(lock);
+	if (busy && !wait)
+	{
+		skipped++;
+		return;
+	}
+	wake.wait(guard,[this]() { return !busy; });
+
+	save(cpu,count,inputs,pending);
+	busy = true;
+	captureNanos += NanosSince(start);
+	guard.unlock();
+	wake.notify_all();
+}
+
+void Checkpointer::writer()
+{
+	State state;
+	for (;;)
+	{
+		{
+			std::unique_lock<std::mutex> guard(lock);
+			wake.wait(guard,[this]() { return busy || quit; });
+			if (!busy)
+				return;
+
+			std::swap(state,pending); //the copy is what the guest waited for, not this
+		}
+
+		auto start = std::chrono::steady_clock::now();
+		u64 fileSize = 0;
+		bool ok = write(state,fileSize);
+		u64 nanos = NanosSince(start);
+
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			if (ok)
+			{
+				written++;
+				writeNanos += nanos;
+				bytesWritten += fileSize;
+			}
+			else
+				failed++;
+			busy = false;
+		}
+		wake.notify_all();
+	}
+}
+
+bool Checkpointer::write( const State& state, u64& fileSize ) const
+{
+	ByteVector data;
+	encode(state,image,programHash,data);
+
+	//into a temporary first, so there is always a whole one to resume from even if this never finishes
+	const string tempName = fileName + ".tmp";
+	{
+		std::ofstream out(tempName,std::ios::binary|std::ios::trunc);
+		out.write(reinterpret_cast<const char*>(&data[0]),data.size());
+		out.close();
+		if (!out)
+			return false;
+	}
+#ifdef _WIN32
+	std::remove(fileName.c_str()); //rename doesn't replace there
+#endif
+	if (std::rename(tempName.c_str(),fileName.c_str()) != 0)
+		return false;
+
+	fileSize = data.size();
+	return true;
+}
+
+void Checkpointer::encode( const State& state, const ByteVector& image, u32 programHash, ByteVector& out )
+{
+	Header header;
+	memset(&header,0,sizeof(header));
+	memcpy(header.magic,Magic,sizeof(header.magic));
+	header.programHash = programHash;
+	header.count = state.count;
+	header.inputs = state.inputs;
+	memcpy(header.regs,state.regs,sizeof(header.regs));
+	header.zn = state.zn;
+	header.c = state.c;
+	header.o = state.o;
+	header.iep = static_cast<u32>(state.iep);
+	header.sp = static_cast<u32>(state.sp);
+
+	out.assign(reinterpret_cast<const u8*>(&header),reinterpret_cast<const u8*>(&header) + sizeof(header));
+	ByteVector encoded;
+	for (size_t page=0;page<PAGES;page++)
+	{
+		const u8* bytes = &state.memory[page*PAGE_SIZE];
+		const u8* base = &image[page*PAGE_SIZE];
+		if (memcmp(bytes,base,PAGE_SIZE) == 0)
+			continue;
+
+		header.pages[page/8] |= 1 << (page%8);
+		encoded.clear();
+		EncodePage(bytes,base,encoded);
+		u16 len = static_cast<u16>(encoded.size());
+		out.push_back(static_cast<u8>(len));
+		out.push_back(static_cast<u8>(len >> 8));
+		out.insert(out.end(),encoded.begin(),encoded.end());
+	}
+	memcpy(&out[0],&header,sizeof(header)); //with the page bits
+}
+
+u32 Checkpointer::hash( const ByteVector& program )
+{
+	return HashBytes(program);
+}
+
+void Checkpointer::report( std::ostream& out )
+{
+	std::unique_lock<std::mutex> guard(lock);
+	wake.wait(guard,[this]() { return !busy; }); //the last one counts too
+	if (written + skipped + failed == 0)
+		return;
+
+	out << "Checkpoints: " << written << " written to " << fileName << ", " << skipped << " skipped (previous still writing)";
+	if (failed)
+		out << ", " << failed << " failed";
+	out << std::endl;
+
+	const u64 taken = written + failed;
+	if (taken)
+		out << "  guest paused " << captureNanos / taken / 1000 << " us each";
+	if (written)
+		out << ", writing took " << writeNanos / written / 1000 << " us and " << bytesWritten / written << " bytes each";
+	out << std::endl;
+}
+
+void Checkpointer::save( const Cpu& cpu, u64 count, u64 inputs, State& state )
+{
+	state.count = count;
+	state.inputs = inputs;
+	for (size_t i=0;i<lengthof(state.regs);i++)
+		state.regs[i] = cpu.regs[i].u;
+	state.zn = cpu.psw.getZNDst().u;
+	state.c = cpu.psw.getC();
+	state.o = cpu.psw.getO();
+	state.iep = cpu.mem.iep;
+	state.sp = cpu.mem.sp;
+	state.memory.assign(cpu.mem.bytes,cpu.mem.bytes + Cpu::Memory::SIZE);
+}
+
+void Checkpointer::apply( const State& state, Cpu& cpu )
+{
+	cpu.mem.init(&state.memory[0],state.memory.size());
+	for (size_t i=0;i<lengthof(state.regs);i++)
+		cpu.regs[i].u = state.regs[i];
+
+	Cpu::Op zn;
+	zn.u = state.zn;
+	cpu.psw.setZN(zn);
+	cpu.psw.setC(state.c);
+	cpu.psw.setO(state.o);
+	cpu.mem.iep = state.iep;
+	cpu.mem.sp = state.sp;
+}
+
+bool Checkpointer::load( std::istream& in, const ByteVector& program, State& state )
+{
+	Header header;
+	if (!in.read(reinterpret_cast<char*>(&header),sizeof(header)) || memcmp(header.magic,Magic,sizeof(header.magic)) != 0)
+		return false;
+	if (header.programHash != HashBytes(program) || header.iep >= Cpu::Memory::SIZE || header.sp > Cpu::Memory::SIZE)
+		return false;
+
+	state.count = header.count;
+	state.inputs = header.inputs;
+	memcpy(state.regs,header.regs,sizeof(state.regs));
+	state.zn = header.zn;
+	state.c = header.c != 0;
+	state.o = header.o != 0;
+	state.iep = header.iep;
+	state.sp = header.sp;
+	state.memory = program;
+	state.memory.resize(Cpu::Memory::SIZE,0);
+
+	ByteVector encoded;
+	for (size_t page=0;page<PAGES;page++)
+	{
+		if (!(header.pages[page/8] & (1 << (page%8))))
+			continue;
+
+		u8 len[2];
+		if (!in.read(reinterpret_cast<char*>(len),sizeof(len)))
+			return false;
+		encoded.resize(len[0] | (len[1] << 8));
+		if (!encoded.empty() && !in.read(reinterpret_cast<char*>(&encoded[0]),encoded.size()))
+			return false;
+		if (!DecodePage(encoded.empty() ? nullptr : &encoded[0],encoded.size(),&state.memory[page*PAGE_SIZE]))
+			return false;
+	}
+	return true;
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "Cpu.h"
+#include <istream>
+#include <ostream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+//saves the whole guest state to a file now and then while it runs, so a long run can be picked up again with --resume.
+//The guest only stops for copying the state at an instruction boundary, a background thread compresses it (memory as
+//a zero run encoded XOR against the program image, so pages the program never wrote cost nothing) and writes it out
+class Checkpointer
+{
+public:
+	enum
+	{
+		PAGE_SIZE = 1 << Cpu::Memory::PAGE_BITS,
+		PAGES = Cpu::Memory::SIZE / PAGE_SIZE
+	};
+
+	struct State
+	{
+		State() : count(0), inputs(0), zn(0), c(false), o(false), iep(0), sp(0) {}
+
+		u64 count; //instructions executed up to it
+		u64 inputs; //values IN consumed up to it
+		u16 regs[Registers::REG_COUNT];
+		u16 zn; //what the Z and N flags come from
+		bool c, o;
+		size_t iep, sp;
+		ByteVector memory; //all Memory::SIZE bytes
+	};
+
+	Checkpointer(const ByteVector& program, const string& fileName);
+	~Checkpointer(); //waits for the write in progress
+
+	//copies the state and hands it to the writer, skipped if it's still busy with the last one unless wait is set
+	void capture(const Cpu& cpu, u64 count, u64 inputs, bool wait = false);
+	void report(std::ostream& out); //how many there were and what they cost, after the one being written is done
+
+	static void save(const Cpu& cpu, u64 count, u64 inputs, State& state);
+	//what the file holds for state, image is the program padded to Memory::SIZE, load() reads it back
+	static void encode(const State& state, const ByteVector& image, u32 programHash, ByteVector& out);
+	static u32 hash(const ByteVector& program);
+	static void apply(const State& state, Cpu& cpu); //cpu has to be otherwise idle, like after init()
+	//false if in isn't a checkpoint, or one of a different program
+	static bool load(std::istream& in, const ByteVector& program, State& state);
+private:
+	void writer();
+	bool write(const State& state, u64& fileSize) const;
+
+	ByteVector image; //program padded to Memory::SIZE with zeroes, how memory starts out
+	u32 programHash;
+	string fileName;
+
+	std::mutex lock;
+	std::condition_variable wake;
+	State pending;
+	bool busy, quit; //pending holds one not written yet, destructor wants the thread gone
+
+	u64 written, skipped, failed;
+	u64 captureNanos, writeNanos, bytesWritten;
+
+	std::thread thread; //last, so everything it uses is there before it starts
+};
@@ -1,5 +1,10 @@
 #include "Cpu.h"
+#include "Jit.h"
+#include "IoDevice.h"
+#include "Profiler.h"
+#include "Trace.h"
 #include <sstream>
+#include <atomic>
 #include <iostream>
 #include <stdio.h>
 
@@ -25,7 +30,9 @@ string Cpu::InstructionException::toString() const
 
 string Cpu::MemoryException::toString() const 
 {
-	return o.toString();
+	std::ostringstream str;
+	str << "Error executing instruction at " << ValueToString(static_cast<u32>(getIEP())) << " : " << getSize() << " bytes at " << ValueToString(static_cast<u32>(getAddress())) << " are outside of memory";
+	return str.str();
 }
 
 string Cpu::Psw::toString() const
@@ -35,6 +42,115 @@ string Cpu::Psw::toString() const
 	return str.str();
 }
 
+const u64 Cpu::NO_BUDGET;
+
+namespace
+{
+	InteractiveIo ConsoleIo(std::cin,std::cout);
+};
+
+Cpu::Cpu() : io(&ConsoleIo), inputWait(false) {}
+Cpu::~Cpu() {}
+
+Cpu::Memory::Memory() : iep(0), sp(SIZE), decoded(SIZE + GUARD_SIZE), codePages((SIZE >> PAGE_BITS) + 1, 0), dirtyPages((SIZE >> PAGE_BITS) + 1, 0), dirtySince(0), codeVersion(0), jit(nullptr)
+{
+	memset(bytes,0,sizeof(bytes));
+}
+
+void Cpu::Memory::reset()
+{
+	iep = 0;
+	sp = SIZE;
+	fault = Fault();
+	memset(bytes,0,sizeof(bytes));
+	dirtySince = 0;
+	codeVersion++;
+
+	//only pages that ever had code in them have decoded entries to forget
+	for (size_t page=0;page<codePages.size();page++)
+	{
+		if (!codePages[page])
+			continue;
+
+		size_t offset = page << PAGE_BITS;
+		size_t first = (offset >= Decoded::MAX_LEN) ? (offset - (Decoded::MAX_LEN-1)) : 0;
+		size_t last = std::min(offset + (1 << PAGE_BITS), decoded.size());
+		for (size_t i=first;i<last;i++)
+			decoded[i].len = 0;
+		codePages[page] = 0;
+	}
+
+	if (jit)
+		jit->invalidate(0,decoded.size());
+}
+
+void Cpu::Memory::invalidateCode( size_t offset, size_t len )
+{
+	size_t first = (offset >= Decoded::MAX_LEN) ? (offset - (Decoded::MAX_LEN-1)) : 0;
+	size_t last = std::min(offset + len, decoded.size());
+	for (size_t i=first;i<last;i++)
+		decoded[i].len = 0;
+
+	codeVersion++;
+	if (jit)
+		jit->invalidate(offset,len);
+}
+
+void Cpu::reset()
+{
+	for (size_t i=0;i<lengthof(regs);i++)
+		regs[i] = Op();
+	psw = Psw();
+	inputWait = false;
+	mem.reset();
+}
+
+namespace
+{
+	std::atomic<u64> NextSnapshotId(1); //0 is no snapshot
+};
+
+void Cpu::snapshot( Snapshot& snap )
+{
+	for (size_t i=0;i<lengthof(regs);i++)
+		snap.regs[i] = regs[i];
+	snap.psw = psw;
+	snap.iep = mem.iep;
+	snap.sp = mem.sp;
+	snap.bytes.assign(mem.bytes,mem.bytes + Memory::SIZE);
+	snap.id = NextSnapshotId++;
+
+	std::fill(mem.dirtyPages.begin(),mem.dirtyPages.end(),0);
+	mem.dirtySince = snap.id;
+}
+
+void Cpu::restore( const Snapshot& snap )
+{
+	for (size_t i=0;i<lengthof(regs);i++)
+		regs[i] = snap.regs[i];
+	psw = snap.psw;
+	inputWait = false;
+	mem.iep = snap.iep;
+	mem.sp = snap.sp;
+	mem.fault = Memory::Fault();
+
+	//without tracking relative to snap every page has to come back
+	const bool tracked = (snap.id != 0) && (mem.dirtySince == snap.id);
+	const size_t PAGE_SIZE = 1 << Memory::PAGE_BITS;
+	for (size_t page=0;page<(Memory::SIZE >> Memory::PAGE_BITS);page++)
+	{
+		if (tracked && !mem.dirtyPages[page])
+			continue;
+
+		size_t offset = page * PAGE_SIZE;
+		memcpy(&mem.bytes[offset],&snap.bytes[offset],PAGE_SIZE);
+		mem.invalidate(offset,PAGE_SIZE);
+	}
+
+	std::fill(mem.dirtyPages.begin(),mem.dirtyPages.end(),0);
+	mem.dirtySince = snap.id;
+}
+
 void Cpu::dumpState(std::ostream& out) const
 {
 	for (size_t i=0;i<lengthof(regs);i++)
@@ -42,263 +158,1484 @@ void Cpu::dumpState(std::ostream& out) const
 	out << std::endl;
 
 	out << "FLAGS: " << psw.toString() << std::endl;
-	out << "IEP: " << ValueToString(mem.iep.pos()) << " SP: " << ValueToString(mem.sp.pos()) << std::endl;
+	out << "IEP: " << ValueToString(mem.iep) << " SP: " << ValueToString(mem.sp) << std::endl;
 }
 
-void Cpu::fetchArithmeticOps( size_t currIEP, Registers::RegisterType src1, Registers::RegisterType src2, Op& op1, Op& op2 )
+namespace
 {
-	op1 = regs[src1];
-	op2 = regs[src2];
-	if (src1 == Registers::REG_CONSTANT || src2 == Registers::REG_CONSTANT)
+	typedef Cpu::Decoded Decoded;
+	typedef Cpu::Op Op;
+
+	//register value or the constant word if the operand is REG_CONSTANT
+	inline Op operand(const Cpu& cpu, u8 reg, const Decoded& ins)
 	{
-		Op constant(mem.iep.read<u16>());
-		if (src1 == src2)
-			throw InstructionException(currIEP, "Only src1 or src2 can be memory addresses, not both");
-		else if (src1 == Registers::REG_CONSTANT)
-			op1 = constant;
-		else //src2 == Registers::REG_CONSTANT
-			op2 = constant;
+		return (reg == Registers::REG_CONSTANT) ? ins.imm : cpu.regs[reg];
 	}
-}
 
-bool Cpu::execute() /* executes one instruction, return value is we should keep going or not */
-{
-	try
+	//register val + offset or just offset
+	inline Op address(const Cpu& cpu, u8 reg, const Decoded& ins)
+	{
+		if (reg == Registers::REG_CONSTANT)
+			return ins.imm;
+		else
+			return Op(static_cast<i16>(cpu.regs[reg].i + ins.imm.i));
+	}
+
+	bool OpAdd(Cpu& cpu, const Decoded& ins)
+	{
+		Op op1 = operand(cpu,ins.src1,ins);
+		Op op2 = operand(cpu,ins.src2,ins);
+		u16 carryBit = cpu.psw.getC();
+		cpu.regs[ins.dst].u = op1.u + op2.u + carryBit;
+		cpu.psw.arithmeticOp(OpCodes::OP_ADD,op1,op2,cpu.regs[ins.dst],carryBit != 0);
+		return true;
+	}
+
+	bool OpSub(Cpu& cpu, const Decoded& ins)
+	{
+		Op op1 = operand(cpu,ins.src1,ins);
+		Op op2 = operand(cpu,ins.src2,ins);
+		i16 carryBit = cpu.psw.getC();
+		cpu.regs[ins.dst].i = op1.i - op2.i - carryBit;
+		cpu.psw.arithmeticOp(OpCodes::OP_SUB,op1,op2,cpu.regs[ins.dst],carryBit != 0);
+		return true;
+	}
+
+	bool OpCmp(Cpu& cpu, const Decoded& ins)
+	{
+		Op op1 = operand(cpu,ins.src1,ins);
+		Op op2 = operand(cpu,ins.src2,ins);
+		cpu.psw.arithmeticOp(OpCodes::OP_CMP,op1,op2,static_cast<i16>(op1.i - op2.i));
+		return true;
+	}
+
+	bool OpSar(Cpu& cpu, const Decoded& ins)
+	{
+		Op op1 = operand(cpu,ins.src1,ins);
+		Op op2 = operand(cpu,ins.src2,ins);
+		i16 shifted = op1.i;
+		bool newCarry = ((shifted >>= op2.u) << op2.u) != op1.i;
+		cpu.psw.setC(newCarry);
+		cpu.regs[ins.dst].i = shifted;
+		cpu.psw.setZN(cpu.regs[ins.dst]);
+		return true;
+	}
+
+	bool OpSal(Cpu& cpu, const Decoded& ins)
+	{
+		Op op1 = operand(cpu,ins.src1,ins);
+		Op op2 = operand(cpu,ins.src2,ins);
+		i16 shifted = op1.i;
+		bool newCarry = ((shifted <<= op2.u) >> op2.u) != op1.i;
+		cpu.psw.setC(newCarry);
+		cpu.regs[ins.dst].i = shifted;
+		cpu.psw.setZN(cpu.regs[ins.dst]);
+		return true;
+	}
+
+	bool OpAnd(Cpu& cpu, const Decoded& ins)
+	{
+		cpu.regs[ins.dst].u = operand(cpu,ins.src1,ins).u & operand(cpu,ins.src2,ins).u;
+		cpu.psw.setZN(cpu.regs[ins.dst]);
+		return true;
+	}
+
+	bool OpOr(Cpu& cpu, const Decoded& ins)
+	{
+		cpu.regs[ins.dst].u = operand(cpu,ins.src1,ins).u | operand(cpu,ins.src2,ins).u;
+		cpu.psw.setZN(cpu.regs[ins.dst]);
+		return true;
+	}
+
+	bool OpNot(Cpu& cpu, const Decoded& ins)
+	{
+		cpu.regs[ins.dst].u = ~(operand(cpu,ins.src1,ins).u);
+		cpu.psw.setZN(cpu.regs[ins.dst]);
+		return true;
+	}
+
+	//control flow ops get the address of the instruction that follows them in iep and leave the next one to execute there,
+	//same return value as handlers
+	inline bool FlowJmp(Cpu& cpu, const Decoded& ins, size_t& iep)
+	{
+		iep = address(cpu,ins.src1,ins).u;
+		return true;
+	}
+
+	//branch conditions
+	inline bool CondZ(const Cpu::Psw& psw) { return psw.getZ(); }
+	inline bool CondNz(const Cpu::Psw& psw) { return !psw.getZ(); }
+	inline bool CondGt(const Cpu::Psw& psw) { return (psw.getZ()==0) && (psw.getN()==psw.getO()); }
+	inline bool CondLt(const Cpu::Psw& psw) { return psw.getN()!=psw.getO(); }
+	inline bool CondGe(const Cpu::Psw& psw) { return psw.getN()==psw.getO(); }
+	inline bool CondLe(const Cpu::Psw& psw) { return psw.getZ() || (psw.getN()!=psw.getO()); }
+	inline bool CondC(const Cpu::Psw& psw) { return psw.getC(); }
+	inline bool CondNc(const Cpu::Psw& psw) { return !psw.getC(); }
+	inline bool CondO(const Cpu::Psw& psw) { return psw.getO(); }
+	inline bool CondN(const Cpu::Psw& psw) { return psw.getN(); }
+
+	//relative targets wrap around at 64K like every other address
+	template<bool (*Cond)(const Cpu::Psw&)>
+	inline bool FlowBranch(Cpu& cpu, const Decoded& ins, size_t& iep)
+	{
+		if (Cond(cpu.psw))
+			iep = static_cast<u16>(ins.iep + address(cpu,ins.src1,ins).i);
+		return true;
+	}
+
+	inline bool FlowLoop(Cpu& cpu, const Decoded& ins, size_t& iep)
+	{
+		if (--cpu.regs[ins.dst].u != 0)
+			iep = static_cast<u16>(ins.iep + address(cpu,ins.src1,ins).i);
+		return true;
+	}
+
+	//what STR, CALL and the pushes do to memory, the default policies make it Memory::putOp()
+	template<typename MemoryModel, typename Checking>
+	inline void StoreOp(Cpu::Memory& mem, size_t address, Op op)
+	{
+		memcpy(&mem.bytes[address],&op.u,sizeof(op.u));
+		MemoryModel::stored(mem,address,sizeof(op.u));
+		if (Checking::CHECKED) //verified code never stores into itself
+			mem.invalidate(address,sizeof(op.u));
+	}
+
+	//and STRB, Memory::putByte()
+	template<typename MemoryModel, typename Checking>
+	inline void StoreByte(Cpu::Memory& mem, size_t address, u8 value)
+	{
+		mem.bytes[address] = value;
+		MemoryModel::stored(mem,address,sizeof(value));
+		if (Checking::CHECKED)
+			mem.invalidate(address,sizeof(value));
+	}
+
+	//and after MEMCPY or MEMSET wrote len bytes at address, which can be more than the page markDirty() takes
+	template<typename MemoryModel, typename Checking>
+	inline void StoredBlock(Cpu::Memory& mem, size_t address, size_t len)
+	{
+		if (len == 0)
+			return;
+
+		const size_t PAGE_SIZE = 1 << Cpu::Memory::PAGE_BITS;
+		for (size_t at=address;at<address+len;at+=PAGE_SIZE)
+			MemoryModel::stored(mem,at,std::min(PAGE_SIZE,address+len-at));
+		if (Checking::CHECKED)
+			mem.invalidate(address,len);
+	}
+
+	//where a push leaves sp, the stack stops at 0 instead of faulting so the push is always in range
+	inline size_t PushedSP(size_t sp)
+	{
+		return (sp >= sizeof(u16)) ? (sp - sizeof(u16)) : 0;
+	}
+
+	template<typename MemoryModel = Cpu::TrackedMemory, typename Checking = Cpu::CheckedCode>
+	inline bool FlowCall(Cpu& cpu, const Decoded& ins, size_t& iep)
+	{
+		u16 funcLoc = address(cpu,ins.src1,ins).u;
+		cpu.mem.sp = PushedSP(cpu.mem.sp);
+		StoreOp<MemoryModel,Checking>(cpu.mem,cpu.mem.sp,Op(static_cast<u16>(iep)));
+		iep = funcLoc;
+		return true;
+	}
+
+	inline bool FlowRet(Cpu& cpu, const Decoded& ins, size_t& iep)
+	{
+		if (!cpu.mem.check(ins.iep,cpu.mem.sp,sizeof(u16)))
+			return false;
+
+		iep = cpu.mem.fetchOp(cpu.mem.sp).u;
+		cpu.mem.sp += sizeof(u16);
+		return true;
+	}
+
+	template<bool (*Flow)(Cpu&, const Decoded&, size_t&)>
+	bool OpFlow(Cpu& cpu, const Decoded& ins)
+	{
+		size_t iep = cpu.mem.iep;
+		if (!Flow(cpu,ins,iep))
+			return false;
+
+		cpu.mem.iep = iep;
+		return true;
+	}
+
+	bool OpMov(Cpu& cpu, const Decoded& ins)
+	{
+		cpu.regs[ins.dst] = address(cpu,ins.src1,ins);
+		cpu.psw.setZN(cpu.regs[ins.dst]);
+		return true;
+	}
+
+	bool OpLdr(Cpu& cpu, const Decoded& ins)
+	{
+		u16 wantedAddress = address(cpu,ins.src1,ins).u;
+		if (!cpu.mem.check(ins.iep,wantedAddress,sizeof(u16)))
+			return false;
+
+		cpu.regs[ins.dst] = cpu.mem.fetchOp(wantedAddress);
+		cpu.psw.setZN(cpu.regs[ins.dst]);
+		return true;
+	}
+
+	template<typename MemoryModel = Cpu::TrackedMemory, typename Checking = Cpu::CheckedCode>
+	bool OpStr(Cpu& cpu, const Decoded& ins)
+	{
+		u16 wantedAddress = address(cpu,ins.dst,ins).u;
+		if (!cpu.mem.check(ins.iep,wantedAddress,sizeof(u16)))
+			return false;
+
+		StoreOp<MemoryModel,Checking>(cpu.mem,wantedAddress,cpu.regs[ins.src1]);
+		return true;
+	}
+
+	//base + index * scale, what the imm of an indexed LDR/STR says
+	inline Op indexed(Cpu& cpu, u8 reg, const Decoded& ins)
+	{
+		return Op(static_cast<u16>(cpu.regs[reg].u + (cpu.regs[ins.imm.u & 0x0F].u << (ins.imm.u >> 4))));
+	}
+
+	bool OpLdrx(Cpu& cpu, const Decoded& ins)
+	{
+		u16 wantedAddress = indexed(cpu,ins.src1,ins).u;
+		if (!cpu.mem.check(ins.iep,wantedAddress,sizeof(u16)))
+			return false;
+
+		cpu.regs[ins.dst] = cpu.mem.fetchOp(wantedAddress);
+		cpu.psw.setZN(cpu.regs[ins.dst]);
+		return true;
+	}
+
+	template<typename MemoryModel = Cpu::TrackedMemory, typename Checking = Cpu::CheckedCode>
+	bool OpStrx(Cpu& cpu, const Decoded& ins)
+	{
+		u16 wantedAddress = indexed(cpu,ins.dst,ins).u;
+		if (!cpu.mem.check(ins.iep,wantedAddress,sizeof(u16)))
+			return false;
+
+		StoreOp<MemoryModel,Checking>(cpu.mem,wantedAddress,cpu.regs[ins.src1]);
+		return true;
+	}
+
+	//post increment, the address register steps to the next word. Loading into it leaves the loaded value
+	bool OpLdrp(Cpu& cpu, const Decoded& ins)
+	{
+		u16 wantedAddress = cpu.regs[ins.src1].u;
+		if (!cpu.mem.check(ins.iep,wantedAddress,sizeof(u16)))
+			return false;
+
+		cpu.regs[ins.src1].u += sizeof(u16);
+		cpu.regs[ins.dst] = cpu.mem.fetchOp(wantedAddress);
+		cpu.psw.setZN(cpu.regs[ins.dst]);
+		return true;
+	}
+
+	//storing the address register itself stores it from before the increment
+	template<typename MemoryModel = Cpu::TrackedMemory, typename Checking = Cpu::CheckedCode>
+	bool OpStrp(Cpu& cpu, const Decoded& ins)
+	{
+		u16 wantedAddress = cpu.regs[ins.dst].u;
+		if (!cpu.mem.check(ins.iep,wantedAddress,sizeof(u16)))
+			return false;
+
+		StoreOp<MemoryModel,Checking>(cpu.mem,wantedAddress,cpu.regs[ins.src1]);
+		cpu.regs[ins.dst].u += sizeof(u16);
+		return true;
+	}
+
+	//LDRB zero extends the byte, LDRSB sign extends it
+	template<bool Signed>
+	bool OpLdrb(Cpu& cpu, const Decoded& ins)
+	{
+		u16 wantedAddress = address(cpu,ins.src1,ins).u;
+		if (!cpu.mem.check(ins.iep,wantedAddress,sizeof(u8)))
+			return false;
+
+		const u8 value = cpu.mem.bytes[wantedAddress];
+		cpu.regs[ins.dst].u = Signed ? static_cast<u16>(static_cast<i8>(value)) : value;
+		cpu.psw.setZN(cpu.regs[ins.dst]);
+		return true;
+	}
+
+	template<typename MemoryModel = Cpu::TrackedMemory, typename Checking = Cpu::CheckedCode>
+	bool OpStrb(Cpu& cpu, const Decoded& ins)
+	{
+		u16 wantedAddress = address(cpu,ins.dst,ins).u;
+		if (!cpu.mem.check(ins.iep,wantedAddress,sizeof(u8)))
+			return false;
+
+		StoreByte<MemoryModel,Checking>(cpu.mem,wantedAddress,static_cast<u8>(cpu.regs[ins.src1].u));
+		return true;
+	}
+
+	//the 32 bit value in a register pair, reg is the even one with the low word
+	inline u32 Pair(const Cpu& cpu, u8 reg)
+	{
+		return cpu.regs[reg].u | (static_cast<u32>(cpu.regs[reg+1].u) << 16);
+	}
+
+	inline u32 PairOperand(const Cpu& cpu, u8 reg, const Decoded& ins)
+	{
+		if (reg == Registers::REG_CONSTANT)
+			return static_cast<u32>(static_cast<i32>(ins.imm.i));
+		else
+			return Pair(cpu,reg);
+	}
+
+	inline void SetPair(Cpu& cpu, u8 reg, u32 val)
+	{
+		cpu.regs[reg].u = static_cast<u16>(val);
+		cpu.regs[reg+1].u = static_cast<u16>(val >> 16);
+	}
+
+	//ADD32, SUB32 and CMP32 (which only sets the flags), no carry in
+	template<bool Subtract, bool Store>
+	bool OpArith32(Cpu& cpu, const Decoded& ins)
+	{
+		u32 op1 = Pair(cpu,ins.dst);
+		u32 op2 = PairOperand(cpu,ins.src1,ins);
+		u32 result = Subtract ? (op1 - op2) : (op1 + op2);
+		if (Store)
+			SetPair(cpu,ins.dst,result);
+		cpu.psw.arithmeticOp32(Subtract ? (Store ? OpCodes::OP_SUB32 : OpCodes::OP_CMP32) : OpCodes::OP_ADD32,op1,op2,result);
+		return true;
+	}
+
+	//C when shifting back doesn't give the original value, like SAL and SAR. 32 or more shifts everything out
+	template<bool Left>
+	bool OpShift32(Cpu& cpu, const Decoded& ins)
+	{
+		u32 val = Pair(cpu,ins.dst);
+		u16 count = operand(cpu,ins.src1,ins).u;
+		u32 result, back;
+		if (count >= 32)
+		{
+			result = Left ? 0 : static_cast<u32>(static_cast<i32>(val) >> 31);
+			back = 0;
+		}
+		else if (Left)
+		{
+			result = val << count;
+			back = static_cast<u32>(static_cast<i32>(result) >> count);
+		}
+		else
+		{
+			result = static_cast<u32>(static_cast<i32>(val) >> count);
+			back = result << count;
+		}
+		SetPair(cpu,ins.dst,result);
+		cpu.psw.setZN32(result);
+		cpu.psw.setC(back != val);
+		return true;
+	}
+
+	//bytes MEMCPY, MEMSET and MEMCMP do, from the register their word names
+	inline size_t BlockCount(const Cpu& cpu, const Decoded& ins)
 	{
-		u8 instr;
-		u8 dst,src1,src2;
-		size_t currIEP = mem.iep.pos();
-		//std::cout << "IEP: " << ValueToString(currIEP) << std::endl;
-		//fetch and expand first 2 bytes of instruction
+		return cpu.regs[ins.imm.u].u;
+	}
+
+	//one host call each. Neither range wraps around the end of memory, one that would faults with nothing done
+	template<typename MemoryModel = Cpu::TrackedMemory, typename Checking = Cpu::CheckedCode>
+	bool OpMemcpy(Cpu& cpu, const Decoded& ins)
+	{
+		const u16 dst = cpu.regs[ins.dst].u;
+		const u16 src = cpu.regs[ins.src1].u;
+		const size_t count = BlockCount(cpu,ins);
+		if (!cpu.mem.check(ins.iep,dst,count) || !cpu.mem.check(ins.iep,src,count))
+			return false;
+
+		memmove(&cpu.mem.bytes[dst],&cpu.mem.bytes[src],count);
+		StoredBlock<MemoryModel,Checking>(cpu.mem,dst,count);
+		return true;
+	}
+
+	template<typename MemoryModel = Cpu::TrackedMemory, typename Checking = Cpu::CheckedCode>
+	bool OpMemset(Cpu& cpu, const Decoded& ins)
+	{
+		const u16 dst = cpu.regs[ins.dst].u;
+		const size_t count = BlockCount(cpu,ins);
+		if (!cpu.mem.check(ins.iep,dst,count))
+			return false;
+
+		memset(&cpu.mem.bytes[dst],static_cast<u8>(cpu.regs[ins.src1].u),count);
+		StoredBlock<MemoryModel,Checking>(cpu.mem,dst,count);
+		return true;
+	}
+
+	//Z if all of them match, otherwise N if the first that differs is the lower (unsigned) one at dst. C stays
+	bool OpMemcmp(Cpu& cpu, const Decoded& ins)
+	{
+		const u16 first = cpu.regs[ins.dst].u;
+		const u16 second = cpu.regs[ins.src1].u;
+		const size_t count = BlockCount(cpu,ins);
+		if (!cpu.mem.check(ins.iep,first,count) || !cpu.mem.check(ins.iep,second,count))
+			return false;
+
+		const int diff = memcmp(&cpu.mem.bytes[first],&cpu.mem.bytes[second],count);
+		cpu.psw.setZN(Op(static_cast<i16>((diff > 0) - (diff < 0))));
+		return true;
+	}
+
+	template<typename IoModel = Cpu::VirtualIo>
+	bool OpIn(Cpu& cpu, const Decoded& ins)
+	{
+		i16 value;
+		if (!IoModel::in(cpu.io,ins.iep,static_cast<Registers::RegisterType>(ins.dst),value))
 		{
-			instr = mem.iep.read<u8>();
-			u8 secondByte = mem.iep.read<u8>();
-			if (instr & 0x80) //non arithmetic instr
+			cpu.inputWait = true;
+			return false;
+		}
+		cpu.regs[ins.dst].i = value;
+		cpu.psw.setZN(cpu.regs[ins.dst]);
+		return true;
+	}
+
+	template<typename IoModel = Cpu::VirtualIo>
+	bool OpOut(Cpu& cpu, const Decoded& ins)
+	{
+		IoModel::out(cpu.io,ins.iep,static_cast<Registers::RegisterType>(ins.src1),cpu.regs[ins.src1].i);
+		return true;
+	}
+
+	bool OpClc(Cpu& cpu, const Decoded&) { cpu.psw.clearC(); return true; }
+	bool OpStc(Cpu& cpu, const Decoded&) { cpu.psw.setC(); return true; }
+	bool OpNc(Cpu& cpu, const Decoded&) { cpu.psw.setC(!cpu.psw.getC()); return true; }
+
+	bool OpMovf(Cpu& cpu, const Decoded& ins)
+	{
+		cpu.regs[ins.dst].u = static_cast<u16>(cpu.psw);
+		return true;
+	}
+
+	bool OpMovtsp(Cpu& cpu, const Decoded& ins)
+	{
+		cpu.mem.sp = cpu.regs[ins.src1].u;
+		return true;
+	}
+
+	bool OpMovfsp(Cpu& cpu, const Decoded& ins)
+	{
+		cpu.regs[ins.dst].u = static_cast<u16>(cpu.mem.sp);
+		return true;
+	}
+
+	template<typename IoModel = Cpu::VirtualIo>
+	bool OpHlt(Cpu& cpu, const Decoded&) 
+	{ 
+		IoModel::flush(cpu.io);
+		return false; 
+	}
+
+	//dst times src, C set if the unsigned product didn't fit in the word. O gets cleared with the result like
+	//setZN does for everything but ADD, SUB and CMP, so the signed branches after these look at the result alone
+	bool OpMul(Cpu& cpu, const Decoded& ins)
+	{
+		u32 product = static_cast<u32>(cpu.regs[ins.dst].u) * operand(cpu,ins.src1,ins).u;
+		cpu.regs[ins.dst].u = static_cast<u16>(product);
+		cpu.psw.setZN(cpu.regs[ins.dst]);
+		cpu.psw.setC((product >> 16) != 0);
+		return true;
+	}
+
+	//the high word of that product, clears C
+	template<bool Signed>
+	bool OpMulh(Cpu& cpu, const Decoded& ins)
+	{
+		Op op1 = cpu.regs[ins.dst];
+		Op op2 = operand(cpu,ins.src1,ins);
+		if (Signed)
+			cpu.regs[ins.dst].u = static_cast<u16>((static_cast<i32>(op1.i) * op2.i) >> 16);
+		else
+			cpu.regs[ins.dst].u = static_cast<u16>((static_cast<u32>(op1.u) * op2.u) >> 16);
+		cpu.psw.setZN(cpu.regs[ins.dst]);
+		cpu.psw.setC(false);
+		return true;
+	}
+
+	//dst divided by src, truncating, the remainder has the sign of dst. Clears C unless the divisor was 0 (the quotient
+	//is then all ones and the remainder dst) or it was the one signed quotient that doesn't fit (-32768 / -1, which
+	//stays -32768 with remainder 0). That one is a signed overflow, so IDIV also sets O for it
+	template<bool Signed, bool Remainder>
+	bool OpDiv(Cpu& cpu, const Decoded& ins)
+	{
+		Op op1 = cpu.regs[ins.dst];
+		Op op2 = operand(cpu,ins.src1,ins);
+		Op quotient, remainder;
+		bool overflow = true;
+		if (op2.u == 0)
+		{
+			quotient.u = 0xFFFF;
+			remainder = op1;
+		}
+		else if (Signed && op1.u == 0x8000 && op2.i == -1)
+		{
+			quotient = op1;
+			remainder.u = 0;
+		}
+		else if (Signed)
+		{
+			quotient.i = static_cast<i16>(op1.i / op2.i);
+			remainder.i = static_cast<i16>(op1.i % op2.i);
+			overflow = false;
+		}
+		else
+		{
+			quotient.u = op1.u / op2.u;
+			remainder.u = op1.u % op2.u;
+			overflow = false;
+		}
+		cpu.regs[ins.dst] = Remainder ? remainder : quotient;
+		cpu.psw.setZN(cpu.regs[ins.dst]);
+		cpu.psw.setC(overflow);
+		if (Signed && !Remainder && op2.u != 0)
+			cpu.psw.setO(overflow);
+		return true;
+	}
+
+	//PUSH and POP don't touch the flags, so an epilogue leaves them as the function body did
+	template<typename MemoryModel = Cpu::TrackedMemory, typename Checking = Cpu::CheckedCode>
+	bool OpPush(Cpu& cpu, const Decoded& ins)
+	{
+		cpu.mem.sp = PushedSP(cpu.mem.sp);
+		StoreOp<MemoryModel,Checking>(cpu.mem,cpu.mem.sp,cpu.regs[ins.src1]);
+		return true;
+	}
+
+	bool OpPop(Cpu& cpu, const Decoded& ins)
+	{
+		if (!cpu.mem.check(ins.iep,cpu.mem.sp,sizeof(u16)))
+			return false;
+
+		cpu.regs[ins.dst] = cpu.mem.fetchOp(cpu.mem.sp);
+		cpu.mem.sp += sizeof(u16);
+		return true;
+	}
+
+	//lowest address PUSHM writes, everything from there up to where sp was (or the one word at 0)
+	inline size_t PushmBottom(const Cpu& cpu, const Decoded& ins)
+	{
+		size_t sp = cpu.mem.sp;
+		for (size_t reg=0;reg<Registers::REG_CONSTANT;reg++)
+		{
+			if (ins.imm.u & (1 << reg))
+				sp = PushedSP(sp);
+		}
+		return sp;
+	}
+
+	//bytes PUSHM writes from PushmBottom
+	inline size_t PushmSize(const Cpu& cpu, const Decoded& ins)
+	{
+		size_t bottom = PushmBottom(cpu,ins);
+		return std::max(cpu.mem.sp,bottom + sizeof(u16)) - bottom;
+	}
+
+	//bytes POPM reads from sp
+	inline size_t PopmSize(const Decoded& ins)
+	{
+		size_t count = 0;
+		for (size_t reg=0;reg<Registers::REG_CONSTANT;reg++)
+			count += (ins.imm.u >> reg) & 1;
+		return count*sizeof(u16);
+	}
+
+	//same as a PUSH of each register in the mask, highest first
+	template<typename MemoryModel = Cpu::TrackedMemory, typename Checking = Cpu::CheckedCode>
+	bool OpPushm(Cpu& cpu, const Decoded& ins)
+	{
+		for (size_t reg=Registers::REG_CONSTANT;reg-->0;)
+		{
+			if (ins.imm.u & (1 << reg))
 			{
-				dst = (secondByte >> 4) & 0x0F;
-				src1 = (secondByte >> 0) & 0x0F;
-				return otherInstr(currIEP,
-					static_cast<OpCodes::OpCodeType>(instr),
-					static_cast<Registers::RegisterType>(dst),
-					static_cast<Registers::RegisterType>(src1));
+				cpu.mem.sp = PushedSP(cpu.mem.sp);
+				StoreOp<MemoryModel,Checking>(cpu.mem,cpu.mem.sp,cpu.regs[reg]);
 			}
-			else //3 op instr
+		}
+		return true;
+	}
+
+	//POP of each, lowest first. All of them have to be in memory, otherwise none get popped
+	bool OpPopm(Cpu& cpu, const Decoded& ins)
+	{
+		if (!cpu.mem.check(ins.iep,cpu.mem.sp,PopmSize(ins)))
+			return false;
+
+		for (size_t reg=0;reg<Registers::REG_CONSTANT;reg++)
+		{
+			if (ins.imm.u & (1 << reg))
 			{
-				dst = instr & 0x0F;
-				instr &= 0xF0;
-				src1 = (secondByte >> 4) & 0x0F;
-				src2 = (secondByte >> 0) & 0x0F;
-
-				arithmeticInstr(currIEP, 
-					static_cast<OpCodes::OpCodeType>(instr),
-					static_cast<Registers::RegisterType>(dst),
-					static_cast<Registers::RegisterType>(src1),
-					static_cast<Registers::RegisterType>(src2));
-				return true;
+				cpu.regs[reg] = cpu.mem.fetchOp(cpu.mem.sp);
+				cpu.mem.sp += sizeof(u16);
 			}
-		}	
+		}
+		return true;
 	}
-	catch (const BufferPtr::OutOfRangeException& memE)
+
+	//instruction didn't fit in memory, imm is how many bytes it needed
+	bool OpFetchFault(Cpu& cpu, const Decoded& ins)
 	{
-		throw MemoryException(memE);
+		size_t currIEP = &ins - &cpu.mem.decoded[0]; //ins.iep can't hold addresses past the end
+		cpu.mem.fault = Cpu::Memory::Fault(currIEP,currIEP,ins.imm.u);
+		return false;
 	}
-}
-
 
+	//debugger patches, these are only ever in decoded entries the debugger cares about
+	bool OpBreak(Cpu& cpu, const Decoded&)
+	{
+		cpu.debug.breakHit = true;
+		return false;
+	}
 
-void Cpu::arithmeticInstr( size_t currIEP, OpCodes::OpCodeType instr, Registers::RegisterType dst, Registers::RegisterType src1, Registers::RegisterType src2 )
-{
-	if (dst >= Registers::REG_CONSTANT)
-		throw InstructionException(currIEP, "dst must be a register");
+	//where an LDR or STR in any of its addressing modes (or a byte, block or stack one) is going to access
+	inline u16 LoadAddress(Cpu& cpu, const Decoded& ins)
+	{
+		switch (ins.opcode())
+		{
+		case OpCodes::OP_RET:
+		case OpCodes::OP_POP:
+		case OpCodes::OP_POPM:
+			return static_cast<u16>(cpu.mem.sp);
+		case OpCodes::OP_LDRX:
+			return indexed(cpu,ins.src1,ins).u;
+		case OpCodes::OP_LDRP:
+			return cpu.regs[ins.src1].u;
+		case OpCodes::OP_MEMCMP:
+			return cpu.regs[ins.dst].u;
+		default:
+			return address(cpu,ins.src1,ins).u;
+		}
+	}
 
-	Op op1,op2;
+	inline u16 StoreAddress(Cpu& cpu, const Decoded& ins)
+	{
+		switch (ins.opcode())
+		{
+		case OpCodes::OP_CALL:
+		case OpCodes::OP_PUSH:
+			return static_cast<u16>(PushedSP(cpu.mem.sp));
+		case OpCodes::OP_PUSHM:
+			return static_cast<u16>(PushmBottom(cpu,ins));
+		case OpCodes::OP_STRX:
+			return indexed(cpu,ins.dst,ins).u;
+		case OpCodes::OP_STRP:
+		case OpCodes::OP_MEMCPY:
+		case OpCodes::OP_MEMSET:
+			return cpu.regs[ins.dst].u;
+		default:
+			return address(cpu,ins.dst,ins).u;
+		}
+	}
 
-	switch (instr)
+	inline size_t AccessSize(const Cpu& cpu, const Decoded& ins)
 	{
-	case OpCodes::OP_ADD:
+		switch (ins.opcode())
 		{
-			fetchArithmeticOps(currIEP,src1,src2,op1,op2);
-			u16 carryBit = psw.getC();
-			regs[dst].u = op1.u + op2.u + carryBit;
-			psw.arithmeticOp(instr,op1,op2,regs[dst],carryBit);
+		case OpCodes::OP_LDRB:
+		case OpCodes::OP_LDRSB:
+		case OpCodes::OP_STRB:
+			return sizeof(u8);
+		case OpCodes::OP_MEMCPY:
+		case OpCodes::OP_MEMSET:
+		case OpCodes::OP_MEMCMP:
+			return BlockCount(cpu,ins);
+		case OpCodes::OP_PUSHM:
+			return PushmSize(cpu,ins);
+		case OpCodes::OP_POPM:
+			return PopmSize(ins);
+		default:
+			return sizeof(u16);
 		}
-		break;
-	case OpCodes::OP_SUB:
+	}
+
+	//the access happens, then it stops. MEMCPY and MEMCMP also read count bytes at src
+	bool OpLdrWatch(Cpu& cpu, const Decoded& ins)
+	{
+		u16 wantedAddress = LoadAddress(cpu,ins);
+		size_t size = AccessSize(cpu,ins);
+		bool done;
+		switch (ins.opcode())
 		{
-			fetchArithmeticOps(currIEP,src1,src2,op1,op2);
-			i16 carryBit = psw.getC();
-			regs[dst].i = op1.i - op2.i - carryBit;
-			psw.arithmeticOp(instr,op1,op2,regs[dst],carryBit);
+		case OpCodes::OP_LDRX:
+			done = OpLdrx(cpu,ins);
+			break;
+		case OpCodes::OP_LDRP:
+			done = OpLdrp(cpu,ins);
+			break;
+		case OpCodes::OP_LDRB:
+			done = OpLdrb<false>(cpu,ins);
+			break;
+		case OpCodes::OP_LDRSB:
+			done = OpLdrb<true>(cpu,ins);
+			break;
+		case OpCodes::OP_MEMCMP:
+			done = OpMemcmp(cpu,ins);
+			break;
+		case OpCodes::OP_RET:
+			done = OpFlow<FlowRet>(cpu,ins);
+			break;
+		case OpCodes::OP_POP:
+			done = OpPop(cpu,ins);
+			break;
+		case OpCodes::OP_POPM:
+			done = OpPopm(cpu,ins);
+			break;
+		default:
+			done = OpLdr(cpu,ins);
+			break;
 		}
-		break;
-	case OpCodes::OP_CMP:
-		fetchArithmeticOps(currIEP,src1,src2,op1,op2);
-		psw.arithmeticOp(instr,op1,op2,static_cast<i16>(op1.i - op2.i));
-		break;
-	case OpCodes::OP_SAR:
+		if (!done)
+			return false;
+
+		if (ins.opcode() == OpCodes::OP_MEMCMP && cpu.debug.hit(ins.iep,cpu.regs[ins.src1].u,size,Cpu::Debug::WATCH_READ))
+			return false;
+		return !cpu.debug.hit(ins.iep,wantedAddress,size,Cpu::Debug::WATCH_READ);
+	}
+
+	bool OpStrWatch(Cpu& cpu, const Decoded& ins)
+	{
+		u16 wantedAddress = StoreAddress(cpu,ins);
+		size_t size = AccessSize(cpu,ins);
+		bool done;
+		switch (ins.opcode())
 		{
-			fetchArithmeticOps(currIEP,src1,src2,op1,op2);
-			i16 shifted = op1.i;
-			bool newCarry = ((shifted >>= op2.u) << op2.u) != op1.i;
-			psw.setC(newCarry);
-			regs[dst].i = shifted;
-			psw.setZN(regs[dst]);
+		case OpCodes::OP_STRX:
+			done = OpStrx<>(cpu,ins);
+			break;
+		case OpCodes::OP_STRP:
+			done = OpStrp<>(cpu,ins);
+			break;
+		case OpCodes::OP_STRB:
+			done = OpStrb<>(cpu,ins);
+			break;
+		case OpCodes::OP_MEMCPY:
+			done = OpMemcpy<>(cpu,ins);
+			break;
+		case OpCodes::OP_MEMSET:
+			done = OpMemset<>(cpu,ins);
+			break;
+		case OpCodes::OP_CALL:
+			done = OpFlow<FlowCall<>>(cpu,ins);
+			break;
+		case OpCodes::OP_PUSH:
+			done = OpPush<>(cpu,ins);
+			break;
+		case OpCodes::OP_PUSHM:
+			done = OpPushm<>(cpu,ins);
+			break;
+		default:
+			done = OpStr<>(cpu,ins);
+			break;
 		}
-		break;
-		case OpCodes::OP_SAL:
+		if (!done)
+			return false;
+
+		if (ins.opcode() == OpCodes::OP_MEMCPY && cpu.debug.hit(ins.iep,cpu.regs[ins.src1].u,size,Cpu::Debug::WATCH_READ))
+			return false;
+		return !cpu.debug.hit(ins.iep,wantedAddress,size,Cpu::Debug::WATCH_WRITE);
+	}
+
+	//indexed by Decoded::index
+	const Cpu::OpHandler Handlers[] = 
+	{ 
+		OpAdd, OpSub, OpCmp, OpSar, OpSal, OpAnd, OpOr, OpNot,
+		OpFlow<FlowJmp>, OpFlow<FlowBranch<CondZ>>, OpFlow<FlowBranch<CondGt>>, OpMov, OpLdr, OpStr<>, OpIn<>, OpOut<>, 
+		OpClc, OpStc, OpNc, OpMovf, OpMovtsp, OpMovfsp, OpFlow<FlowCall<>>, OpFlow<FlowRet>, OpHlt<>,
+		OpMul, OpMulh<false>, OpMulh<true>, OpDiv<false,false>, OpDiv<true,false>, OpDiv<false,true>, OpDiv<true,true>,
+		OpPush<>, OpPop, OpPushm<>, OpPopm, OpLdrx, OpStrx<>, OpLdrp, OpStrp<>,
+		OpFlow<FlowBranch<CondNz>>, OpFlow<FlowBranch<CondLt>>, OpFlow<FlowBranch<CondGe>>, OpFlow<FlowBranch<CondLe>>,
+		OpFlow<FlowBranch<CondC>>, OpFlow<FlowBranch<CondNc>>, OpFlow<FlowBranch<CondO>>, OpFlow<FlowBranch<CondN>>, OpFlow<FlowLoop>,
+		OpLdrb<false>, OpLdrb<true>, OpStrb<>,
+		OpArith32<false,true>, OpArith32<true,true>, OpArith32<true,false>, OpShift32<true>, OpShift32<false>,
+		OpMemcpy<>, OpMemset<>, OpMemcmp,
+		OpFetchFault,
+		OpBreak, OpLdrWatch, OpStrWatch
+	};
+	static_assert(sizeof(Handlers)/sizeof(Handlers[0]) == Decoded::INDEX_COUNT, "Handler for every opcode");
+
+	//what the unchecked engine makes sure of before executing an instruction verify() couldn't vouch for statically,
+	//false hands it to the checked engine
+	inline bool VerifiedTarget(const Cpu& cpu, const Decoded& ins, u16 target)
+	{
+		return ins.src1 == Registers::REG_CONSTANT || cpu.verified.starts[target];
+	}
+
+	inline bool VerifiedBranch(const Cpu& cpu, const Decoded& ins)
+	{
+		return VerifiedTarget(cpu,ins,static_cast<u16>(ins.iep + address(cpu,ins.src1,ins).i));
+	}
+
+	inline bool VerifiedStore(const Cpu& cpu, size_t address, size_t size = sizeof(u16))
+	{
+		return address + size <= cpu.verified.codeStart || address >= cpu.verified.codeEnd;
+	}
+
+	inline bool VerifiedCall(const Cpu& cpu, const Decoded& ins)
+	{
+		return VerifiedTarget(cpu,ins,address(cpu,ins.src1,ins).u) && VerifiedStore(cpu,PushedSP(cpu.mem.sp));
+	}
+
+	inline bool VerifiedPushm(const Cpu& cpu, const Decoded& ins)
+	{
+		return VerifiedStore(cpu,PushmBottom(cpu,ins),PushmSize(cpu,ins));
+	}
+
+	inline bool VerifiedRet(const Cpu& cpu)
+	{
+		//one that faults gets to do it on the checked engine
+		return cpu.mem.sp + sizeof(u16) <= Cpu::Memory::SIZE && cpu.verified.starts[cpu.mem.fetchOp(cpu.mem.sp).u];
+	}
+
+	//every addressing mode of LDR and STR gets watched, and the byte and block ones, and everything that moves words on the stack
+	inline bool WatchesLoad(u8 realIndex)
+	{
+		const OpCodes::OpCodeType op = OpCodes::fromIndex(realIndex);
+		return op == OpCodes::OP_LDR || op == OpCodes::OP_LDRX || op == OpCodes::OP_LDRP || op == OpCodes::OP_LDRB || op == OpCodes::OP_LDRSB ||
+			op == OpCodes::OP_MEMCMP || op == OpCodes::OP_RET || op == OpCodes::OP_POP || op == OpCodes::OP_POPM;
+	}
+
+	inline bool WatchesStore(u8 realIndex)
+	{
+		const OpCodes::OpCodeType op = OpCodes::fromIndex(realIndex);
+		return op == OpCodes::OP_STR || op == OpCodes::OP_STRX || op == OpCodes::OP_STRP || op == OpCodes::OP_STRB ||
+			op == OpCodes::OP_MEMCPY || op == OpCodes::OP_MEMSET || op == OpCodes::OP_CALL || op == OpCodes::OP_PUSH || op == OpCodes::OP_PUSHM;
+	}
+
+	const u8 CallIndex = static_cast<u8>(OpCodes::index(OpCodes::OP_CALL));
+	const u8 RetIndex = static_cast<u8>(OpCodes::index(OpCodes::OP_RET));
+};
+
+const Cpu::Decoded& Cpu::decode( size_t currIEP )
+{
+	Decoded ins;
+	ins.iep = static_cast<u16>(currIEP);
+	ins.len = 2;
+	if (currIEP + ins.len > Memory::SIZE)
+		return fetchFault(currIEP,ins.len);
+
+	//the first byte says which instruction it is, the table how the rest of it goes
+	u8 index = OpCodes::decodeIndex(mem.bytes[currIEP]);
+	if (index == OpCodes::INVALID_INDEX)
+		throw InstructionException(currIEP, "Unknown instruction opcode");
+
+	const OpCodes::Info& info = OpCodes::Table[index];
+	u8 fields[OpCodes::FIELD_COUNT];
+	OpCodes::decodeFields(info,mem.bytes[currIEP],mem.bytes[currIEP+1],fields);
+	string error;
+	if (!OpCodes::checkFields(info,fields,error))
+		throw InstructionException(currIEP, error);
+
+	if (OpCodes::hasWord(info,fields))
+	{
+		if (currIEP + Decoded::MAX_LEN > Memory::SIZE)
+			return fetchFault(currIEP,Decoded::MAX_LEN);
+		ins.imm = mem.fetchOp(currIEP+ins.len);
+		ins.len += sizeof(u16);
+		if (!OpCodes::checkWord(info,ins.imm.u,error))
+			throw InstructionException(currIEP, error);
+	}
+	ins.dst = fields[OpCodes::FIELD_DST];
+	ins.src1 = fields[OpCodes::FIELD_SRC1];
+	ins.src2 = fields[OpCodes::FIELD_SRC2];
+	ins.index = index;
+	ins.realIndex = ins.index;
+	if (debugging())
+		patch(ins,currIEP,true);
+	else
+		ins.handler = Handlers[ins.index];
+
+	mem.decoded[currIEP] = ins;
+	mem.codePages[currIEP >> Memory::PAGE_BITS] = 1;
+	mem.codePages[(currIEP + ins.len - 1) >> Memory::PAGE_BITS] = 1;
+	return mem.decoded[currIEP];
+}
+
+const Cpu::Decoded& Cpu::fetchFault( size_t currIEP, size_t size )
+{
+	//left undecoded (len 0), so the fault only gets recorded if execution really gets here
+	Decoded& ins = mem.decoded[currIEP];
+	ins = Decoded();
+	ins.iep = static_cast<u16>(currIEP);
+	ins.imm = Op(static_cast<u16>(size));
+	ins.index = ins.realIndex = Decoded::FAULT_INDEX;
+	if (debugging())
+		patch(ins,currIEP,true);
+	else
+		ins.handler = Handlers[ins.index];
+	return ins;
+}
+
+void Cpu::patch( Decoded& ins, size_t address, bool withBreakpoint ) const
+{
+	ins.index = ins.realIndex;
+	if (withBreakpoint && debug.breakpoints.count(address))
+		ins.index = Decoded::BREAK_INDEX;
+	else if (!debug.watches.empty() && WatchesLoad(ins.realIndex))
+		ins.index = Decoded::LDR_WATCH_INDEX;
+	else if (!debug.watches.empty() && WatchesStore(ins.realIndex))
+		ins.index = Decoded::STR_WATCH_INDEX;
+
+	ins.handler = Handlers[ins.index];
+}
+
+void Cpu::repatch( size_t address )
+{
+	Decoded& ins = mem.decoded[address];
+	if (ins.handler) //decoded, or a fetch fault that gets decoded again anyway
+		patch(ins,address,true);
+}
+
+Cpu::Stop Cpu::stopped( size_t currIEP, u64 count )
+{
+	if (mem.fault.size != 0)
+	{
+		mem.iep = mem.fault.iep; //restartable from the faulting instruction
+		return Stop(Stop::STOP_FAULT,count,mem.iep,Stop::ERR_MEMORY);
+	}
+	if (inputWait)
+	{
+		inputWait = false;
+		mem.iep = currIEP;
+		return Stop(Stop::STOP_IO_WAIT,count,mem.iep);
+	}
+	if (debug.breakHit)
+	{
+		debug.breakHit = false;
+		mem.iep = currIEP;
+		return Stop(Stop::STOP_BREAKPOINT,count,mem.iep);
+	}
+	if (debug.watchHit.size != 0)
+		return Stop(Stop::STOP_WATCHPOINT,count+1,mem.iep);
+	return Stop(Stop::STOP_HALT,count+1,mem.iep);
+}
+
+void Cpu::throwIfFault( const Stop& stop )
+{
+	if (stop.reason != Stop::STOP_FAULT)
+		return;
+
+	if (stop.error == Stop::ERR_MEMORY)
+		throw MemoryException(mem.fault.iep,mem.fault.address,mem.fault.size);
+
+	decode(stop.iep); //throws the same InstructionException again
+	throw InstructionException(stop.iep,"Instruction changed after faulting");
+}
+
+Cpu::Stop Cpu::step()
+{
+	mem.fault = Memory::Fault();
+	debug.watchHit = Memory::Fault();
+	size_t currIEP = mem.iep;
+	const Decoded* ins;
+	try
+	{
+		ins = &fetchDecoded(currIEP);
+	}
+	catch (const InstructionException&)
+	{
+		return Stop(Stop::STOP_FAULT,0,currIEP,Stop::ERR_INSTRUCTION);
+	}
+	mem.iep = currIEP+ins->len;
+	if (ins->handler(*this,*ins))
+		return Stop(Stop::STOP_BUDGET,1,mem.iep);
+
+	return stopped(currIEP,0);
+}
+
+Cpu::Stop Cpu::runStepped( u64 budget )
+{
+	for (u64 count=0;count<budget;count++)
+	{
+		Stop stop = step();
+		if (stop.reason != Stop::STOP_BUDGET)
 		{
-			fetchArithmeticOps(currIEP,src1,src2,op1,op2);
-			i16 shifted = op1.i;
-			bool newCarry = ((shifted <<= op2.u) >> op2.u) != op1.i;
-			psw.setC(newCarry);
-			regs[dst].i = shifted;
-			psw.setZN(regs[dst]);
+			stop.count += count;
+			return stop;
 		}
-		break;
-	case OpCodes::OP_AND:
-		fetchArithmeticOps(currIEP,src1,src2,op1,op2);
-		regs[dst].u = op1.u & op2.u;
-		psw.setZN(regs[dst]);
-		break;
-	case OpCodes::OP_OR:
-		fetchArithmeticOps(currIEP,src1,src2,op1,op2);
-		regs[dst].u = op1.u | op2.u;
-		psw.setZN(regs[dst]);
-		break;
-	case OpCodes::OP_NOT:
-		if (src2 != 0)
-			throw InstructionException(currIEP,"OP_NOT src2 must be 0");
+	}
+	return Stop(Stop::STOP_BUDGET,budget,mem.iep);
+}
 
-		fetchArithmeticOps(currIEP,src1,src2,op1,op2);
-		regs[dst].u = ~(op1.u);
-		psw.setZN(regs[dst]);
-		break;
-	default:
-		throw InstructionException(currIEP,"Unknown instruction opcode");
-		break;
+bool Cpu::execute() /* executes one instruction, return value is we should keep going or not */
+{
+	Stop stop = step();
+	throwIfFault(stop);
+	return stop.reason == Stop::STOP_BUDGET;
+}
+
+template<typename P>
+Cpu::Stop Cpu::runWith( u64 budget, typename P::InstrumentPolicy& prof )
+{
+	typedef typename P::MemoryPolicy MemoryModel;
+	typedef typename P::CheckPolicy Checking;
+	typedef typename P::IoPolicy IoModel;
+	const bool Checked = Checking::CHECKED;
+	if (!MemoryModel::TRACKED)
+		mem.dirtySince = 0; //dirtyPages won't be right after this
+
+#ifdef __GNUC__
+	//every handler ends with its own indirect jump to the next one (labels as values),
+	//so the predictor learns per-opcode successors instead of sharing one central branch
+	static void* const Targets[] = 
+	{
+		&&op_add, &&op_sub, &&op_cmp, &&op_sar, &&op_sal, &&op_and, &&op_or, &&op_not,
+		&&op_jmp, &&op_jz, &&op_jgt, &&op_mov, &&op_ldr, &&op_str, &&op_in, &&op_out,
+		&&op_clc, &&op_stc, &&op_nc, &&op_movf, &&op_movtsp, &&op_movfsp, &&op_call, &&op_ret, &&op_hlt,
+		&&op_mul, &&op_mulh, &&op_imulh, &&op_div, &&op_idiv, &&op_mod, &&op_imod,
+		&&op_push, &&op_pop, &&op_pushm, &&op_popm, &&op_ldrx, &&op_strx, &&op_ldrp, &&op_strp,
+		&&op_jnz, &&op_jlt, &&op_jge, &&op_jle, &&op_jc, &&op_jnc, &&op_jo, &&op_jn, &&op_loop,
+		&&op_ldrb, &&op_ldrsb, &&op_strb,
+		&&op_add32, &&op_sub32, &&op_cmp32, &&op_sal32, &&op_sar32,
+		&&op_memcpy, &&op_memset, &&op_memcmp,
+		&&op_fault,
+		&&op_break, &&op_ldr_watch, &&op_str_watch
+	};
+	static_assert(sizeof(Targets) == sizeof(Handlers), "Target for every handler");
+
+	mem.fault = Memory::Fault();
+	debug.watchHit = Memory::Fault();
+	//IEP lives in a local while we run, mem.iep is only synced when leaving
+	size_t iep = mem.iep;
+	u64 left = budget;
+	const Decoded* ins;
+	//unchecked, everything it can get to was decoded by verify() and nothing invalidated it
+#define DISPATCH() if (left == 0) goto out_of_budget; left--; ins = Checked ? &fetchDecoded(iep) : &mem.decoded[iep]; prof.executed(iep); iep += ins->len; goto *Targets[ins->index]
+	//the guards that only the unchecked engine has, before anything happened
+#define VERIFIED(guard) if (!Checked && !(guard)) goto unverified;
+	//handlers that can't fail return a constant true, so the check folds away
+#define THREADED_OP(label,handler) label: if (!handler(*this,*ins)) goto stop; prof.retired(*ins); DISPATCH();
+#define THREADED_FLOW(label,flow,guard) label: VERIFIED(guard) if (!flow(*this,*ins,iep)) goto stop; prof.retired(*ins); DISPATCH();
+	//the profiler hooks that need more than the address of the instruction
+#define THREADED_BRANCH(label,flow,guard) label: VERIFIED(guard) { size_t fallThrough = iep; if (!flow(*this,*ins,iep)) goto stop; prof.branch(ins->iep,iep != fallThrough); } DISPATCH();
+#define THREADED_LOAD(label,handler,at) label: prof.load(at); if (!handler(*this,*ins)) goto stop; prof.retired(*ins); DISPATCH();
+#define THREADED_STORE(label,handler,at,guard) label: VERIFIED(guard) prof.store(at); if (!handler(*this,*ins)) goto stop; prof.retired(*ins); DISPATCH();
+	//a watched CALL or RET moves mem.iep like it would when stepped, so that goes through memory around it
+#define THREADED_WATCH(label,handler,profile,at) label: prof.profile(at); mem.iep = iep; { bool kept = handler(*this,*ins); iep = mem.iep; if (!kept) goto stop; } prof.retired(*ins); DISPATCH();
+
+	try
+	{
+		DISPATCH();
+		THREADED_OP(op_add,OpAdd)
+		THREADED_OP(op_sub,OpSub)
+		THREADED_OP(op_cmp,OpCmp)
+		THREADED_OP(op_sar,OpSar)
+		THREADED_OP(op_sal,OpSal)
+		THREADED_OP(op_and,OpAnd)
+		THREADED_OP(op_or,OpOr)
+		THREADED_OP(op_not,OpNot)
+		THREADED_FLOW(op_jmp,FlowJmp,VerifiedTarget(*this,*ins,address(*this,ins->src1,*ins).u))
+		THREADED_BRANCH(op_jz,FlowBranch<CondZ>,VerifiedBranch(*this,*ins))
+		THREADED_BRANCH(op_jgt,FlowBranch<CondGt>,VerifiedBranch(*this,*ins))
+		THREADED_OP(op_mov,OpMov)
+		THREADED_LOAD(op_ldr,OpLdr,address(*this,ins->src1,*ins).u)
+		THREADED_STORE(op_str,(OpStr<MemoryModel,Checking>),address(*this,ins->dst,*ins).u,VerifiedStore(*this,address(*this,ins->dst,*ins).u))
+		THREADED_OP(op_in,OpIn<IoModel>)
+		THREADED_OP(op_out,OpOut<IoModel>)
+		THREADED_OP(op_clc,OpClc)
+		THREADED_OP(op_stc,OpStc)
+		THREADED_OP(op_nc,OpNc)
+		THREADED_OP(op_movf,OpMovf)
+		THREADED_OP(op_movtsp,OpMovtsp)
+		THREADED_OP(op_movfsp,OpMovfsp)
+		THREADED_FLOW(op_call,(FlowCall<MemoryModel,Checking>),VerifiedCall(*this,*ins))
+		THREADED_FLOW(op_ret,FlowRet,VerifiedRet(*this))
+		THREADED_OP(op_hlt,OpHlt<IoModel>)
+		THREADED_OP(op_mul,OpMul)
+		THREADED_OP(op_mulh,OpMulh<false>)
+		THREADED_OP(op_imulh,OpMulh<true>)
+		THREADED_OP(op_div,(OpDiv<false,false>))
+		THREADED_OP(op_idiv,(OpDiv<true,false>))
+		THREADED_OP(op_mod,(OpDiv<false,true>))
+		THREADED_OP(op_imod,(OpDiv<true,true>))
+		THREADED_STORE(op_push,(OpPush<MemoryModel,Checking>),static_cast<u16>(PushedSP(mem.sp)),VerifiedStore(*this,PushedSP(mem.sp)))
+		THREADED_LOAD(op_pop,OpPop,static_cast<u16>(mem.sp))
+		THREADED_STORE(op_pushm,(OpPushm<MemoryModel,Checking>),static_cast<u16>(PushmBottom(*this,*ins)),VerifiedPushm(*this,*ins))
+		THREADED_LOAD(op_popm,OpPopm,static_cast<u16>(mem.sp))
+		THREADED_LOAD(op_ldrx,OpLdrx,indexed(*this,ins->src1,*ins).u)
+		THREADED_STORE(op_strx,(OpStrx<MemoryModel,Checking>),indexed(*this,ins->dst,*ins).u,VerifiedStore(*this,indexed(*this,ins->dst,*ins).u))
+		THREADED_LOAD(op_ldrp,OpLdrp,regs[ins->src1].u)
+		THREADED_STORE(op_strp,(OpStrp<MemoryModel,Checking>),regs[ins->dst].u,VerifiedStore(*this,regs[ins->dst].u))
+		THREADED_BRANCH(op_jnz,FlowBranch<CondNz>,VerifiedBranch(*this,*ins))
+		THREADED_BRANCH(op_jlt,FlowBranch<CondLt>,VerifiedBranch(*this,*ins))
+		THREADED_BRANCH(op_jge,FlowBranch<CondGe>,VerifiedBranch(*this,*ins))
+		THREADED_BRANCH(op_jle,FlowBranch<CondLe>,VerifiedBranch(*this,*ins))
+		THREADED_BRANCH(op_jc,FlowBranch<CondC>,VerifiedBranch(*this,*ins))
+		THREADED_BRANCH(op_jnc,FlowBranch<CondNc>,VerifiedBranch(*this,*ins))
+		THREADED_BRANCH(op_jo,FlowBranch<CondO>,VerifiedBranch(*this,*ins))
+		THREADED_BRANCH(op_jn,FlowBranch<CondN>,VerifiedBranch(*this,*ins))
+		THREADED_BRANCH(op_loop,FlowLoop,VerifiedBranch(*this,*ins))
+		THREADED_LOAD(op_ldrb,OpLdrb<false>,address(*this,ins->src1,*ins).u)
+		THREADED_LOAD(op_ldrsb,OpLdrb<true>,address(*this,ins->src1,*ins).u)
+		THREADED_STORE(op_strb,(OpStrb<MemoryModel,Checking>),address(*this,ins->dst,*ins).u,VerifiedStore(*this,address(*this,ins->dst,*ins).u,sizeof(u8)))
+		THREADED_OP(op_add32,(OpArith32<false,true>))
+		THREADED_OP(op_sub32,(OpArith32<true,true>))
+		THREADED_OP(op_cmp32,(OpArith32<true,false>))
+		THREADED_OP(op_sal32,OpShift32<true>)
+		THREADED_OP(op_sar32,OpShift32<false>)
+		THREADED_STORE(op_memcpy,(OpMemcpy<MemoryModel,Checking>),regs[ins->dst].u,VerifiedStore(*this,regs[ins->dst].u,BlockCount(*this,*ins)))
+		THREADED_STORE(op_memset,(OpMemset<MemoryModel,Checking>),regs[ins->dst].u,VerifiedStore(*this,regs[ins->dst].u,BlockCount(*this,*ins)))
+		THREADED_LOAD(op_memcmp,OpMemcmp,regs[ins->dst].u)
+		THREADED_OP(op_fault,OpFetchFault)
+		THREADED_OP(op_break,OpBreak)
+		THREADED_WATCH(op_ldr_watch,OpLdrWatch,load,LoadAddress(*this,*ins))
+		THREADED_WATCH(op_str_watch,OpStrWatch,store,StoreAddress(*this,*ins))
+	}
+	catch (const InstructionException&) //decode rejected it before it ran
+	{
+		mem.iep = iep;
+		return Stop(Stop::STOP_FAULT,budget-left-1,iep,Stop::ERR_INSTRUCTION);
 	}
+stop:
+	mem.iep = iep;
+	return stopped(ins->iep,budget-left-1);
+out_of_budget:
+	mem.iep = iep;
+	return Stop(Stop::STOP_BUDGET,budget,iep);
+unverified: //short of the budget, runUnchecked() goes on with the checked engine from this instruction
+	mem.iep = ins->iep;
+	return Stop(Stop::STOP_BUDGET,budget-left-1,ins->iep);
+
+#undef THREADED_WATCH
+#undef THREADED_STORE
+#undef THREADED_LOAD
+#undef THREADED_BRANCH
+#undef THREADED_FLOW
+#undef THREADED_OP
+#undef VERIFIED
+#undef DISPATCH
+#else
+	//no labels as values, fall back to calling through the decoded handler pointers (unprofiled)
+	(void)prof;
+	return runStepped(budget);
+#endif
+}
+
+Cpu::Stop Cpu::run( u64 budget )
+{
+	NoInstrument none;
+	return runWith<DefaultPolicy>(budget,none);
 }
 
-void Cpu::CheckNull( size_t currIEP, Registers::RegisterType r, const char* regName )
+Cpu::Stop Cpu::runProfiled( Profiler& prof, u64 budget )
 {
-	if (r != 0)
-		throw InstructionException(currIEP,regName + string(" must be zero!"));
+	return runWith<Policy<TrackedMemory,CheckedCode,VirtualIo,Profiler>>(budget,prof);
 }
 
-void Cpu::CheckReg( size_t currIEP, Registers::RegisterType r, const char* regName )
+Cpu::Stop Cpu::runTraced( Tracer& trace, u64 budget )
 {
-	if (r >= Registers::REG_CONSTANT)
-		throw InstructionException(currIEP,regName + string(" must be a register!"));
+	return runWith<Policy<TrackedMemory,CheckedCode,VirtualIo,Tracer>>(budget,trace);
 }
 
-bool Cpu::otherInstr( size_t currIEP, OpCodes::OpCodeType instr, Registers::RegisterType dst, Registers::RegisterType src )
+Cpu::Stop Cpu::runUnchecked( u64 budget )
 {
-	if (dst >= Registers::REG_CONSTANT)
-		throw InstructionException(currIEP, "dst must be a register");
+	if (debugging())
+		return run(budget);
+	if (verified.codeVersion != mem.codeVersion)
+		verify();
+	if (!verified.safe || !verified.starts[mem.iep])
+		return run(budget);
 
-	switch(instr)
+	NoInstrument none;
+	Stop stop = runWith<Policy<TrackedMemory,VerifiedCode,VirtualIo,NoInstrument>>(budget,none);
+	if (stop.reason != Stop::STOP_BUDGET || stop.count == budget)
+		return stop;
+
+	//got to something it can't vouch for, like storing into code, which might not be verified any more after
+	Stop rest = run(budget - stop.count);
+	rest.count += stop.count;
+	return rest;
+}
+
+//the combinations other files run with, the ones above get instantiated by their use
+template Cpu::Stop Cpu::runWith<Cpu::BatchPolicy>(u64 budget, Cpu::NoInstrument& instrument);
+template Cpu::Stop Cpu::runWith<Cpu::TextPolicy>(u64 budget, Cpu::NoInstrument& instrument);
+template Cpu::Stop Cpu::runWith<Cpu::BinaryPolicy>(u64 budget, Cpu::NoInstrument& instrument);
+
+bool Cpu::verify()
+{
+	verified.safe = false;
+	verified.starts.reset();
+	verified.codeStart = Memory::SIZE;
+	verified.codeEnd = 0;
+	verified.codeVersion = mem.codeVersion;
+	verified.reason.clear();
+
+	vector<size_t> work(1,0);
+	vector<std::pair<size_t,u16>> stores; //STRs and STRBs to constant addresses, checked against the code once all of it is known
+	while (!work.empty())
 	{
-	case OpCodes::OP_JMP:
-		CheckNull(currIEP,dst,"dst");
-		mem.iep.pos(resolveAddress(src).u);
-		break;
-	case OpCodes::OP_JZ:
+		size_t at = work.back();
+		work.pop_back();
+		if (at >= Memory::SIZE)
 		{
-			CheckNull(currIEP,dst,"dst");
-			i16 relAddr = resolveAddress(src).i;
-			if (psw.getZ())
-				mem.iep.pos(static_cast<int>(currIEP)+relAddr);
+			verified.reason = "Execution runs past the end of memory at " + ValueToString(static_cast<u32>(at));
+			return false;
 		}
-		break;
-	case OpCodes::OP_JGT:
+		if (verified.starts[at])
+			continue;
+
+		const Decoded* ins;
+		try
 		{
-			CheckNull(currIEP,dst,"dst");
-			i16 relAddr = resolveAddress(src).i;
-			if ((psw.getZ()==0) && (psw.getN()==psw.getO()))
-				mem.iep.pos(static_cast<int>(currIEP)+relAddr);
-		}		
-		break;
-	case OpCodes::OP_MOV:
-		CheckReg(currIEP,dst,"dst");
-		regs[dst] = resolveAddress(src); //register val + 0 or register val + offset or just offset
-		psw.setZN(regs[dst]);
-		break;
-	case OpCodes::OP_LDR:
+			ins = &fetchDecoded(at);
+		}
+		catch (const InstructionException& e)
 		{
-			CheckReg(currIEP,dst,"dst");
-			u16 wantedAddress = resolveAddress(src).u;
-			//std::cout << "Loading " << ValueToString(wantedAddress) << " to " << Registers::toString(dst) << std::endl;
-			regs[dst] = mem.fetchOp(wantedAddress);
-			psw.setZN(regs[dst]);
-		}		
-		break;
-	case OpCodes::OP_STR:
+			verified.reason = "Instruction at " + ValueToString(static_cast<u16>(at)) + " is invalid: " + e.getDescr();
+			return false;
+		}
+		if (ins->realIndex == Decoded::FAULT_INDEX)
 		{
-			CheckReg(currIEP,src,"src");
-			u16 wantedAddress = resolveAddress(dst).u;
-			//std::cout << "Storing " << Registers::toString(src) << "(" << ValueToString(regs[src].u) << ") to " << ValueToString(wantedAddress) << std::endl;
-			mem.putOp(wantedAddress,regs[src]);
+			verified.reason = "Instruction at " + ValueToString(static_cast<u16>(at)) + " runs past the end of memory";
+			return false;
 		}
-		break;
-	case OpCodes::OP_IN:
-		CheckNull(currIEP,src,"src");
-		CheckReg(currIEP,dst,"dst");
-		std::cout << "IEP: " << ValueToString(currIEP) << " Enter value into " << Registers::toString(dst) << ":";
-		std::cin >> regs[dst].i;
-		psw.setZN(regs[dst]);
-		break;
-	case OpCodes::OP_OUT:
-		CheckReg(currIEP,src,"src");
-		CheckNull(currIEP,dst,"dst");
-		std::cout << "IEP: " << ValueToString(currIEP) << " Value of " << Registers::toString(src) << ": " << regs[src].i << std::endl;
-		break;
-	case OpCodes::OP_CLC:
-		CheckNull(currIEP,src,"src");
-		CheckNull(currIEP,dst,"dst");
-		psw.clearC();
-		break;
-	case OpCodes::OP_STC:
-		CheckNull(currIEP,src,"src");
-		CheckNull(currIEP,dst,"dst");
-		psw.setC();
-		break;
-	case OpCodes::OP_NC:
-		CheckNull(currIEP,src,"src");
-		CheckNull(currIEP,dst,"dst");
-		psw.setC(!psw.getC());
-		break;
-	case OpCodes::OP_MOVF:
-		CheckNull(currIEP,src,"src");
-		CheckReg(currIEP,dst,"dst");
-		regs[dst].u = static_cast<u16>(psw);
-		break;
-	case OpCodes::OP_MOVTSP:
-		CheckReg(currIEP,src,"src");
-		CheckNull(currIEP,dst,"dst");
-		mem.sp.pos(regs[src].u);
-		break;
-	case OpCodes::OP_MOVFSP:
-		CheckNull(currIEP,src,"src");
-		CheckReg(currIEP,dst,"dst");
-		regs[dst].u = mem.sp.pos();
-		break;
-	case OpCodes::OP_CALL:
+
+		verified.starts.set(at);
+		verified.codeStart = std::min(verified.codeStart,at);
+		verified.codeEnd = std::max(verified.codeEnd,at + ins->len);
+
+		//targets in registers (and RET) get checked when they happen
+		const bool constant = (ins->src1 == Registers::REG_CONSTANT);
+		switch (ins->opcode())
 		{
-			CheckNull(currIEP,dst,"dst");
-			u16 funcLoc = resolveAddress(src).u;
-			mem.sp.backtrack(sizeof(u16));
-			mem.putOp(mem.sp.pos(),Op(static_cast<u16>(mem.iep.pos())));
-			mem.iep.pos(funcLoc);
+		case OpCodes::OP_HLT:
+		case OpCodes::OP_RET:
+			break;
+		case OpCodes::OP_JMP:
+			if (constant)
+				work.push_back(ins->imm.u);
+			break;
+		case OpCodes::OP_JZ:
+		case OpCodes::OP_JGT:
+		case OpCodes::OP_JNZ:
+		case OpCodes::OP_JLT:
+		case OpCodes::OP_JGE:
+		case OpCodes::OP_JLE:
+		case OpCodes::OP_JC:
+		case OpCodes::OP_JNC:
+		case OpCodes::OP_JO:
+		case OpCodes::OP_JN:
+		case OpCodes::OP_LOOP:
+			work.push_back(at + ins->len);
+			if (constant)
+				work.push_back(static_cast<u16>(at + ins->imm.i));
+			break;
+		case OpCodes::OP_CALL:
+			work.push_back(at + ins->len);
+			if (constant)
+				work.push_back(ins->imm.u);
+			break;
+		case OpCodes::OP_STR:
+		case OpCodes::OP_STRB:
+			if (ins->dst == Registers::REG_CONSTANT)
+				stores.push_back(std::make_pair(at,ins->imm.u));
+			work.push_back(at + ins->len);
+			break;
+		default:
+			work.push_back(at + ins->len);
+			break;
+		}
+	}
+
+	for (auto it=stores.begin();it!=stores.end();++it)
+	{
+		const Decoded& store = mem.decoded[it->first];
+		if (!VerifiedStore(*this,it->second,AccessSize(*this,store)))
+		{
+			verified.reason = ((store.opcode() == OpCodes::OP_STRB) ? "STRB at " : "STR at ") + ValueToString(static_cast<u16>(it->first)) + " writes into the program's code at " + ValueToString(it->second);
+			return false;
 		}
-		break;
-	case OpCodes::OP_RET:
-		CheckNull(currIEP,src,"src");
-		CheckNull(currIEP,dst,"dst");
-		mem.iep.pos(mem.sp.read<u16>());
-		break;
-	case OpCodes::OP_HLT:
-		return false;
 	}
 
+	verified.safe = true;
 	return true;
 }
+
+Cpu::Stop Cpu::runJit( u64 budget )
+{
+	if (!Jit::available() || debugging())
+		return run(budget);
+
+	if (!jit)
+		jit.reset(new Jit(*this));
+
+	return jit->run(budget);
+}
+
+bool Cpu::Debug::hit( size_t currIEP, size_t address, size_t len, u8 kind )
+{
+	//address is in memory (the access already happened), so is every page up to its end. Block ones can span more than two
+	if (len == 0)
+		return false;
+
+	size_t page = address >> Memory::PAGE_BITS;
+	const size_t lastPage = (address + len - 1) >> Memory::PAGE_BITS;
+	while (page <= lastPage && !watchPages[page])
+		page++;
+	if (page > lastPage)
+		return false;
+
+	for (auto it=watches.begin();it!=watches.end();++it)
+	{
+		if ((it->kind & kind) && address < it->address + it->len && it->address < address + len)
+		{
+			watchHit = Memory::Fault(currIEP,address,len);
+			watchKind = kind;
+			return true;
+		}
+	}
+	return false;
+}
+
+void Cpu::setBreakpoint( size_t address )
+{
+	debug.breakpoints.insert(address);
+	repatch(address);
+}
+
+void Cpu::clearBreakpoint( size_t address )
+{
+	debug.breakpoints.erase(address);
+	repatch(address);
+}
+
+void Cpu::setWatchpoint( size_t address, size_t len, u8 kind )
+{
+	if (len == 0 || address >= Memory::SIZE)
+		return;
+
+	len = std::min<size_t>(len,Memory::SIZE - address);
+	Debug::Watch watch = {address, len, kind};
+	debug.watches.push_back(watch);
+	for (size_t page = address >> Memory::PAGE_BITS;page <= (address + len - 1) >> Memory::PAGE_BITS;page++)
+		debug.watchPages.set(page);
+
+	if (debug.watches.size() == 1) //every LDR and STR becomes a watching one
+	{
+		for (size_t i=0;i<mem.decoded.size();i++)
+			repatch(i);
+	}
+}
+
+void Cpu::clearWatchpoints()
+{
+	if (debug.watches.empty())
+		return;
+
+	debug.watches.clear();
+	debug.watchPages.reset();
+	for (size_t i=0;i<mem.decoded.size();i++)
+		repatch(i);
+}
+
+Cpu::Stop Cpu::stepInto()
+{
+	size_t currIEP = mem.iep;
+	try
+	{
+		fetchDecoded(currIEP); //patched on the way if it wasn't decoded yet
+	}
+	catch (const InstructionException&)
+	{
+		return Stop(Stop::STOP_FAULT,0,currIEP,Stop::ERR_INSTRUCTION);
+	}
+
+	Decoded& ins = mem.decoded[currIEP];
+	if (ins.index != Decoded::BREAK_INDEX)
+		return step();
+	if (ins.len == 0) //fetch fault, step() would just fetch the breakpoint again
+	{
+		mem.fault = Memory::Fault(currIEP,currIEP,ins.imm.u);
+		return stopped(currIEP,0);
+	}
+
+	//run what's under the breakpoint, then put it back if that instruction didn't get overwritten
+	patch(ins,currIEP,false);
+	Stop stop = step();
+	if (ins.len != 0)
+		patch(ins,currIEP,true);
+	return stop;
+}
+
+Cpu::Stop Cpu::stepOver( u64 budget )
+{
+	if (budget == 0)
+		return Stop(Stop::STOP_BUDGET,0,mem.iep);
+
+	size_t callIEP = mem.iep;
+	const Decoded* ins;
+	try
+	{
+		ins = &fetchDecoded(callIEP);
+	}
+	catch (const InstructionException&)
+	{
+		return Stop(Stop::STOP_FAULT,0,callIEP,Stop::ERR_INSTRUCTION);
+	}
+	if (ins->realIndex != CallIndex)
+		return stepInto();
+
+	//a temporary breakpoint where it returns to, which recursive calls also hit with less on the stack
+	size_t returnIEP = callIEP + ins->len;
+	size_t callSP = mem.sp;
+	bool temporary = (debug.breakpoints.count(returnIEP) == 0);
+	if (temporary)
+		setBreakpoint(returnIEP);
+
+	Stop stop = stepInto();
+	u64 count = stop.count;
+	while (stop.reason == Stop::STOP_BUDGET && count < budget)
+	{
+		stop = run(budget - count);
+		count += stop.count;
+		if (stop.reason != Stop::STOP_BREAKPOINT || stop.iep != returnIEP)
+			break;
+		if (mem.sp >= callSP)
+		{
+			stop = Stop(Stop::STOP_BUDGET,count,mem.iep);
+			break;
+		}
+
+		stop = stepInto();
+		count += stop.count;
+	}
+
+	if (temporary)
+		clearBreakpoint(returnIEP);
+	stop.count = count;
+	return stop;
+}
+
+Cpu::Stop Cpu::runToReturn( u64 budget )
+{
+	size_t startSP = mem.sp;
+	for (u64 count=0;count<budget;count++)
+	{
+		//the first one is allowed to be on a breakpoint, like with resume()
+		size_t currIEP = mem.iep;
+		Stop stop = (count == 0) ? stepInto() : step();
+		if (stop.reason != Stop::STOP_BUDGET)
+		{
+			stop.count += count;
+			return stop;
+		}
+		if (mem.decoded[currIEP].realIndex == RetIndex && mem.sp > startSP)
+			return Stop(Stop::STOP_BUDGET,count+1,mem.iep);
+	}
+	return Stop(Stop::STOP_BUDGET,budget,mem.iep);
+}
+
+Cpu::Stop Cpu::resume( u64 budget )
+{
+	if (budget == 0)
+		return Stop(Stop::STOP_BUDGET,0,mem.iep);
+
+	Stop stop = stepInto();
+	if (stop.reason != Stop::STOP_BUDGET || budget == 1)
+		return stop;
+
+	stop = run((budget == NO_BUDGET) ? NO_BUDGET : (budget - 1));
+	stop.count++;
+	return stop;
+}
@@ -4,7 +4,16 @@
 #include "Common/Registers.h"
 #include "Common/Exception.h"
 #include "Common/Opcodes.h"
-#include "Common/BufferPtr.h"
+#include "IoDevice.h"
+#include <algorithm>
+#include <memory>
+#include <cstring>
+#include <set>
+#include <bitset>
+
+class Jit;
+class Profiler;
+class Tracer;
 
 class Cpu
 {
@@ -28,16 +37,51 @@ public:
 
 	struct MemoryException : public CpuException
 	{
-		MemoryException(BufferPtr::OutOfRangeException o) : CpuException("MemoryException"), o(o) {}
+		MemoryException(size_t iep, size_t address, size_t size) : CpuException("MemoryException"), iep(iep), address(address), size(size) {}
 		~MemoryException() NO_THROW {}
-		const BufferPtr::OutOfRangeException& getBufferExc() const { return o; }
+		size_t getIEP() const { return iep; }
+		size_t getAddress() const { return address; }
+		size_t getSize() const { return size; }
 		string toString() const OVERRIDE;
 	private:
-		BufferPtr::OutOfRangeException o;
+		size_t iep;
+		size_t address;
+		size_t size;
+	};
+
+	//why run() returned, with no exceptions involved
+	struct Stop
+	{
+		enum Reason
+		{
+			STOP_BUDGET, //executed as many instructions as asked for
+			STOP_HALT, //HLT, iep is past it
+			STOP_FAULT, //error says why, iep is the faulting instruction which had no effect
+			STOP_IO_WAIT, //IN found no input, iep is the IN so it can be resumed once there is some
+			STOP_BREAKPOINT, //iep is the instruction the breakpoint is on, not executed yet
+			STOP_WATCHPOINT //debug.watchHit is the access, iep is past the instruction that did it
+		};
+		enum Error
+		{
+			ERR_NONE,
+			ERR_MEMORY, //fetch or access outside of memory, details in mem.fault
+			ERR_INSTRUCTION //invalid instruction encoding
+		};
+
+		Stop() : count(0), iep(0), reason(STOP_BUDGET), error(ERR_NONE) {}
+		Stop(Reason reason, u64 count, size_t iep, Error error = ERR_NONE) : count(count), iep(static_cast<u32>(iep)), reason(static_cast<u8>(reason)), error(static_cast<u8>(error)) {}
+
+		u64 count; //instructions that completed
+		u32 iep;
+		u8 reason; //Reason
+		u8 error; //Error
 	};
+	static const u64 NO_BUDGET = ~u64(0);
 
-	Cpu(size_t memSize = 65536) : mem(memSize) {}
+	Cpu();
+	~Cpu();
 	void dumpState(std::ostream& out) const;
+	void reset(); //registers, flags and memory as if newly constructed, for running another program on this one
 
 	union Op
 	{
@@ -53,27 +97,120 @@ public:
 	};
 	Op regs[Registers::REG_COUNT];
 
+	struct Decoded;
+	typedef bool (*OpHandler)(Cpu& cpu, const Decoded& ins); //return value is we should keep going or not
+
+	//instruction as it was decoded the first time its address got executed
+	struct Decoded
+	{
+		enum 
+		{ 
+			MAX_LEN = 4, //2 bytes of opcode and registers + optional constant/offset word
+			FAULT_INDEX = OpCodes::INSTRUCTION_COUNT, //not an opcode, fetch ran past the end of memory
+			//what the debugger patches in, realIndex keeps what was there
+			BREAK_INDEX,
+			LDR_WATCH_INDEX,
+			STR_WATCH_INDEX,
+			INDEX_COUNT
+		};
+
+		Decoded() : handler(nullptr), iep(0), len(0), index(0), realIndex(0), dst(0), src1(0), src2(0) {}
+
+		OpHandler handler;
+		Op imm; //constant or offset word following the instruction (if it has one)
+		u16 iep; //address this was decoded from
+		u8 len; //size in bytes, 0 means not decoded (yet)
+		u8 index; //dense opcode number, the OpCodes::Table index
+		u8 realIndex; //same as index, unless the debugger patched that
+		u8 dst, src1, src2;
+
+		OpCodes::OpCodeType opcode() const { return OpCodes::fromIndex(realIndex); }
+	};
+
+	//the whole 16 bit address space, plus guard bytes/entries past the end so that
+	//u16 addresses and falling through the last instruction never need a bounds check
 	struct Memory
 	{
-		Memory(size_t memSize = 65536) : bytes(memSize,0), iep(bytes), sp(bytes)  
+		enum 
+		{ 
+			SIZE = 0x10000,
+			GUARD_SIZE = Decoded::MAX_LEN,
+			PAGE_BITS = 8 //granularity of codePages and dirtyPages
+		};
+
+		//access that didn't fit in the address space, the instruction doing it has no effect
+		struct Fault
 		{
-			iep.toBegin(); sp.toEnd();
-		}
+			Fault() : iep(0), address(0), size(0) {}
+			Fault(size_t iep, size_t address, size_t size) : iep(iep), address(address), size(size) {}
 
-		void init(const u8* data, size_t len) { sp.put(0,data,len); }
-	private:
-		ByteVector bytes;
-	public:
-		BufferPtr iep, sp;
+			size_t iep, address;
+			size_t size; //0 means no fault
+		};
+
+		Memory();
+
+		void init(const u8* data, size_t len) { len = std::min<size_t>(len,SIZE); memcpy(bytes,data,len); invalidateCode(0,len); dirtySince = 0; }
+		void reset(); //back to how the constructor left it, without allocating anything
 
+		size_t iep, sp; //sp goes from SIZE (empty stack) down
+		u8 bytes[SIZE + GUARD_SIZE];
+		vector<Decoded> decoded; //indexed by address
+		vector<u8> codePages; //nonzero if an instruction starting or ending in that page was ever decoded
+		vector<u8> dirtyPages; //nonzero if written by a store (STR, CALL, PUSH) since the snapshot dirtySince
+		u64 dirtySince; //Snapshot::id, 0 if memory was changed some other way (init, reset) since
+		u64 codeVersion; //changes whenever decoded instructions get thrown away
+		Jit* jit; //gets told about writes to code, if there is one
+		Fault fault; //set when a handler returns false because of a bad access
+
+		//true if size bytes at address are inside memory, otherwise records the fault for the instruction at currIEP and the handler should return false
+		inline bool check(size_t currIEP, size_t address, size_t size)
+		{
+			if (address + size <= SIZE)
+				return true;
+
+			fault = Fault(currIEP,address,size);
+			return false;
+		}
+		//unchecked, any u16 address stays inside bytes
 		Cpu::Op fetchOp(size_t offset) const
 		{
-			return Op(sp.read<u16>(offset)); //could be iep too, they both use the same underlying memory bytes
+			Op op;
+			memcpy(&op.u,&bytes[offset],sizeof(op.u));
+			return op;
 		}
 		void putOp(size_t offset, Cpu::Op op)
 		{
-			sp.put(offset,reinterpret_cast<const u8*>(&(op.u)),sizeof(op.u));
+			memcpy(&bytes[offset],&op.u,sizeof(op.u));
+			markDirty(offset,sizeof(op.u));
+			invalidate(offset,sizeof(op.u));
+		}
+		void putByte(size_t offset, u8 value)
+		{
+			bytes[offset] = value;
+			markDirty(offset,sizeof(value));
+			invalidate(offset,sizeof(value));
+		}
+		//len is at most a page
+		void markDirty(size_t offset, size_t len)
+		{
+			dirtyPages[offset >> PAGE_BITS] = 1;
+			dirtyPages[(offset + len - 1) >> PAGE_BITS] = 1;
 		}
+		//forget decodes and translations of every instruction that overlaps [offset, offset+len)
+		void invalidate(size_t offset, size_t len)
+		{
+			size_t lastPage = std::min((offset + len - 1) >> PAGE_BITS, codePages.size() - 1);
+			for (size_t page = offset >> PAGE_BITS;page <= lastPage;page++)
+			{
+				if (codePages[page])
+				{
+					invalidateCode(offset,len);
+					return;
+				}
+			}
+		}
+		void invalidateCode(size_t offset, size_t len);
 	} mem;
 
 	struct Psw
@@ -109,6 +246,7 @@ public:
 			bool oldC; //carry bit used when evaluating OP (for add and sub)
 			Op src1,src2; //operands
 			Op dst; //destination (result)
+			u32 src1Pair,src2Pair,dstPair; //same for the 32 bit ops on register pairs
 			OpCodes::OpCodeType op; //which op was used
 		} ocLazy;
 		//destination of last zn affecting op
@@ -118,12 +256,17 @@ public:
 		inline void setC(bool isSet) { val.c = isSet; set |= PSW_C_MASK; }
 		inline void setC() { setC(true); }
 		inline void clearC() { setC(false); }
+		inline void setO(bool isSet) { val.o = isSet; set |= PSW_O_MASK; }
 		
 		//faster to always lazy
 		inline bool getZ() const { return (znDst.u == 0); }
 		inline bool getN() const { return (znDst.i < 0); }
-		//all operations that change zn will do this
-		inline void setZN(Op dstReg) { znDst = dstReg; }		
+		//all operations that change zn will do this. O goes with it, only the arithmetic ones below work one out,
+		//so the signed branches compare the result's N with its own O instead of an older instruction's
+		inline void setZN(Op dstReg) { znDst = dstReg; setO(false); }
+		//a 32 bit result goes in as its high word, with the low bit also set if the low word isn't zero
+		inline void setZN32(u32 dst) { znDst.u = static_cast<u16>((dst >> 16) | ((dst & 0xFFFF) != 0)); setO(false); }
+		inline Op getZNDst() const { return znDst; }
 
 		inline bool getC() const
 		{
@@ -141,6 +284,13 @@ public:
 			case OpCodes::OP_SUB: //subtract with borrow
 				val.c = (ocLazy.src1.u < ocLazy.dst.u) || (ocLazy.oldC && (ocLazy.src2.u==0xFFFF));
 				break;
+			case OpCodes::OP_ADD32:
+				val.c = (ocLazy.dstPair < ocLazy.src1Pair);
+				break;
+			case OpCodes::OP_SUB32:
+			case OpCodes::OP_CMP32:
+				val.c = (ocLazy.src1Pair < ocLazy.src2Pair);
+				break;
 			}
 
 			//to avoid branch next time
@@ -162,6 +312,7 @@ public:
 				ocLazy.src2 = src2;
 				ocLazy.dst = dst;
 				ocLazy.op = type;
+				set &= ~(PSW_C_MASK | PSW_O_MASK); //both come from this op now, worked out when read
 				break;
 			default:
 				ocLazy.op = OpCodes::OP_COUNT;
@@ -169,6 +320,17 @@ public:
 			}
 		}
 
+		//ADD32, SUB32 and CMP32, which don't take C in
+		inline void arithmeticOp32(OpCodes::OpCodeType type, u32 src1, u32 src2, u32 dst)
+		{
+			setZN32(dst);
+			ocLazy.src1Pair = src1;
+			ocLazy.src2Pair = src2;
+			ocLazy.dstPair = dst;
+			ocLazy.op = type;
+			set &= ~(PSW_C_MASK | PSW_O_MASK);
+		}
+
 		inline bool getO() const
 		{
 			if (set & PSW_O_MASK)
@@ -184,6 +346,13 @@ public:
 			case OpCodes::OP_SUB: //subtract with borrow
 				val.o = ((ocLazy.src1.u ^ ocLazy.src2.u) & (ocLazy.src1.u ^ ocLazy.dst.u)) & 0x8000;
 				break;
+			case OpCodes::OP_ADD32:
+				val.o = ((ocLazy.src1Pair ^ ocLazy.src2Pair ^ 0x80000000) & (ocLazy.dstPair ^ ocLazy.src2Pair)) & 0x80000000;
+				break;
+			case OpCodes::OP_SUB32:
+			case OpCodes::OP_CMP32:
+				val.o = ((ocLazy.src1Pair ^ ocLazy.src2Pair) & (ocLazy.src1Pair ^ ocLazy.dstPair)) & 0x80000000;
+				break;
 			}
 
 			//to avoid branch next time
@@ -198,19 +367,160 @@ public:
 		string toString() const;
 	} psw;
 
-	bool execute(); // executes one instruction, return value is we should keep going or not
+	//everything a program can change, for running it again from the same point
+	struct Snapshot
+	{
+		Snapshot() : iep(0), sp(0), id(0) {}
+
+		Op regs[Registers::REG_COUNT];
+		Psw psw;
+		size_t iep, sp;
+		vector<u8> bytes; //all of memory
+		u64 id; //different for every snapshot() call
+	};
+	void snapshot(Snapshot& snap); //also starts tracking which pages get written after it
+	void restore(const Snapshot& snap); //only copies back the pages written since, if snap is the one being tracked
+
+	//breakpoints and watchpoints, changed through the debugger methods below, which patch the decoded
+	//instructions they concern into ones that stop, so nothing else pays for them
+	struct Debug
+	{
+		enum WatchKind
+		{
+			WATCH_READ = 1,
+			WATCH_WRITE = 2
+		};
+		struct Watch
+		{
+			size_t address, len;
+			u8 kind; //WatchKind bits
+		};
+
+		Debug() : breakHit(false), watchKind(0) {}
+
+		//true if [address, address+len) overlaps a watch of that kind, then also sets watchHit
+		bool hit(size_t currIEP, size_t address, size_t len, u8 kind);
+
+		std::set<size_t> breakpoints;
+		vector<Watch> watches;
+		std::bitset<(Memory::SIZE >> Memory::PAGE_BITS)> watchPages; //any watch touches that page
+		bool breakHit; //set by the breakpoint handler alongside it returning false
+		Memory::Fault watchHit; //instruction, address and size of the access that hit, size 0 if none
+		u8 watchKind; //which kind of access it was
+	} debug;
+
+	//what verify() proved about the code reachable from address 0, runUnchecked() relies on it
+	struct Verified
+	{
+		Verified() : safe(false), codeStart(0), codeEnd(0), codeVersion(~u64(0)) {}
+
+		bool safe; //every reachable instruction decodes and no constant STR hits one
+		std::bitset<Memory::SIZE> starts; //addresses of the reachable instructions, all decoded
+		size_t codeStart, codeEnd; //range they cover
+		u64 codeVersion; //Memory::codeVersion this holds for
+		string reason; //why it's not safe
+	} verified;
+
+	IoDevice* io; //where IN and OUT go, not owned, prompts on the console by default
+	bool inputWait; //set by IN when there was nothing to read, alongside its handler returning false
+
+	//compile time choices for the threaded core. runWith() gets instantiated (in Cpu.cpp) for each combination something
+	//runs, with all of it inlined, so whatever a combination leaves out costs nothing
+
+	//memory model, whether stores mark dirtyPages for restore()
+	struct TrackedMemory
+	{
+		enum { TRACKED = true };
+		static inline void stored(Memory& mem, size_t address, size_t size) { mem.markDirty(address,size); }
+	};
+	struct UntrackedMemory //then the next restore() copies all of memory back
+	{
+		enum { TRACKED = false };
+		static inline void stored(Memory&, size_t, size_t) {}
+	};
+
+	//checking, decode on first execution and have stores invalidate code they hit, or only run what verify() passed
+	struct CheckedCode { enum { CHECKED = true }; };
+	struct VerifiedCode { enum { CHECKED = false }; };
+
+	//io, through the IoDevice vtable or straight into a device class the caller knows cpu.io is
+	struct VirtualIo
+	{
+		static inline bool in(IoDevice* io, size_t iep, Registers::RegisterType reg, i16& value) { return io->in(iep,reg,value); }
+		static inline void out(IoDevice* io, size_t iep, Registers::RegisterType reg, i16 value) { io->out(iep,reg,value); }
+		static inline void flush(IoDevice* io) { io->flush(); }
+	};
+	template<typename Device>
+	struct DirectIo
+	{
+		static inline bool in(IoDevice* io, size_t iep, Registers::RegisterType reg, i16& value) { return static_cast<Device*>(io)->Device::in(iep,reg,value); }
+		static inline void out(IoDevice* io, size_t iep, Registers::RegisterType reg, i16 value) { static_cast<Device*>(io)->Device::out(iep,reg,value); }
+		static inline void flush(IoDevice* io) { static_cast<Device*>(io)->Device::flush(); }
+	};
+
+	//instrumentation, these hooks or a Profiler or Tracer, which have the same ones
+	struct NoInstrument
+	{
+		inline void executed(size_t) {}
+		inline void retired(const Decoded&) {}
+		inline void branch(size_t, bool) {}
+		inline void load(u16) {}
+		inline void store(u16) {}
+	};
+
+	template<typename MemoryModel, typename Checking, typename IoModel, typename Instrument>
+	struct Policy
+	{
+		typedef MemoryModel MemoryPolicy;
+		typedef Checking CheckPolicy;
+		typedef IoModel IoPolicy;
+		typedef Instrument InstrumentPolicy;
+	};
+	typedef Policy<TrackedMemory,CheckedCode,VirtualIo,NoInstrument> DefaultPolicy; //run()
+	typedef Policy<TrackedMemory,CheckedCode,DirectIo<VectorIo>,NoInstrument> BatchPolicy; //Batch, which restores between jobs
+	typedef Policy<UntrackedMemory,CheckedCode,DirectIo<TextIo>,NoInstrument> TextPolicy; //plain Emu runs with --io text
+	typedef Policy<UntrackedMemory,CheckedCode,DirectIo<BinaryIo>,NoInstrument> BinaryPolicy; //and --io binary
+
+	//the threaded core, up to budget instructions, cpu.io has to be what P::IoPolicy expects
+	template<typename P> Stop runWith(u64 budget, typename P::InstrumentPolicy& instrument);
+
+	Stop step(); // executes one instruction through its handler pointer
+	Stop runStepped(u64 budget = NO_BUDGET); // step() in a loop (reference engine)
+	Stop run(u64 budget = NO_BUDGET); // executes up to budget instructions with threaded dispatch
+	Stop runJit(u64 budget = NO_BUDGET); // like run(), but translates hot code to native instructions where the host allows it
+	Stop runProfiled(Profiler& prof, u64 budget = NO_BUDGET); // like run(), also counting what executed where into prof
+	Stop runTraced(Tracer& trace, u64 budget = NO_BUDGET); // like run(), also recording every instruction into trace's ring
+	Stop runUnchecked(u64 budget = NO_BUDGET); // like run(), minus the per instruction checks verify() made unnecessary, run() takes over for anything it didn't prove
+	bool verify(); // walks the code reachable from address 0 (following constant branch and call targets) and fills verified
+	void throwIfFault(const Stop& stop); // turns a STOP_FAULT into the matching CpuException
+	bool execute(); // executes one instruction, return value is we should keep going or not (HLT or waiting for input), throws on faults
+
+	//debugger, only the threaded and reference engines stop for these, runJit() runs threaded while any are set
+	void setBreakpoint(size_t address);
+	void clearBreakpoint(size_t address);
+	void setWatchpoint(size_t address, size_t len, u8 kind); //kind is Debug::WatchKind bits
+	void clearWatchpoints();
+	bool debugging() const { return !debug.breakpoints.empty() || !debug.watches.empty(); }
+	Stop stepInto(); // step() that also executes an instruction with a breakpoint on it
+	Stop stepOver(u64 budget = NO_BUDGET); // stepInto(), except a CALL also runs until it returns
+	Stop runToReturn(u64 budget = NO_BUDGET); // runs until a RET leaves the current function
+	Stop resume(u64 budget = NO_BUDGET); // run(), after stepping off the breakpoint IEP might be sitting on
 private:
-	void fetchArithmeticOps(size_t currIEP, Registers::RegisterType src1, Registers::RegisterType src2, Op& op1, Op& op2);
-	void arithmeticInstr(size_t currIEP, OpCodes::OpCodeType instr, Registers::RegisterType dst, Registers::RegisterType src1, Registers::RegisterType src2);
-	static void CheckNull(size_t currIEP, Registers::RegisterType r, const char* regName);
-	static void CheckReg(size_t currIEP, Registers::RegisterType r, const char* regName);
-	inline Op resolveAddress(Registers::RegisterType reg)
-	{
-		Op offset(mem.iep.read<i16>());
-		if (reg == Registers::REG_CONSTANT)
-			return offset;
-		else
-			return Op(static_cast<i16>(regs[reg].i + offset.i));
+	Stop stopped(size_t currIEP, u64 count); //what the handler of the instruction at currIEP returning false meant, count is what completed before it
+	friend class Jit;
+	friend class Lanes;
+	std::unique_ptr<Jit> jit;
+
+	const Decoded& decode(size_t currIEP);
+	const Decoded& fetchFault(size_t currIEP, size_t size); //what decode returns for instructions that don't fit in memory
+	void patch(Decoded& ins, size_t address, bool withBreakpoint) const; //sets index and handler from realIndex and the debugger state
+	void repatch(size_t address); //after the debugger state for it changed, if it is decoded
+	inline const Decoded& fetchDecoded(size_t currIEP)
+	{
+		const Decoded& ins = mem.decoded[currIEP]; //currIEP is at most SIZE + MAX_LEN - 1
+		if (ins.len != 0)
+			return ins;
+
+		return decode(currIEP);
 	}
-	bool otherInstr(size_t currIEP, OpCodes::OpCodeType instr, Registers::RegisterType dst, Registers::RegisterType src);
-};
+};
\ No newline at end of file
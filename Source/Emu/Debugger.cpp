@@ -0,0 +1,255 @@
+#include "Debugger.h"
+#include "Profiler.h"
+#include <sstream>
+#include <cstdlib>
+#include <stdio.h>
+
+namespace
+{
+	string HexWord(size_t val)
+	{
+		char hexPos[16] = {0};
+		sprintf(hexPos,"0x%04x",static_cast<u32>(val));
+		return hexPos;
+	}
+
+	bool ParseNumber(const string& str, u64& val)
+	{
+		if (str.empty())
+			return false;
+
+		char* end = nullptr;
+		val = strtoull(str.c_str(),&end,0);
+		return *end == 0;
+	}
+};
+
+void Debugger::run( std::istream& in, std::ostream& out )
+{
+	where(out);
+
+	string line;
+	while (out << "(dbg) " << std::flush, std::getline(in,line))
+	{
+		if (!command(line,out))
+			break;
+	}
+}
+
+bool Debugger::command( const string& line, std::ostream& out )
+{
+	std::istringstream words(line);
+	string cmd, arg1, arg2, arg3;
+	words >> cmd >> arg1 >> arg2 >> arg3;
+	if (cmd.empty())
+		return true;
+
+	const bool runs = (cmd == "continue" || cmd == "c" || cmd == "step" || cmd == "s" || cmd == "next" || cmd == "n" || cmd == "finish" || cmd == "f");
+	if (runs && halted)
+	{
+		out << "Program finished executing, restart it first" << std::endl;
+		return true;
+	}
+
+	size_t address = 0;
+	u64 num = 0;
+	if (cmd == "quit" || cmd == "q")
+		return false;
+	else if (cmd == "help" || cmd == "h")
+	{
+		out << "break|b ADDR            stop before executing ADDR" << std::endl;
+		out << "delete|d ADDR           remove that breakpoint" << std::endl;
+		out << "watch|w ADDR [LEN] [r|w|rw] stop after an instruction touches LEN bytes at ADDR (default 2, w)" << std::endl;
+		out << "unwatch                 remove all watchpoints" << std::endl;
+		out << "info|i                  list breakpoints and watchpoints" << std::endl;
+		out << "continue|c [N]          run (at most N instructions)" << std::endl;
+		out << "step|s [N]              execute N instructions (default 1)" << std::endl;
+		out << "next|n                  step, but run CALLs until they return" << std::endl;
+		out << "finish|f                run until the current function returns" << std::endl;
+		out << "restart                 back to how the program was loaded, breakpoints and watchpoints stay" << std::endl;
+		out << "regs|r                  registers, flags, IEP and SP" << std::endl;
+		out << "mem|m ADDR [N]          N words of memory (default 8)" << std::endl;
+		out << "quit|q" << std::endl;
+		out << "ADDR is a number (0x for hex) or a label if a listing was given" << std::endl;
+	}
+	else if (cmd == "break" || cmd == "b" || cmd == "delete" || cmd == "d")
+	{
+		if (!parseAddress(arg1,address))
+		{
+			out << "Bad address " << arg1 << std::endl;
+			return true;
+		}
+
+		if (cmd[0] == 'b')
+		{
+			cpu.setBreakpoint(address);
+			out << "Breakpoint at " << HexWord(address) << std::endl;
+		}
+		else
+		{
+			cpu.clearBreakpoint(address);
+			out << "Deleted breakpoint at " << HexWord(address) << std::endl;
+		}
+	}
+	else if (cmd == "watch" || cmd == "w")
+	{
+		u64 len = sizeof(u16);
+		string kindStr = "w";
+		if (!arg2.empty() && !ParseNumber(arg2,len))
+			kindStr = arg2;
+		else if (!arg3.empty())
+			kindStr = arg3;
+
+		u8 kind = 0;
+		if (kindStr.find('r') != string::npos)
+			kind |= Cpu::Debug::WATCH_READ;
+		if (kindStr.find('w') != string::npos)
+			kind |= Cpu::Debug::WATCH_WRITE;
+
+		if (!parseAddress(arg1,address) || len == 0 || kind == 0)
+		{
+			out << "Usage: watch ADDR [LEN] [r|w|rw]" << std::endl;
+			return true;
+		}
+		cpu.setWatchpoint(address,static_cast<size_t>(len),kind);
+		out << "Watching " << len << " bytes at " << HexWord(address) << std::endl;
+	}
+	else if (cmd == "unwatch")
+		cpu.clearWatchpoints();
+	else if (cmd == "info" || cmd == "i")
+	{
+		for (auto it=cpu.debug.breakpoints.begin();it!=cpu.debug.breakpoints.end();++it)
+		{
+			out << "Breakpoint at " << HexWord(*it);
+			if (listing)
+				out << " " << listing->location(*it);
+			out << std::endl;
+		}
+		for (auto it=cpu.debug.watches.begin();it!=cpu.debug.watches.end();++it)
+		{
+			out << "Watching " << it->len << " bytes at " << HexWord(it->address) << " for" <<
+				((it->kind & Cpu::Debug::WATCH_READ) ? " reads" : "") << ((it->kind & Cpu::Debug::WATCH_WRITE) ? " writes" : "") << std::endl;
+		}
+	}
+	else if (cmd == "continue" || cmd == "c")
+	{
+		num = Cpu::NO_BUDGET;
+		if (!arg1.empty() && !ParseNumber(arg1,num))
+		{
+			out << "Bad count " << arg1 << std::endl;
+			return true;
+		}
+		stopped(cpu.resume(num),out);
+	}
+	else if (cmd == "step" || cmd == "s")
+	{
+		num = 1;
+		if (!arg1.empty() && !ParseNumber(arg1,num))
+		{
+			out << "Bad count " << arg1 << std::endl;
+			return true;
+		}
+
+		Cpu::Stop stop(Cpu::Stop::STOP_BUDGET,0,cpu.mem.iep);
+		for (u64 i=0;i<num && stop.reason == Cpu::Stop::STOP_BUDGET;i++)
+		{
+			u64 count = stop.count;
+			stop = (i == 0) ? cpu.stepInto() : cpu.step();
+			stop.count += count;
+		}
+		stopped(stop,out);
+	}
+	else if (cmd == "next" || cmd == "n")
+		stopped(cpu.stepOver(),out);
+	else if (cmd == "finish" || cmd == "f")
+		stopped(cpu.runToReturn(),out);
+	else if (cmd == "restart")
+	{
+		cpu.restore(start);
+		halted = false;
+		where(out);
+	}
+	else if (cmd == "regs" || cmd == "r")
+		cpu.dumpState(out);
+	else if (cmd == "mem" || cmd == "m")
+	{
+		num = 8;
+		if (!parseAddress(arg1,address) || (!arg2.empty() && !ParseNumber(arg2,num)))
+		{
+			out << "Usage: mem ADDR [N]" << std::endl;
+			return true;
+		}
+
+		for (u64 i=0;i<num && address + sizeof(u16) <= Cpu::Memory::SIZE;i++,address+=sizeof(u16))
+		{
+			if (i % 8 == 0)
+				out << (i ? "\n" : "") << HexWord(address) << ":";
+			out << " " << HexWord(cpu.mem.fetchOp(address).u);
+		}
+		out << std::endl;
+	}
+	else
+		out << "Unknown command " << cmd << ", try help" << std::endl;
+
+	return true;
+}
+
+bool Debugger::parseAddress( const string& str, size_t& address ) const
+{
+	u64 val;
+	if (ParseNumber(str,val))
+	{
+		if (val >= Cpu::Memory::SIZE)
+			return false;
+
+		address = static_cast<size_t>(val);
+		return true;
+	}
+	return listing && listing->find(str,address);
+}
+
+void Debugger::where( std::ostream& out ) const
+{
+	out << "IEP: " << HexWord(cpu.mem.iep);
+	if (listing)
+	{
+		out << " " << listing->location(cpu.mem.iep);
+		const Listing::Line* line = listing->at(cpu.mem.iep);
+		if (line)
+			out << " " << line->file << ":" << line->lineNum << " " << line->text;
+	}
+	out << std::endl;
+}
+
+void Debugger::stopped( const Cpu::Stop& stop, std::ostream& out )
+{
+	switch (stop.reason)
+	{
+	case Cpu::Stop::STOP_HALT:
+		out << "Program finished executing" << std::endl;
+		halted = true;
+		break;
+	case Cpu::Stop::STOP_FAULT:
+		try
+		{
+			cpu.throwIfFault(stop);
+		}
+		catch(const Cpu::CpuException& e)
+		{
+			out << e.toString() << std::endl;
+		}
+		break;
+	case Cpu::Stop::STOP_IO_WAIT:
+		out << "Ran out of input" << std::endl;
+		break;
+	case Cpu::Stop::STOP_BREAKPOINT:
+		out << "Breakpoint" << std::endl;
+		break;
+	case Cpu::Stop::STOP_WATCHPOINT:
+		out << "Watchpoint: " << ((cpu.debug.watchKind == Cpu::Debug::WATCH_READ) ? "read" : "write") << " of " << cpu.debug.watchHit.size <<
+			" bytes at " << HexWord(cpu.debug.watchHit.address) << " by " << HexWord(cpu.debug.watchHit.iep) << std::endl;
+		break;
+	}
+	out << stop.count << " instructions executed" << std::endl;
+	where(out);
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include "Cpu.h"
+#include <istream>
+#include <ostream>
+
+class Listing;
+
+//line based commands for the Cpu debugger methods (break, watch, continue, step, next, finish, restart, regs, mem)
+class Debugger
+{
+public:
+	Debugger(Cpu& cpu, const Listing* listing = nullptr) : cpu(cpu), listing(listing), halted(false) { cpu.snapshot(start); }
+
+	void run(std::istream& in, std::ostream& out); //until quit or the commands run out
+private:
+	bool command(const string& line, std::ostream& out); //false on quit
+	bool parseAddress(const string& str, size_t& address) const; //number or, with a listing, label
+	void where(std::ostream& out) const; //the instruction at IEP
+	void stopped(const Cpu::Stop& stop, std::ostream& out);
+
+	Cpu& cpu;
+	const Listing* listing;
+	Cpu::Snapshot start; //what restart goes back to
+	bool halted; //ran into HLT, nothing runs until restart
+};
@@ -0,0 +1,111 @@
+#include "IoDevice.h"
+#include <cctype>
+#include <stdio.h>
+
+namespace
+{
+	string IepToString(size_t iep)
+	{
+		char hexPos[16] = {0};
+		sprintf(hexPos,"0x%04x",static_cast<u32>(iep));
+		return hexPos;
+	}
+
+	typedef std::char_traits<char> Traits;
+};
+
+bool InteractiveIo::in( size_t iep, Registers::RegisterType reg, i16& value )
+{
+	output << "IEP: " << IepToString(iep) << " Enter value into " << Registers::toString(reg) << ":";
+	return !!(input >> value);
+}
+
+void InteractiveIo::out( size_t iep, Registers::RegisterType reg, i16 value )
+{
+	output << "IEP: " << IepToString(iep) << " Value of " << Registers::toString(reg) << ": " << value << std::endl;
+}
+
+void BufferedIo::flush()
+{
+	if (!outBuf.empty())
+	{
+		output.write(reinterpret_cast<const char*>(&outBuf[0]),outBuf.size());
+		outBuf.clear();
+	}
+	output.flush();
+}
+
+bool TextIo::in( size_t, Registers::RegisterType, i16& value )
+{
+	int c = input.sgetc();
+	while (c != Traits::eof() && isspace(c))
+		c = input.snextc();
+
+	bool negative = (c == '-');
+	if (negative || c == '+')
+		c = input.snextc();
+	if (c == Traits::eof() || !isdigit(c))
+		return false;
+
+	//anything that fits in 16 bits, signed or not
+	u32 absVal = 0;
+	for (;c != Traits::eof() && isdigit(c);c = input.snextc())
+	{
+		absVal = absVal*10 + (c - '0');
+		if (absVal > (negative ? 0x8000u : 0xFFFFu))
+			return false;
+	}
+
+	value = static_cast<i16>(negative ? (0x10000u - absVal) : absVal);
+	return true;
+}
+
+void TextIo::out( size_t, Registers::RegisterType, i16 value )
+{
+	char digits[8]; //-32768 and newline
+	char* at = digits + sizeof(digits);
+	*--at = '\n';
+	u32 absVal = (value < 0) ? static_cast<u32>(-static_cast<i32>(value)) : static_cast<u32>(value);
+	do
+	{
+		*--at = static_cast<char>('0' + absVal % 10);
+		absVal /= 10;
+	} while (absVal != 0);
+	if (value < 0)
+		*--at = '-';
+
+	reserve(digits + sizeof(digits) - at);
+	outBuf.insert(outBuf.end(),at,digits + sizeof(digits));
+}
+
+bool BinaryIo::in( size_t, Registers::RegisterType, i16& value )
+{
+	char word[sizeof(u16)];
+	if (input.sgetn(word,sizeof(word)) != sizeof(word))
+		return false;
+
+	value = static_cast<i16>(static_cast<u8>(word[0]) | (static_cast<u8>(word[1]) << 8));
+	return true;
+}
+
+void BinaryIo::out( size_t, Registers::RegisterType, i16 value )
+{
+	reserve(sizeof(u16));
+	u16 word = static_cast<u16>(value);
+	outBuf.push_back(static_cast<u8>(word & 0xFF));
+	outBuf.push_back(static_cast<u8>(word >> 8));
+}
+
+bool CountingIo::in( size_t iep, Registers::RegisterType reg, i16& value )
+{
+	if (!inner.in(iep,reg,value))
+		return false;
+
+	inputs++;
+	return true;
+}
+
+void CountingIo::out( size_t iep, Registers::RegisterType reg, i16 value )
+{
+	inner.out(iep,reg,value);
+}
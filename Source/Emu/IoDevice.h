@@ -0,0 +1,108 @@
+#pragma once
+
+#include "Common/Types.h"
+#include "Common/Registers.h"
+#include <istream>
+#include <ostream>
+
+//where IN gets its values from and OUT sends them to
+class IoDevice
+{
+public:
+	virtual ~IoDevice() {}
+
+	//false if there is nothing to read (yet), IN then stops the cpu waiting for input
+	virtual bool in(size_t iep, Registers::RegisterType reg, i16& value) = 0;
+	virtual void out(size_t iep, Registers::RegisterType reg, i16 value) = 0;
+	//called on HLT, buffered devices also do it when their buffer fills up
+	virtual void flush() {}
+};
+
+//prompt for every IN and print every OUT right away, like the emulator always did
+class InteractiveIo : public IoDevice
+{
+public:
+	InteractiveIo(std::istream& input, std::ostream& output) : input(input), output(output) {}
+
+	bool in(size_t iep, Registers::RegisterType reg, i16& value) OVERRIDE;
+	void out(size_t iep, Registers::RegisterType reg, i16 value) OVERRIDE;
+private:
+	std::istream& input;
+	std::ostream& output;
+};
+
+//output side shared by the stream backends, only written out when full or flushed
+class BufferedIo : public IoDevice
+{
+public:
+	enum { BUFFER_SIZE = 64 * 1024 };
+
+	BufferedIo(std::istream& input, std::ostream& output) : input(*input.rdbuf()), output(output) { outBuf.reserve(BUFFER_SIZE); }
+	~BufferedIo() { flush(); }
+
+	void flush() OVERRIDE;
+protected:
+	void reserve(size_t len) { if (outBuf.size() + len > BUFFER_SIZE) flush(); }
+
+	std::streambuf& input; //read directly, it does its own buffering without blocking for more than is there
+	ByteVector outBuf;
+private:
+	std::ostream& output;
+};
+
+//whitespace separated decimal values in, one per line out
+class TextIo : public BufferedIo
+{
+public:
+	TextIo(std::istream& input, std::ostream& output) : BufferedIo(input,output) {}
+
+	bool in(size_t iep, Registers::RegisterType reg, i16& value) OVERRIDE;
+	void out(size_t iep, Registers::RegisterType reg, i16 value) OVERRIDE;
+};
+
+//raw little endian words both ways
+class BinaryIo : public BufferedIo
+{
+public:
+	BinaryIo(std::istream& input, std::ostream& output) : BufferedIo(input,output) {}
+
+	bool in(size_t iep, Registers::RegisterType reg, i16& value) OVERRIDE;
+	void out(size_t iep, Registers::RegisterType reg, i16 value) OVERRIDE;
+};
+
+//for embedding, values come from and go to vectors the owner can get at
+class VectorIo : public IoDevice
+{
+public:
+	VectorIo() : inputPos(0) {}
+	VectorIo(const vector<i16>& input) : input(input), inputPos(0) {}
+
+	//in here, so Cpu::DirectIo<VectorIo> inlines them
+	bool in(size_t, Registers::RegisterType, i16& value) OVERRIDE
+	{
+		if (inputPos >= input.size())
+			return false;
+
+		value = input[inputPos++];
+		return true;
+	}
+	void out(size_t, Registers::RegisterType, i16 value) OVERRIDE { output.push_back(value); }
+
+	vector<i16> input; //more can be appended while the cpu waits for input
+	size_t inputPos; //next one IN gets
+	vector<i16> output;
+};
+
+//passes everything through to another device, counting the values IN got from it
+class CountingIo : public IoDevice
+{
+public:
+	CountingIo(IoDevice& inner) : inner(inner), inputs(0) {}
+
+	bool in(size_t iep, Registers::RegisterType reg, i16& value) OVERRIDE;
+	void out(size_t iep, Registers::RegisterType reg, i16 value) OVERRIDE;
+	void flush() OVERRIDE { inner.flush(); }
+
+	IoDevice& inner;
+	u64 inputs;
+};
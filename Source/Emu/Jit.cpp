@@ -0,0 +1,1127 @@
+#include "Jit.h"
+#include "IoDevice.h"
+#include <cstddef>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <iostream>
+
+#if defined(__x86_64__) && !defined(_WIN32)
+#define JIT_X64
+#include <sys/mman.h>
+#endif
+
+namespace
+{
+	//low 2 bits of what translated code returns, the rest is the index of the exit taken (for chaining)
+	enum ExitCode
+	{
+		EXIT_NEXT = 0, //continue at ctx.iep
+		EXIT_INTERPRET = 1, //interpret the instruction at ctx.iep
+		EXIT_HALT = 2
+	};
+	const u32 NO_EXIT = 0x3FFFFFFF; //exit can't be chained (indirect jump, side exit)
+	inline u32 ExitResult(ExitCode code, u32 exitIdx = NO_EXIT) { return code | (exitIdx << 2); }
+
+	const size_t CODE_BUFFER_SIZE = 4 << 20;
+	const size_t MAX_BLOCK_INSTRUCTIONS = 64;
+	const size_t MAX_BLOCK_CODE = 192 * MAX_BLOCK_INSTRUCTIONS; //generous upper bound of emitted bytes per block
+
+	//just enough of x86-64 for what the translator needs, all context accesses are [rbx+disp32]
+	class Emitter
+	{
+	public:
+		enum HostReg { EAX = 0, ECX = 1, EDX = 2, EBX = 3, ESP = 4, EBP = 5, ESI = 6, EDI = 7 };
+		enum Cond { CC_O = 0x0, CC_B = 0x2, CC_E = 0x4, CC_NE = 0x5, CC_A = 0x7 };
+		enum Alu { ALU_ADD = 0x01, ALU_OR = 0x09, ALU_ADC = 0x11, ALU_SBB = 0x19, ALU_AND = 0x21, ALU_SUB = 0x29, ALU_CMP = 0x39 };
+
+		Emitter(u8* at) : p(at) {}
+		u8* here() const { return p; }
+
+		void byte(u8 b) { *p++ = b; }
+		void dword(u32 d) { memcpy(p,&d,sizeof(d)); p += sizeof(d); }
+		void qword(u64 q) { memcpy(p,&q,sizeof(q)); p += sizeof(q); }
+
+		void loadWord(HostReg r, u32 disp) { byte(0x0F); byte(0xB7); ctxOperand(r,disp); } //movzx r32, word [rbx+disp]
+		void loadWordSigned(HostReg r, u32 disp) { byte(0x0F); byte(0xBF); ctxOperand(r,disp); } //movsx r32, word [rbx+disp]
+		void loadByte(HostReg r, u32 disp) { byte(0x0F); byte(0xB6); ctxOperand(r,disp); } //movzx r32, byte [rbx+disp]
+		void loadDword(HostReg r, u32 disp) { byte(0x8B); ctxOperand(r,disp); }
+		void loadPtr(HostReg r, u32 disp) { byte(0x48); byte(0x8B); ctxOperand(r,disp); }
+		void storeWord(u32 disp, HostReg r) { byte(0x66); byte(0x89); ctxOperand(r,disp); }
+		void storeDword(u32 disp, HostReg r) { byte(0x89); ctxOperand(r,disp); }
+		void storeDwordImm(u32 disp, u32 imm) { byte(0xC7); ctxOperand(0,disp); dword(imm); }
+		void storeByteImm(u32 disp, u8 imm) { byte(0xC6); ctxOperand(0,disp); byte(imm); }
+		void xorByteImm(u32 disp, u8 imm) { byte(0x80); ctxOperand(6,disp); byte(imm); }
+		void addQwordImm(u32 disp, u32 imm) { byte(0x48); byte(0x81); ctxOperand(0,disp); dword(imm); }
+		void subQwordImm(u32 disp, u32 imm) { byte(0x48); byte(0x81); ctxOperand(5,disp); dword(imm); }
+		void cmpQwordImm(u32 disp, u32 imm) { byte(0x48); byte(0x81); ctxOperand(7,disp); dword(imm); }
+
+		void movImm(HostReg r, u32 imm) { byte(0xB8 + r); dword(imm); }
+		void mov(HostReg dst, HostReg src) { byte(0x89); byte(0xC0 | (src << 3) | dst); }
+		void alu(Alu op, HostReg dst, HostReg src) { byte(op); byte(0xC0 | (src << 3) | dst); }
+		void addImm(HostReg r, u32 imm) { byte(0x81); byte(0xC0 | (0 << 3) | r); dword(imm); }
+		void subImm(HostReg r, u32 imm) { byte(0x81); byte(0xC0 | (5 << 3) | r); dword(imm); }
+		void cmpImm(HostReg r, u32 imm) { byte(0x81); byte(0xC0 | (7 << 3) | r); dword(imm); }
+		void notReg(HostReg r) { byte(0xF7); byte(0xC0 | (2 << 3) | r); }
+		void shrImm(HostReg r, u8 n) { byte(0xC1); byte(0xC0 | (5 << 3) | r); byte(n); }
+		void shlImm(HostReg r, u8 n) { byte(0xC1); byte(0xC0 | (4 << 3) | r); byte(n); }
+		void sarImm(HostReg r, u8 n) { byte(0xC1); byte(0xC0 | (7 << 3) | r); byte(n); }
+		void signExtend16(HostReg r) { byte(0x0F); byte(0xBF); byte(0xC0 | (r << 3) | r); }
+		void setccByte(Cond cc, u32 disp) { byte(0x0F); byte(0x90 | cc); ctxOperand(0,disp); } //setcc byte [rbx+disp]
+		void test(HostReg a, HostReg b) { byte(0x85); byte(0xC0 | (b << 3) | a); }
+		void zeroExtend16(HostReg r) { byte(0x0F); byte(0xB7); byte(0xC0 | (r << 3) | r); }
+
+		//[base+index] accesses, base must not be rbp/r13
+		void loadMemWord(HostReg dst, HostReg base, HostReg index) { byte(0x0F); byte(0xB7); byte((dst << 3) | 4); byte((index << 3) | base); }
+		void loadMemByte(HostReg dst, HostReg base, HostReg index) { byte(0x0F); byte(0xB6); byte((dst << 3) | 4); byte((index << 3) | base); }
+		void loadMemByteSigned(HostReg dst, HostReg base, HostReg index) { byte(0x0F); byte(0xBE); byte((dst << 3) | 4); byte((index << 3) | base); }
+		void storeMemWord(HostReg base, HostReg index, HostReg src) { byte(0x66); byte(0x89); byte((src << 3) | 4); byte((index << 3) | base); }
+		void storeMemByteImm(HostReg base, HostReg index, u8 imm) { byte(0xC6); byte(4); byte((index << 3) | base); byte(imm); }
+		void storeMemByte(HostReg base, HostReg index, HostReg src) { byte(0x88); byte((src << 3) | 4); byte((index << 3) | base); } //src's low byte, eax to ebx only
+
+		//forward jumps return where their rel32 is, so it can be bound later
+		u8* jcc(Cond cc) { byte(0x0F); byte(0x80 | cc); return rel32(); }
+		u8* jmp() { byte(0xE9); return rel32(); }
+		void jmpTo(const u8* target) { bind(jmp(),target); }
+		static void bind(u8* rel, const u8* target)
+		{
+			i32 offs = static_cast<i32>(target - (rel + sizeof(i32)));
+			memcpy(rel,&offs,sizeof(offs));
+		}
+		void bindHere(u8* rel) { bind(rel,p); }
+
+		void callAbs(const void* func) { byte(0x48); byte(0xB8); qword(reinterpret_cast<u64>(func)); byte(0xFF); byte(0xD0); } //mov rax, func; call rax
+	private:
+		void ctxOperand(u8 reg, u32 disp) { byte(0x80 | (reg << 3) | EBX); dword(disp); }
+		u8* rel32() { u8* at = p; dword(0); return at; }
+
+		u8* p;
+	};
+
+	inline bool TranslatableOp(const Cpu::Decoded& ins)
+	{
+		switch (ins.opcode())
+		{
+		case OpCodes::OP_ADD:
+		case OpCodes::OP_SUB:
+		case OpCodes::OP_CMP:
+		case OpCodes::OP_AND:
+		case OpCodes::OP_OR:
+		case OpCodes::OP_NOT:
+		case OpCodes::OP_JMP:
+		case OpCodes::OP_MOV:
+		case OpCodes::OP_LDR:
+		case OpCodes::OP_STR:
+		case OpCodes::OP_CLC:
+		case OpCodes::OP_STC:
+		case OpCodes::OP_NC:
+		case OpCodes::OP_MOVTSP:
+		case OpCodes::OP_MOVFSP:
+		case OpCodes::OP_RET:
+		case OpCodes::OP_HLT:
+		case OpCodes::OP_PUSH:
+		case OpCodes::OP_POP:
+		case OpCodes::OP_LDRX:
+		case OpCodes::OP_STRX:
+		case OpCodes::OP_LDRP:
+		case OpCodes::OP_STRP:
+		case OpCodes::OP_LDRB:
+		case OpCodes::OP_LDRSB:
+		case OpCodes::OP_STRB:
+		case OpCodes::OP_ADD32:
+		case OpCodes::OP_SUB32:
+		case OpCodes::OP_CMP32:
+			return true;
+		case OpCodes::OP_JZ:
+		case OpCodes::OP_JGT:
+		case OpCodes::OP_JNZ:
+		case OpCodes::OP_JLT:
+		case OpCodes::OP_JGE:
+		case OpCodes::OP_JLE:
+		case OpCodes::OP_JC:
+		case OpCodes::OP_JNC:
+		case OpCodes::OP_JO:
+		case OpCodes::OP_JN:
+		case OpCodes::OP_LOOP:
+		case OpCodes::OP_CALL:
+			return ins.src1 == Registers::REG_CONSTANT; //what the assembler emits for labels
+		case OpCodes::OP_SAR:
+		case OpCodes::OP_SAL:
+			return ins.src2 == Registers::REG_CONSTANT && ins.imm.u < 16; //wider counts have C++ promotion quirks
+		case OpCodes::OP_SAL32:
+		case OpCodes::OP_SAR32:
+			return ins.src1 == Registers::REG_CONSTANT && ins.imm.u < 32; //the host masks counts to 5 bits
+		default: //IN/OUT, MOVF, PUSHM/POPM, and the block ones which are a single host call interpreted anyway
+			return false;
+		}
+	}
+
+	inline bool EndsBlock(OpCodes::OpCodeType op)
+	{
+		switch (op)
+		{
+		case OpCodes::OP_JMP:
+		case OpCodes::OP_JZ:
+		case OpCodes::OP_JGT:
+		case OpCodes::OP_JNZ:
+		case OpCodes::OP_JLT:
+		case OpCodes::OP_JGE:
+		case OpCodes::OP_JLE:
+		case OpCodes::OP_JC:
+		case OpCodes::OP_JNC:
+		case OpCodes::OP_JO:
+		case OpCodes::OP_JN:
+		case OpCodes::OP_LOOP:
+		case OpCodes::OP_CALL:
+		case OpCodes::OP_RET:
+		case OpCodes::OP_HLT:
+			return true;
+		default:
+			return false;
+		}
+	}
+
+	inline bool WritesZN(OpCodes::OpCodeType op)
+	{
+		switch (op)
+		{
+		case OpCodes::OP_ADD:
+		case OpCodes::OP_SUB:
+		case OpCodes::OP_CMP:
+		case OpCodes::OP_SAR:
+		case OpCodes::OP_SAL:
+		case OpCodes::OP_AND:
+		case OpCodes::OP_OR:
+		case OpCodes::OP_NOT:
+		case OpCodes::OP_MOV:
+		case OpCodes::OP_LDR:
+		case OpCodes::OP_LDRX:
+		case OpCodes::OP_LDRP:
+		case OpCodes::OP_LDRB:
+		case OpCodes::OP_LDRSB:
+		case OpCodes::OP_ADD32:
+		case OpCodes::OP_SUB32:
+		case OpCodes::OP_CMP32:
+		case OpCodes::OP_SAL32:
+		case OpCodes::OP_SAR32:
+			return true;
+		default:
+			return false;
+		}
+	}
+
+	//works O out along with zn, every other zn writer clears it like Psw::setZN
+	inline bool WritesO(OpCodes::OpCodeType op)
+	{
+		switch (op)
+		{
+		case OpCodes::OP_ADD:
+		case OpCodes::OP_SUB:
+		case OpCodes::OP_CMP:
+		case OpCodes::OP_ADD32:
+		case OpCodes::OP_SUB32:
+		case OpCodes::OP_CMP32:
+			return true;
+		default:
+			return false;
+		}
+	}
+
+	//reads zn, or can leave the block before writing it (so the interpreter needs it to be current)
+	inline bool NeedsZN(OpCodes::OpCodeType op)
+	{
+		switch (op)
+		{
+		case OpCodes::OP_JZ:
+		case OpCodes::OP_JGT:
+		case OpCodes::OP_JNZ:
+		case OpCodes::OP_JLT:
+		case OpCodes::OP_JGE:
+		case OpCodes::OP_JLE:
+		case OpCodes::OP_JC:
+		case OpCodes::OP_JNC:
+		case OpCodes::OP_JO:
+		case OpCodes::OP_JN:
+		case OpCodes::OP_LOOP:
+		case OpCodes::OP_LDR:
+		case OpCodes::OP_STR:
+		case OpCodes::OP_CALL:
+		case OpCodes::OP_RET:
+		case OpCodes::OP_PUSH:
+		case OpCodes::OP_POP:
+		case OpCodes::OP_LDRX:
+		case OpCodes::OP_STRX:
+		case OpCodes::OP_LDRP:
+		case OpCodes::OP_STRP:
+		case OpCodes::OP_STRB: //LDRB has no check to leave at
+			return true;
+		default:
+			return false;
+		}
+	}
+};
+
+#define CTX(field) static_cast<u32>(offsetof(Context,field))
+#define CTX_REG(reg) static_cast<u32>(offsetof(Context,regs) + (reg)*sizeof(u16))
+
+Jit::Jit( Cpu& cpu ) : cpu(cpu), codeBuf(nullptr), codeSize(0), codeFree(nullptr), epilogue(nullptr), codeWritable(false), invalidated(false)
+{
+	memset(&ctx,0,sizeof(ctx));
+	ctx.jit = this;
+	ctx.codePages = &cpu.mem.codePages[0];
+	ctx.dirtyPages = &cpu.mem.dirtyPages[0];
+
+#ifdef JIT_X64
+	void* mapped = mmap(nullptr,CODE_BUFFER_SIZE,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS,-1,0);
+	if (mapped == MAP_FAILED)
+		std::cerr << "Can't map the JIT code buffer (" << strerror(errno) << "), running interpreted" << std::endl;
+	else
+	{
+		codeBuf = static_cast<u8*>(mapped);
+		codeSize = CODE_BUFFER_SIZE;
+		codeWritable = true;
+
+		//u32 enter(Context* ctx, const u8* code)
+		Emitter em(codeBuf);
+		em.byte(0x53); //push rbx
+		em.byte(0x48); em.byte(0x89); em.byte(0xFB); //mov rbx, rdi
+		em.byte(0xFF); em.byte(0xE6); //jmp rsi
+		//every exit ends up here with the result in eax
+		epilogue = em.here();
+		em.byte(0x5B); //pop rbx
+		em.byte(0xC3); //ret
+		codeFree = em.here();
+
+		//find out now if the host lets it become executable at all, not in the middle of a run
+		if (mprotect(codeBuf,codeSize,PROT_READ|PROT_EXEC) != 0)
+		{
+			std::cerr << "Can't make the JIT code buffer executable (" << strerror(errno) << "), running interpreted" << std::endl;
+			munmap(codeBuf,codeSize);
+			codeBuf = codeFree = epilogue = nullptr;
+			codeSize = 0;
+		}
+		codeWritable = false;
+	}
+#endif
+
+	cpu.mem.jit = this;
+	entries.resize(Cpu::Memory::SIZE,nullptr);
+}
+
+Jit::~Jit()
+{
+	cpu.mem.jit = nullptr;
+#ifdef JIT_X64
+	if (codeBuf)
+		munmap(codeBuf,codeSize);
+#endif
+}
+
+void Jit::protect( bool writable )
+{
+#ifdef JIT_X64
+	if (writable == codeWritable)
+		return;
+	if (mprotect(codeBuf,codeSize,writable ? (PROT_READ|PROT_WRITE) : (PROT_READ|PROT_EXEC)) != 0)
+	{
+		//the constructor already got it to flip once, so there's nothing sensible left to do
+		std::cerr << "Can't change the protection of the JIT code buffer (" << strerror(errno) << ")" << std::endl;
+		std::abort();
+	}
+	codeWritable = writable;
+#endif
+}
+
+bool Jit::available()
+{
+#ifdef JIT_X64
+	return true;
+#else
+	return false;
+#endif
+}
+
+void Jit::syncIn()
+{
+	for (size_t i=0;i<lengthof(cpu.regs);i++)
+		ctx.regs[i] = cpu.regs[i].u;
+
+	ctx.zn = cpu.psw.getZNDst().u;
+	ctx.c = cpu.psw.getC();
+	ctx.o = cpu.psw.getO();
+	ctx.iep = static_cast<u32>(cpu.mem.iep);
+	ctx.sp = static_cast<u32>(cpu.mem.sp);
+	ctx.mem = cpu.mem.bytes;
+}
+
+void Jit::syncOut()
+{
+	for (size_t i=0;i<lengthof(cpu.regs);i++)
+		cpu.regs[i].u = ctx.regs[i];
+
+	cpu.psw.setZN(Cpu::Op(ctx.zn));
+	cpu.psw.setC(ctx.c != 0);
+	cpu.psw.setO(ctx.o != 0);
+	cpu.mem.iep = ctx.iep;
+	cpu.mem.sp = ctx.sp;
+}
+
+Cpu::Stop Jit::interpretOne()
+{
+	syncOut();
+	Cpu::Stop stop = cpu.step();
+	syncIn();
+	if (stop.reason == Cpu::Stop::STOP_BUDGET)
+		ctx.left--;
+	return stop;
+}
+
+Cpu::Stop Jit::run( u64 budget )
+{
+	if (!codeBuf)
+		return cpu.run(budget);
+
+	syncIn();
+	ctx.left = budget;
+	for (;;)
+	{
+		if (ctx.left == 0)
+		{
+			syncOut();
+			return Cpu::Stop(Cpu::Stop::STOP_BUDGET,budget,ctx.iep);
+		}
+		//only flush between blocks, never while translated code is on the stack
+		if (codeFree + MAX_BLOCK_CODE > codeBuf + codeSize)
+			flush();
+		if (!unchain.empty())
+		{
+			protect(true);
+			for (auto it=unchain.begin();it!=unchain.end();++it)
+			{
+				Exit& exit = exits[*it];
+				if (exit.owner->alive)
+					Emitter::bind(exit.chain,exit.chain + sizeof(i32));
+			}
+			unchain.clear();
+		}
+
+		Block* block = (ctx.iep < entries.size()) ? entries[ctx.iep] : nullptr;
+		if (!block)
+			block = translate(ctx.iep);
+		u32 result = ExitResult(EXIT_INTERPRET);
+		if (block)
+		{
+			protect(false);
+			typedef u32 (*EnterFunc)(Context*, const u8*);
+			result = reinterpret_cast<EnterFunc>(codeBuf)(&ctx,block->code);
+		}
+
+		u32 exitIdx = result >> 2;
+		switch (result & 3)
+		{
+		case EXIT_HALT:
+			syncOut();
+			cpu.io->flush();
+			return Cpu::Stop(Cpu::Stop::STOP_HALT,budget - ctx.left,ctx.iep);
+		case EXIT_INTERPRET:
+			if (ctx.left != 0) //the block might have used it all up
+			{
+				Cpu::Stop stop = interpretOne();
+				if (stop.reason != Cpu::Stop::STOP_BUDGET)
+				{
+					stop.count += budget - ctx.left;
+					return stop;
+				}
+			}
+			break;
+		case EXIT_NEXT:
+			if (exitIdx != NO_EXIT)
+				chain(exitIdx);
+			break;
+		}
+	}
+}
+
+void Jit::chain( u32 exitIdx )
+{
+	u32 targetIEP = exits[exitIdx].target;
+	if (!exits[exitIdx].owner->alive || targetIEP >= entries.size())
+		return;
+
+	Block* target = entries[targetIEP];
+	if (!target)
+		target = translate(targetIEP); //can grow exits
+	if (!target)
+		return;
+
+	protect(true);
+	Emitter::bind(exits[exitIdx].chain,target->code);
+	target->incoming.push_back(exitIdx);
+}
+
+void Jit::kill( Block& block )
+{
+	block.alive = false;
+	if (entries[block.start] == &block)
+		entries[block.start] = nullptr;
+
+	//everyone jumping straight here goes back to their exit stub, once run() gets control back,
+	//translated code might be calling in from StoreHelper right now and the buffer isn't writable
+	unchain.insert(unchain.end(),block.incoming.begin(),block.incoming.end());
+	block.incoming.clear();
+}
+
+bool Jit::invalidate( size_t offset, size_t len )
+{
+	bool any = false;
+	for (auto it=blocks.begin();it!=blocks.end();++it)
+	{
+		Block& block = **it;
+		if (block.alive && offset < block.end && offset + len > block.start)
+		{
+			kill(block);
+			any = true;
+		}
+	}
+
+	invalidated |= any;
+	return any;
+}
+
+void Jit::flush()
+{
+	blocks.clear();
+	exits.clear();
+	unchain.clear();
+	std::fill(entries.begin(),entries.end(),nullptr);
+	codeFree = epilogue + 2;
+}
+
+u32 Jit::StoreHelper( Context* ctx, u32 address, u32 value )
+{
+	Jit& jit = *ctx->jit;
+	jit.invalidated = false;
+	jit.cpu.mem.putOp(address,Cpu::Op(static_cast<u16>(value))); //bounds were checked by the caller
+	return jit.invalidated ? 1 : 0;
+}
+
+u32 Jit::StoreByteHelper( Context* ctx, u32 address, u32 value )
+{
+	Jit& jit = *ctx->jit;
+	jit.invalidated = false;
+	jit.cpu.mem.putByte(address,static_cast<u8>(value));
+	return jit.invalidated ? 1 : 0;
+}
+
+Jit::Block* Jit::translate( size_t start )
+{
+	if (!codeBuf || start >= entries.size() || codeFree + MAX_BLOCK_CODE > codeBuf + codeSize)
+		return nullptr;
+
+	//gather the block
+	vector<Cpu::Decoded> body;
+	size_t at = start;
+	bool interpretAtEnd = false;
+	while (body.size() < MAX_BLOCK_INSTRUCTIONS && at < entries.size())
+	{
+		const Cpu::Decoded* ins = nullptr;
+		try
+		{
+			ins = &cpu.fetchDecoded(at);
+		}
+		catch (const std::exception&) //let the interpreter raise it if execution really gets here
+		{
+			interpretAtEnd = true;
+			break;
+		}
+		if (!TranslatableOp(*ins))
+		{
+			interpretAtEnd = true;
+			break;
+		}
+
+		body.push_back(*ins);
+		at += ins->len;
+		if (EndsBlock(ins->opcode()))
+			break;
+	}
+	if (body.empty())
+		return nullptr;
+
+	//which zn results somebody looks at before they get overwritten, everything is live at exits
+	vector<bool> storeZN(body.size(),false);
+	{
+		bool live = true;
+		for (size_t i=body.size();i-- > 0;)
+		{
+			OpCodes::OpCodeType op = body[i].opcode();
+			if (WritesZN(op))
+			{
+				storeZN[i] = live;
+				live = false;
+			}
+			if (NeedsZN(op))
+				live = true;
+		}
+	}
+
+	typedef Emitter E;
+	const u32 memLimit = Cpu::Memory::SIZE - sizeof(u16); //last address a word can be accessed at
+
+	blocks.emplace_back(new Block(start));
+	Block* block = blocks.back().get();
+	block->end = at;
+	block->code = codeFree;
+	protect(true);
+	E em(codeFree);
+
+	//the whole block is paid for up front, exits before its end give back what didn't run
+	const u32 blockCount = static_cast<u32>(body.size());
+	em.cmpQwordImm(CTX(left),blockCount);
+	u8* lowBudget = em.jcc(E::CC_B);
+	em.subQwordImm(CTX(left),blockCount);
+	u32 notRun = blockCount; //instructions from the current one to the end of the block
+
+	struct SideExit
+	{
+		u8* jump; //to patch
+		u32 iep; //of the instruction to interpret
+		u32 refund;
+	};
+	vector<SideExit> sideExits;
+	auto sideExit = [&](u8* jump, const Cpu::Decoded& ins)
+	{
+		SideExit exit = { jump, ins.iep, notRun };
+		sideExits.push_back(exit);
+	};
+	auto exitUnchained = [&](size_t target, u32 refund) //always back to the dispatcher
+	{
+		if (refund != 0)
+			em.addQwordImm(CTX(left),refund);
+		em.storeDwordImm(CTX(iep),static_cast<u32>(target));
+		em.movImm(E::EAX,ExitResult(EXIT_NEXT));
+		em.jmpTo(epilogue);
+	};
+	auto exitTo = [&](size_t target, u32 refund)
+	{
+		if (target >= entries.size()) //let the interpreter fault on it
+		{
+			exitUnchained(target,refund);
+			return;
+		}
+		if (refund != 0)
+			em.addQwordImm(CTX(left),refund);
+		u32 exitIdx = static_cast<u32>(exits.size());
+		u8* chainRel = em.jmp();
+		em.bindHere(chainRel); //unchained until the dispatcher links it
+		exits.push_back(Exit(chainRel,static_cast<u32>(target),block));
+		em.storeDwordImm(CTX(iep),static_cast<u32>(target));
+		em.movImm(E::EAX,ExitResult(EXIT_NEXT,exitIdx));
+		em.jmpTo(epilogue);
+	};
+	auto exitIndirect = [&](E::HostReg target) //target iep is in a register
+	{
+		em.storeDword(CTX(iep),target);
+		em.movImm(E::EAX,ExitResult(EXIT_NEXT));
+		em.jmpTo(epilogue);
+	};
+	auto loadOperand = [&](E::HostReg r, u8 reg, const Cpu::Decoded& ins)
+	{
+		if (reg == Registers::REG_CONSTANT)
+			em.movImm(r,ins.imm.u);
+		else
+			em.loadWord(r,CTX_REG(reg));
+	};
+	auto loadAddress = [&](E::HostReg r, u8 reg, const Cpu::Decoded& ins) //register val + offset or just offset
+	{
+		if (reg == Registers::REG_CONSTANT)
+			em.movImm(r,ins.imm.u);
+		else
+		{
+			em.loadWord(r,CTX_REG(reg));
+			em.addImm(r,ins.imm.u);
+			em.zeroExtend16(r);
+		}
+	};
+	auto loadIndexed = [&](E::HostReg r, u8 reg, const Cpu::Decoded& ins) //base + index * scale, uses edx
+	{
+		em.loadWord(r,CTX_REG(reg));
+		em.loadWord(E::EDX,CTX_REG(ins.imm.u & 0x0F));
+		if (ins.imm.u >> 4)
+			em.shlImm(E::EDX,static_cast<u8>(ins.imm.u >> 4));
+		em.alu(E::ALU_ADD,r,E::EDX);
+		em.zeroExtend16(r);
+	};
+	auto storeZN32 = [&](E::HostReg r) //Psw::setZN32 of r, uses ecx and edx
+	{
+		em.mov(E::ECX,r);
+		em.zeroExtend16(E::ECX);
+		em.addImm(E::ECX,0xFFFF); //carries into bit 16 unless the low word is 0
+		em.shrImm(E::ECX,16);
+		em.mov(E::EDX,r);
+		em.shrImm(E::EDX,16);
+		em.alu(E::ALU_OR,E::EDX,E::ECX);
+		em.storeWord(CTX(zn),E::EDX);
+	};
+	auto checkWordAccess = [&](E::HostReg addr, const Cpu::Decoded& ins)
+	{
+		em.cmpImm(addr,memLimit);
+		sideExit(em.jcc(E::CC_A),ins);
+	};
+	//stores ecx (or just cl) at address eax, goes through Memory::putOp/putByte if the page has code in it, continueAt is
+	//where to go if a block got thrown out
+	auto storeValue = [&](size_t continueAt, bool byte)
+	{
+		//Memory::markDirty, a byte is on one page
+		em.loadPtr(E::ESI,CTX(dirtyPages));
+		em.mov(E::EDX,E::EAX);
+		em.shrImm(E::EDX,Cpu::Memory::PAGE_BITS);
+		em.storeMemByteImm(E::ESI,E::EDX,1);
+		if (!byte)
+		{
+			em.mov(E::EDX,E::EAX);
+			em.addImm(E::EDX,1);
+			em.shrImm(E::EDX,Cpu::Memory::PAGE_BITS);
+			em.storeMemByteImm(E::ESI,E::EDX,1);
+		}
+
+		em.loadPtr(E::ESI,CTX(codePages));
+		em.mov(E::EDX,E::EAX);
+		em.shrImm(E::EDX,Cpu::Memory::PAGE_BITS);
+		em.loadMemByte(E::EDI,E::ESI,E::EDX);
+		if (!byte)
+		{
+			em.mov(E::EDX,E::EAX);
+			em.addImm(E::EDX,1);
+			em.shrImm(E::EDX,Cpu::Memory::PAGE_BITS);
+			em.loadMemByte(E::EDX,E::ESI,E::EDX);
+			em.alu(E::ALU_OR,E::EDI,E::EDX);
+		}
+		else
+			em.test(E::EDI,E::EDI);
+		u8* plainStore = em.jcc(E::CC_E);
+		//mov rdi, rbx; mov esi, eax; mov edx, ecx
+		em.byte(0x48); em.mov(E::EDI,E::EBX);
+		em.mov(E::ESI,E::EAX);
+		em.mov(E::EDX,E::ECX);
+		em.callAbs(byte ? reinterpret_cast<const void*>(&Jit::StoreByteHelper) : reinterpret_cast<const void*>(&Jit::StoreHelper));
+		em.test(E::EAX,E::EAX);
+		u8* stillValid = em.jcc(E::CC_E);
+		exitUnchained(continueAt,notRun - 1); //the store itself did happen, and what a chain here went to might be gone
+		em.bindHere(stillValid);
+		u8* done = em.jmp();
+		em.bindHere(plainStore);
+		em.loadPtr(E::EDX,CTX(mem));
+		if (byte)
+			em.storeMemByte(E::EDX,E::EAX,E::ECX);
+		else
+			em.storeMemWord(E::EDX,E::EAX,E::ECX);
+		em.bindHere(done);
+	};
+	auto storeWord = [&](size_t continueAt) { storeValue(continueAt,false); };
+
+	bool terminated = false;
+	for (size_t i=0;i<body.size();i++)
+	{
+		const Cpu::Decoded& ins = body[i];
+		notRun = static_cast<u32>(body.size() - i);
+		size_t next = ins.iep + ins.len;
+		switch (ins.opcode())
+		{
+		case OpCodes::OP_ADD:
+		case OpCodes::OP_SUB:
+		case OpCodes::OP_CMP:
+			{
+				//in the top half of the host registers, the host's carry and overflow are the 16 bit C and O
+				loadOperand(E::EAX,ins.src1,ins);
+				em.shlImm(E::EAX,16);
+				loadOperand(E::ECX,ins.src2,ins);
+				em.shlImm(E::ECX,16);
+				if (ins.opcode() == OpCodes::OP_CMP)
+					em.alu(E::ALU_SUB,E::EAX,E::ECX);
+				else
+				{
+					//the carry goes in at bit 0, ones below an added word ripple it up to bit 16 and a borrow does that on its own
+					if (ins.opcode() == OpCodes::OP_ADD)
+						em.addImm(E::EAX,0xFFFF);
+					em.loadByte(E::EDX,CTX(c));
+					em.addImm(E::EDX,~u32(0)); //the host carry is set unless C was 0
+					em.alu((ins.opcode() == OpCodes::OP_ADD) ? E::ALU_ADC : E::ALU_SBB,E::EAX,E::ECX);
+				}
+				em.setccByte(E::CC_B,CTX(c));
+				em.setccByte(E::CC_O,CTX(o));
+				em.shrImm(E::EAX,16);
+				if (ins.opcode() != OpCodes::OP_CMP)
+					em.storeWord(CTX_REG(ins.dst),E::EAX);
+				if (storeZN[i])
+					em.storeWord(CTX(zn),E::EAX);
+			}
+			break;
+		case OpCodes::OP_SAR:
+		case OpCodes::OP_SAL:
+			{
+				//carry is set when shifting back doesn't give the original value
+				u8 count = static_cast<u8>(ins.imm.u);
+				loadOperand(E::EAX,ins.src1,ins);
+				em.signExtend16(E::EAX);
+				em.mov(E::ECX,E::EAX);
+				if (ins.opcode() == OpCodes::OP_SAL)
+				{
+					em.shlImm(E::ECX,count);
+					em.signExtend16(E::ECX);
+					em.mov(E::EDX,E::ECX);
+					em.sarImm(E::EDX,count);
+				}
+				else
+				{
+					em.sarImm(E::ECX,count);
+					em.mov(E::EDX,E::ECX);
+					em.shlImm(E::EDX,count);
+					em.signExtend16(E::EDX);
+				}
+				em.alu(E::ALU_CMP,E::EDX,E::EAX);
+				em.setccByte(E::CC_NE,CTX(c));
+				em.storeWord(CTX_REG(ins.dst),E::ECX);
+				if (storeZN[i])
+					em.storeWord(CTX(zn),E::ECX);
+			}
+			break;
+		case OpCodes::OP_AND:
+		case OpCodes::OP_OR:
+			loadOperand(E::EAX,ins.src1,ins);
+			loadOperand(E::ECX,ins.src2,ins);
+			em.alu((ins.opcode() == OpCodes::OP_AND) ? E::ALU_AND : E::ALU_OR,E::EAX,E::ECX);
+			em.storeWord(CTX_REG(ins.dst),E::EAX);
+			if (storeZN[i])
+				em.storeWord(CTX(zn),E::EAX);
+			break;
+		case OpCodes::OP_NOT:
+			loadOperand(E::EAX,ins.src1,ins);
+			em.notReg(E::EAX);
+			em.storeWord(CTX_REG(ins.dst),E::EAX);
+			if (storeZN[i])
+				em.storeWord(CTX(zn),E::EAX);
+			break;
+		case OpCodes::OP_MOV:
+			loadAddress(E::EAX,ins.src1,ins);
+			em.storeWord(CTX_REG(ins.dst),E::EAX);
+			if (storeZN[i])
+				em.storeWord(CTX(zn),E::EAX);
+			break;
+		case OpCodes::OP_LDR:
+			loadAddress(E::EAX,ins.src1,ins);
+			checkWordAccess(E::EAX,ins);
+			em.loadPtr(E::EDX,CTX(mem));
+			em.loadMemWord(E::EAX,E::EDX,E::EAX);
+			em.storeWord(CTX_REG(ins.dst),E::EAX);
+			if (storeZN[i])
+				em.storeWord(CTX(zn),E::EAX);
+			break;
+		case OpCodes::OP_STR:
+			loadAddress(E::EAX,ins.dst,ins);
+			checkWordAccess(E::EAX,ins);
+			em.loadWord(E::ECX,CTX_REG(ins.src1));
+			storeWord(next);
+			break;
+		case OpCodes::OP_LDRX:
+			loadIndexed(E::EAX,ins.src1,ins);
+			checkWordAccess(E::EAX,ins);
+			em.loadPtr(E::EDX,CTX(mem));
+			em.loadMemWord(E::EAX,E::EDX,E::EAX);
+			em.storeWord(CTX_REG(ins.dst),E::EAX);
+			if (storeZN[i])
+				em.storeWord(CTX(zn),E::EAX);
+			break;
+		case OpCodes::OP_STRX:
+			loadIndexed(E::EAX,ins.dst,ins);
+			checkWordAccess(E::EAX,ins);
+			em.loadWord(E::ECX,CTX_REG(ins.src1));
+			storeWord(next);
+			break;
+		case OpCodes::OP_LDRP:
+			em.loadWord(E::EAX,CTX_REG(ins.src1));
+			checkWordAccess(E::EAX,ins);
+			em.mov(E::ECX,E::EAX);
+			em.addImm(E::ECX,sizeof(u16));
+			em.storeWord(CTX_REG(ins.src1),E::ECX); //before the load, like OpLdrp
+			em.loadPtr(E::EDX,CTX(mem));
+			em.loadMemWord(E::EAX,E::EDX,E::EAX);
+			em.storeWord(CTX_REG(ins.dst),E::EAX);
+			if (storeZN[i])
+				em.storeWord(CTX(zn),E::EAX);
+			break;
+		case OpCodes::OP_STRP:
+			em.loadWord(E::EAX,CTX_REG(ins.dst));
+			checkWordAccess(E::EAX,ins);
+			em.loadWord(E::ECX,CTX_REG(ins.src1));
+			em.mov(E::EDX,E::EAX);
+			em.addImm(E::EDX,sizeof(u16));
+			em.storeWord(CTX_REG(ins.dst),E::EDX); //storeWord() can leave the block, the store has to be all that's left
+			storeWord(next);
+			break;
+		case OpCodes::OP_LDRB:
+		case OpCodes::OP_LDRSB:
+			loadAddress(E::EAX,ins.src1,ins); //any u16 address has its byte, no check
+			em.loadPtr(E::EDX,CTX(mem));
+			if (ins.opcode() == OpCodes::OP_LDRSB)
+				em.loadMemByteSigned(E::EAX,E::EDX,E::EAX);
+			else
+				em.loadMemByte(E::EAX,E::EDX,E::EAX);
+			em.storeWord(CTX_REG(ins.dst),E::EAX);
+			if (storeZN[i])
+				em.storeWord(CTX(zn),E::EAX);
+			break;
+		case OpCodes::OP_STRB:
+			loadAddress(E::EAX,ins.dst,ins);
+			em.loadWord(E::ECX,CTX_REG(ins.src1));
+			storeValue(next,true);
+			break;
+		case OpCodes::OP_ADD32:
+		case OpCodes::OP_SUB32:
+		case OpCodes::OP_CMP32:
+			//a pair is a little endian dword in regs, and the host's carry and overflow are C and O
+			em.loadDword(E::EAX,CTX_REG(ins.dst));
+			if (ins.src1 == Registers::REG_CONSTANT)
+				em.movImm(E::ECX,static_cast<u32>(static_cast<i32>(ins.imm.i)));
+			else
+				em.loadDword(E::ECX,CTX_REG(ins.src1));
+			em.alu((ins.opcode() == OpCodes::OP_ADD32) ? E::ALU_ADD : E::ALU_SUB,E::EAX,E::ECX);
+			em.setccByte(E::CC_B,CTX(c));
+			em.setccByte(E::CC_O,CTX(o));
+			if (ins.opcode() != OpCodes::OP_CMP32)
+				em.storeDword(CTX_REG(ins.dst),E::EAX);
+			if (storeZN[i])
+				storeZN32(E::EAX);
+			break;
+		case OpCodes::OP_SAL32:
+		case OpCodes::OP_SAR32:
+			{
+				u8 count = static_cast<u8>(ins.imm.u);
+				em.loadDword(E::EAX,CTX_REG(ins.dst));
+				em.mov(E::ECX,E::EAX);
+				if (ins.opcode() == OpCodes::OP_SAL32)
+				{
+					em.shlImm(E::ECX,count);
+					em.mov(E::EDX,E::ECX);
+					em.sarImm(E::EDX,count);
+				}
+				else
+				{
+					em.sarImm(E::ECX,count);
+					em.mov(E::EDX,E::ECX);
+					em.shlImm(E::EDX,count);
+				}
+				em.alu(E::ALU_CMP,E::EDX,E::EAX);
+				em.setccByte(E::CC_NE,CTX(c));
+				em.storeDword(CTX_REG(ins.dst),E::ECX);
+				if (storeZN[i])
+				{
+					em.mov(E::EAX,E::ECX);
+					storeZN32(E::EAX);
+				}
+			}
+			break;
+		case OpCodes::OP_CLC:
+		case OpCodes::OP_STC:
+			em.storeByteImm(CTX(c),(ins.opcode() == OpCodes::OP_STC) ? 1 : 0);
+			break;
+		case OpCodes::OP_NC:
+			em.xorByteImm(CTX(c),1);
+			break;
+		case OpCodes::OP_MOVTSP:
+			em.loadWord(E::EAX,CTX_REG(ins.src1));
+			em.storeDword(CTX(sp),E::EAX);
+			break;
+		case OpCodes::OP_MOVFSP:
+			em.loadDword(E::EAX,CTX(sp));
+			em.storeWord(CTX_REG(ins.dst),E::EAX);
+			break;
+		case OpCodes::OP_PUSH:
+			em.loadDword(E::EAX,CTX(sp));
+			em.cmpImm(E::EAX,sizeof(u16)); //like CALL, the interpreter does the clamping at 0
+			sideExit(em.jcc(E::CC_B),ins);
+			em.subImm(E::EAX,sizeof(u16));
+			em.storeDword(CTX(sp),E::EAX);
+			em.loadWord(E::ECX,CTX_REG(ins.src1));
+			storeWord(next);
+			break;
+		case OpCodes::OP_POP:
+			em.loadDword(E::EAX,CTX(sp));
+			checkWordAccess(E::EAX,ins);
+			em.loadPtr(E::EDX,CTX(mem));
+			em.loadMemWord(E::ECX,E::EDX,E::EAX);
+			em.storeWord(CTX_REG(ins.dst),E::ECX);
+			em.addImm(E::EAX,sizeof(u16));
+			em.storeDword(CTX(sp),E::EAX);
+			break;
+		case OpCodes::OP_JMP:
+			if (ins.src1 == Registers::REG_CONSTANT)
+				exitTo(ins.imm.u,0);
+			else
+			{
+				loadAddress(E::EAX,ins.src1,ins);
+				exitIndirect(E::EAX);
+			}
+			terminated = true;
+			break;
+		case OpCodes::OP_JZ:
+		case OpCodes::OP_JGT:
+		case OpCodes::OP_JNZ:
+		case OpCodes::OP_JLT:
+		case OpCodes::OP_JGE:
+		case OpCodes::OP_JLE:
+		case OpCodes::OP_JC:
+		case OpCodes::OP_JNC:
+		case OpCodes::OP_JO:
+		case OpCodes::OP_JN:
+		case OpCodes::OP_LOOP:
+			{
+				u16 target = static_cast<u16>(ins.iep + ins.imm.i); //wraps like FlowBranch
+				vector<u8*> taken, notTaken;
+				auto testZ = [&]() //flags are E if Z
+				{
+					em.loadWord(E::EAX,CTX(zn));
+					em.test(E::EAX,E::EAX);
+				};
+				auto compareNO = [&]() //flags are E if N == O
+				{
+					em.loadWordSigned(E::EAX,CTX(zn));
+					em.shrImm(E::EAX,31);
+					em.loadByte(E::ECX,CTX(o));
+					em.alu(E::ALU_CMP,E::EAX,E::ECX);
+				};
+				auto testFlag = [&](u32 flag) //flags are NE if set
+				{
+					em.loadByte(E::EAX,flag);
+					em.test(E::EAX,E::EAX);
+				};
+				switch (ins.opcode())
+				{
+				case OpCodes::OP_JZ:
+					testZ();
+					notTaken.push_back(em.jcc(E::CC_NE));
+					break;
+				case OpCodes::OP_JNZ:
+					testZ();
+					notTaken.push_back(em.jcc(E::CC_E));
+					break;
+				case OpCodes::OP_JGT: //!Z && N == O
+					testZ();
+					notTaken.push_back(em.jcc(E::CC_E));
+					compareNO();
+					notTaken.push_back(em.jcc(E::CC_NE));
+					break;
+				case OpCodes::OP_JLT:
+					compareNO();
+					notTaken.push_back(em.jcc(E::CC_E));
+					break;
+				case OpCodes::OP_JGE:
+					compareNO();
+					notTaken.push_back(em.jcc(E::CC_NE));
+					break;
+				case OpCodes::OP_JLE: //Z || N != O
+					testZ();
+					taken.push_back(em.jcc(E::CC_E));
+					compareNO();
+					notTaken.push_back(em.jcc(E::CC_E));
+					break;
+				case OpCodes::OP_JC:
+				case OpCodes::OP_JNC:
+					testFlag(CTX(c));
+					notTaken.push_back(em.jcc((ins.opcode() == OpCodes::OP_JC) ? E::CC_E : E::CC_NE));
+					break;
+				case OpCodes::OP_JO:
+					testFlag(CTX(o));
+					notTaken.push_back(em.jcc(E::CC_E));
+					break;
+				case OpCodes::OP_JN:
+					em.loadWordSigned(E::EAX,CTX(zn));
+					em.shrImm(E::EAX,31);
+					em.test(E::EAX,E::EAX);
+					notTaken.push_back(em.jcc(E::CC_E));
+					break;
+				default: //LOOP, the register counts down without touching the flags
+					em.loadWord(E::EAX,CTX_REG(ins.dst));
+					em.subImm(E::EAX,1);
+					em.storeWord(CTX_REG(ins.dst),E::EAX);
+					em.zeroExtend16(E::EAX);
+					em.test(E::EAX,E::EAX);
+					notTaken.push_back(em.jcc(E::CC_E));
+					break;
+				}
+				for (auto it=taken.begin();it!=taken.end();++it)
+					em.bindHere(*it);
+				exitTo(target,0);
+				for (auto it=notTaken.begin();it!=notTaken.end();++it)
+					em.bindHere(*it);
+				exitTo(next,0);
+				terminated = true;
+			}
+			break;
+		case OpCodes::OP_CALL:
+			em.loadDword(E::EAX,CTX(sp));
+			em.cmpImm(E::EAX,sizeof(u16)); //Memory::sp clamps at 0, leave that to the interpreter
+			sideExit(em.jcc(E::CC_B),ins);
+			em.subImm(E::EAX,sizeof(u16));
+			checkWordAccess(E::EAX,ins);
+			em.storeDword(CTX(sp),E::EAX);
+			em.movImm(E::ECX,static_cast<u32>(next));
+			storeWord(ins.imm.u);
+			exitTo(ins.imm.u,0);
+			terminated = true;
+			break;
+		case OpCodes::OP_RET:
+			em.loadDword(E::EAX,CTX(sp));
+			checkWordAccess(E::EAX,ins);
+			em.loadPtr(E::EDX,CTX(mem));
+			em.loadMemWord(E::ECX,E::EDX,E::EAX);
+			em.addImm(E::EAX,sizeof(u16));
+			em.storeDword(CTX(sp),E::EAX);
+			exitIndirect(E::ECX);
+			terminated = true;
+			break;
+		case OpCodes::OP_HLT:
+			em.storeDwordImm(CTX(iep),static_cast<u32>(next));
+			em.movImm(E::EAX,ExitResult(EXIT_HALT));
+			em.jmpTo(epilogue);
+			terminated = true;
+			break;
+		default:
+			break;
+		}
+		//O is only looked at along with zn, so it gets cleared where that's stored
+		if (storeZN[i] && !WritesO(ins.opcode()))
+			em.storeByteImm(CTX(o),0);
+	}
+
+	if (!terminated)
+	{
+		if (interpretAtEnd)
+		{
+			em.storeDwordImm(CTX(iep),static_cast<u32>(at));
+			em.movImm(E::EAX,ExitResult(EXIT_INTERPRET));
+			em.jmpTo(epilogue);
+		}
+		else
+			exitTo(at,0);
+	}
+
+	//faults and edge cases get redone by the interpreter from a clean instruction boundary
+	for (auto it=sideExits.begin();it!=sideExits.end();++it)
+	{
+		em.bindHere(it->jump);
+		em.addQwordImm(CTX(left),it->refund);
+		em.storeDwordImm(CTX(iep),it->iep);
+		em.movImm(E::EAX,ExitResult(EXIT_INTERPRET));
+		em.jmpTo(epilogue);
+	}
+	//not enough budget left for the whole block, go one instruction at a time
+	em.bindHere(lowBudget);
+	em.storeDwordImm(CTX(iep),static_cast<u32>(start));
+	em.movImm(E::EAX,ExitResult(EXIT_INTERPRET));
+	em.jmpTo(epilogue);
+
+	codeFree = em.here();
+	entries[start] = block;
+	return block;
+}
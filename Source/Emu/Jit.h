@@ -0,0 +1,77 @@
+#pragma once
+
+#include "Cpu.h"
+#include <memory>
+
+//translates basic blocks of guest code into x86-64 and chains them together,
+//anything it can't translate is handed to the interpreter one instruction at a time
+class Jit
+{
+public:
+	Jit(Cpu& cpu);
+	~Jit();
+
+	static bool available(); //host can run translated code
+	Cpu::Stop run(u64 budget); //same as Cpu::run()
+	bool invalidate(size_t offset, size_t len); //throws out blocks overlapping [offset, offset+len), true if there were any
+private:
+	//guest state while inside translated code, rbx points to it
+	struct Context
+	{
+		u16 regs[Registers::REG_COUNT];
+		u16 zn; //destination of last zn affecting op
+		u8 c, o;
+		u32 iep;
+		u32 sp;
+		u64 left; //instruction budget
+		u8* mem;
+		const u8* codePages;
+		u8* dirtyPages;
+		Jit* jit;
+	};
+
+	struct Block
+	{
+		Block(size_t start) : start(start), end(start), code(nullptr), alive(true) {}
+
+		size_t start, end; //guest bytes [start, end) it was translated from
+		u8* code;
+		bool alive;
+		vector<u32> incoming; //exits chained to this block
+	};
+
+	struct Exit
+	{
+		Exit(u8* chain, u32 target, Block* owner) : chain(chain), target(target), owner(owner) {}
+
+		u8* chain; //rel32 of the jump that gets patched to the target block
+		u32 target; //guest address
+		Block* owner;
+	};
+
+	Block* translate(size_t start);
+	void chain(u32 exitIdx);
+	void kill(Block& block);
+	void flush();
+	void protect(bool writable);
+	Cpu::Stop interpretOne();
+	void syncIn();
+	void syncOut();
+	static u32 StoreHelper(Context* ctx, u32 address, u32 value);
+	static u32 StoreByteHelper(Context* ctx, u32 address, u32 value);
+
+	Cpu& cpu;
+	Context ctx;
+
+	u8* codeBuf;
+	size_t codeSize;
+	u8* codeFree; //where the next block goes
+	u8* epilogue;
+	bool codeWritable; //never writable and executable at once, protect() flips it to whichever is needed next
+
+	vector<Block*> entries; //indexed by guest address
+	vector<std::unique_ptr<Block>> blocks;
+	vector<Exit> exits;
+	vector<u32> unchain; //exits kill() unlinked, patched back to their stubs before anything runs again
+	bool invalidated; //set by invalidate() during StoreHelper
+};
@@ -0,0 +1,320 @@
+#include "Journal.h"
+#include <chrono>
+#include <stdio.h>
+
+namespace
+{
+	const char Magic[4] = {'S','C','J','1'};
+
+	//followed by records, each starting with a varint: (count - count of the previous value) << 1 and a little endian
+	//u16 value for an IN, or 1 then varints of the count and length of a Checkpointer encoded state for a snapshot
+	struct Header
+	{
+		char magic[4];
+		u32 programHash;
+		u64 snapshotEvery;
+	};
+
+	enum
+	{
+		SNAPSHOT_RECORD = 1,
+		HANDOVER_SIZE = 4096 //records the guest thread collects before passing them on
+	};
+
+	void PutVarint(ByteVector& out, u64 val)
+	{
+		while (val >= 0x80)
+		{
+			out.push_back(static_cast<u8>(val | 0x80));
+			val >>= 7;
+		}
+		out.push_back(static_cast<u8>(val));
+	}
+
+	bool GetVarint(std::istream& in, u64& val)
+	{
+		val = 0;
+		for (size_t shift=0;shift<64;shift+=7)
+		{
+			int c = in.get();
+			if (c == std::char_traits<char>::eof())
+				return false;
+
+			val |= static_cast<u64>(c & 0x7F) << shift;
+			if (!(c & 0x80))
+				return true;
+		}
+		return false;
+	}
+};
+
+bool JournalIo::in( size_t, Registers::RegisterType reg, i16& val )
+{
+	if (!haveValue)
+	{
+		wanted = reg;
+		return false;
+	}
+
+	val = value;
+	haveValue = false;
+	return true;
+}
+
+void JournalIo::out( size_t iep, Registers::RegisterType reg, i16 val )
+{
+	if (!muted)
+		output.out(iep,reg,val);
+}
+
+Recorder::Recorder( const ByteVector& program, u64 snapshotEvery ) : image(program), snapshotEvery(snapshotEvery)
+{
+	programHash = Checkpointer::hash(program);
+	image.resize(Cpu::Memory::SIZE,0);
+	nextSnap = (snapshotEvery != 0) ? snapshotEvery : Cpu::NO_BUDGET;
+
+	lastInput = 0;
+	pendingAt = 0;
+	snapPending = writing = quit = false;
+	inputs = snapshots = skipped = bytesWritten = captureNanos = 0;
+	failed = false;
+	thread = std::thread(&Recorder::writer,this);
+}
+
+Recorder::~Recorder()
+{
+	handOver();
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		quit = true;
+	}
+	wake.notify_all();
+	thread.join();
+}
+
+bool Recorder::open( const string& fileName )
+{
+	file.open(fileName,std::ios::binary|std::ios::trunc);
+	if (!file.is_open())
+		return false;
+
+	Header header;
+	memcpy(header.magic,Magic,sizeof(header.magic));
+	header.programHash = programHash;
+	header.snapshotEvery = snapshotEvery;
+	file.write(reinterpret_cast<const char*>(&header),sizeof(header));
+	file.flush();
+	bytesWritten = sizeof(header);
+	return file.good();
+}
+
+void Recorder::input( u64 count, i16 value )
+{
+	PutVarint(records,(count - lastInput) << 1);
+	records.push_back(static_cast<u8>(value));
+	records.push_back(static_cast<u8>(static_cast<u16>(value) >> 8));
+	lastInput = count;
+	inputs++;
+
+	if (records.size() >= HANDOVER_SIZE)
+		handOver();
+}
+
+void Recorder::handOver()
+{
+	if (records.empty())
+		return;
+
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		queued.insert(queued.end(),records.begin(),records.end());
+	}
+	records.clear();
+	wake.notify_all();
+}
+
+void Recorder::snapshot( const Cpu& cpu, u64 count, u64 inputs )
+{
+	auto start = std::chrono::steady_clock::now();
+	nextSnap = (Cpu::NO_BUDGET - count > snapshotEvery) ? count + snapshotEvery : Cpu::NO_BUDGET;
+
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		queued.insert(queued.end(),records.begin(),records.end());
+		if (snapPending)
+			skipped++;
+		else
+		{
+			Checkpointer::save(cpu,count,inputs,pending);
+			pendingAt = queued.size();
+			snapPending = true;
+			snapshots++;
+			captureNanos += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+		}
+	}
+	records.clear();
+	wake.notify_all();
+}
+
+void Recorder::writer()
+{
+	ByteVector batch, encoded, framing;
+	Checkpointer::State state;
+	for (;;)
+	{
+		bool haveSnap;
+		size_t snapAt;
+		{
+			std::unique_lock<std::mutex> guard(lock);
+			wake.wait(guard,[this]() { return !queued.empty() || snapPending || quit; });
+			if (queued.empty() && !snapPending)
+				return;
+
+			batch.swap(queued);
+			queued.clear();
+			haveSnap = snapPending;
+			snapAt = haveSnap ? pendingAt : batch.size();
+			if (haveSnap)
+				std::swap(state,pending);
+			writing = true;
+		}
+
+		file.write(reinterpret_cast<const char*>(batch.data()),snapAt);
+		u64 len = snapAt;
+		if (haveSnap)
+		{
+			Checkpointer::encode(state,image,programHash,encoded);
+			framing.clear();
+			PutVarint(framing,SNAPSHOT_RECORD);
+			PutVarint(framing,state.count);
+			PutVarint(framing,encoded.size());
+			file.write(reinterpret_cast<const char*>(framing.data()),framing.size());
+			file.write(reinterpret_cast<const char*>(encoded.data()),encoded.size());
+			len += framing.size() + encoded.size();
+		}
+		file.write(reinterpret_cast<const char*>(batch.data()) + snapAt,batch.size() - snapAt);
+		len += batch.size() - snapAt;
+		file.flush(); //a crash loses at most what wasn't handed over yet
+
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			bytesWritten += len;
+			failed |= !file.good();
+			snapPending = snapPending && !haveSnap;
+			writing = false;
+		}
+		wake.notify_all();
+	}
+}
+
+void Recorder::report( std::ostream& out )
+{
+	handOver();
+	std::unique_lock<std::mutex> guard(lock);
+	wake.wait(guard,[this]() { return queued.empty() && !snapPending && !writing; });
+
+	out << "Journal: " << inputs << " inputs, " << snapshots << " snapshots (" << skipped << " skipped, previous still writing), " << bytesWritten << " bytes";
+	if (snapshots)
+		out << ", guest paused " << captureNanos / snapshots / 1000 << " us per snapshot";
+	if (failed)
+		out << ", WRITING FAILED";
+	out << std::endl;
+}
+
+bool Replayer::load( std::istream& journal, const ByteVector& program, std::ostream& errors )
+{
+	this->program = &program;
+	inputs.clear();
+	snapshots.clear();
+	nextInput = 0;
+
+	Header header;
+	if (!journal.read(reinterpret_cast<char*>(&header),sizeof(header)) || memcmp(header.magic,Magic,sizeof(header.magic)) != 0)
+	{
+		errors << "Not a journal file" << std::endl;
+		return false;
+	}
+	if (header.programHash != Checkpointer::hash(program))
+	{
+		errors << "Journal was recorded with a different program" << std::endl;
+		return false;
+	}
+
+	const std::streamoff start = journal.tellg();
+	journal.seekg(0,std::ios::end);
+	const std::streamoff end = journal.tellg();
+	journal.seekg(start);
+
+	//a recording that got cut off mid record (the host died) just ends at the last whole one
+	u64 count = 0;
+	u64 tag;
+	while (GetVarint(journal,tag))
+	{
+		if (tag & 1)
+		{
+			Snapshot snap;
+			u64 len;
+			if (tag != SNAPSHOT_RECORD)
+				break;
+			if (!GetVarint(journal,snap.count) || !GetVarint(journal,len))
+				break;
+
+			snap.offset = journal.tellg();
+			if (len > static_cast<u64>(end - snap.offset))
+				break;
+
+			journal.seekg(snap.offset + static_cast<std::streamoff>(len));
+			snapshots.push_back(snap);
+		}
+		else
+		{
+			u8 value[2];
+			if (!journal.read(reinterpret_cast<char*>(value),sizeof(value)))
+				break;
+
+			count += tag >> 1;
+			inputs.push_back(std::make_pair(count,static_cast<i16>(value[0] | (value[1] << 8))));
+		}
+	}
+	journal.clear();
+	return true;
+}
+
+u64 Replayer::seek( std::istream& journal, u64 count, Cpu& cpu )
+{
+	//the last one at or before count that reads back whole
+	for (size_t i=snapshots.size();i-->0;)
+	{
+		if (snapshots[i].count > count)
+			continue;
+
+		Checkpointer::State state;
+		journal.clear();
+		if (!journal.seekg(snapshots[i].offset) || !Checkpointer::load(journal,*program,state) || state.inputs > inputs.size())
+			continue;
+
+		Checkpointer::apply(state,cpu);
+		nextInput = static_cast<size_t>(state.inputs);
+		return state.count;
+	}
+	nextInput = 0;
+	return 0;
+}
+
+bool Replayer::input( u64 count, i16& value )
+{
+	if (nextInput >= inputs.size())
+		return false;
+
+	if (inputs[nextInput].first != count)
+	{
+		char msg[128];
+		sprintf(msg,"Replay diverged: IN at instruction %llu, the recording has one at %llu",
+			static_cast<unsigned long long>(count),static_cast<unsigned long long>(inputs[nextInput].first));
+		error = msg;
+		return false;
+	}
+
+	value = inputs[nextInput++].second;
+	return true;
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include "Checkpoint.h"
+#include "IoDevice.h"
+#include <istream>
+#include <ostream>
+#include <fstream>
+
+//the cpu's io while recording or replaying: OUT goes to the real device, but IN only gets a value once the run loop
+//supplied one, otherwise the cpu stops waiting for input at the exact instruction count the value belongs to
+class JournalIo : public IoDevice
+{
+public:
+	JournalIo(IoDevice& output) : output(output), wanted(Registers::REG_R0), value(0), haveValue(false), muted(false) {}
+
+	bool in(size_t iep, Registers::RegisterType reg, i16& value) OVERRIDE;
+	void out(size_t iep, Registers::RegisterType reg, i16 value) OVERRIDE;
+	void flush() OVERRIDE { output.flush(); }
+
+	void supply(i16 val) { value = val; haveValue = true; }
+
+	IoDevice& output;
+	Registers::RegisterType wanted; //what the last IN without a value was for
+	i16 value;
+	bool haveValue;
+	bool muted; //OUT values are dropped, while replaying up to where it's supposed to start
+};
+
+//writes every IN value and the instruction count it was read at into a journal file, plus a snapshot of the machine
+//every so many instructions so a replay can start close to anywhere. Values are batched and everything goes out from a
+//background thread, the guest only pays for appending a few bytes per IN and copying memory per snapshot
+class Recorder
+{
+public:
+	Recorder(const ByteVector& program, u64 snapshotEvery);
+	~Recorder(); //flushes what's left
+
+	bool open(const string& fileName);
+	void input(u64 count, i16 value);
+	u64 nextSnapshot() const { return nextSnap; } //count the run loop has to stop at for snapshot()
+	void snapshot(const Cpu& cpu, u64 count, u64 inputs); //skipped if the last one isn't written yet
+	void report(std::ostream& out);
+private:
+	void handOver(); //moves records to queued
+	void writer();
+
+	ByteVector image; //program padded to Memory::SIZE
+	u32 programHash;
+	u64 snapshotEvery, nextSnap;
+	std::ofstream file;
+
+	ByteVector records; //encoded inputs not handed to the writer yet, only the guest thread touches it
+	u64 lastInput; //count of the last one, records store the difference
+
+	std::mutex lock;
+	std::condition_variable wake;
+	ByteVector queued; //records for the writer
+	Checkpointer::State pending;
+	size_t pendingAt; //queued bytes that go before pending
+	bool snapPending, writing, quit;
+
+	u64 inputs, snapshots, skipped, bytesWritten, captureNanos;
+	bool failed;
+
+	std::thread thread;
+};
+
+//reads a journal back, feeding its values to the IN instructions they were recorded for
+class Replayer
+{
+public:
+	Replayer() : nextInput(0) {}
+
+	//reads all the values and where the snapshots are, false with a message in errors if it's not a journal of program
+	bool load(std::istream& journal, const ByteVector& program, std::ostream& errors);
+	//restores the last snapshot at or before count into cpu, returns the count it's at (0 without one)
+	u64 seek(std::istream& journal, u64 count, Cpu& cpu);
+	//the value for the IN at count, false once they ran out or if the run got to an IN the recording didn't
+	bool input(u64 count, i16& value);
+
+	string error; //set when input() found the run going differently than recorded
+private:
+	struct Snapshot
+	{
+		u64 count;
+		std::streamoff offset; //of the checkpoint encoded state
+	};
+
+	const ByteVector* program;
+	vector<std::pair<u64,i16>> inputs; //count and value
+	vector<Snapshot> snapshots;
+	size_t nextInput;
+};
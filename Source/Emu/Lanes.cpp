@@ -0,0 +1,859 @@
+#include "Lanes.h"
+#include <algorithm>
+
+namespace
+{
+	typedef Cpu::Decoded Decoded;
+	typedef Cpu::Memory Memory;
+
+	const u32 NO_IEP = ~u32(0);
+	//when fewer than one in STRAGGLER_RATIO lanes have been executing for STRAGGLER_STEPS in a row, those go to the scalar cpu
+	const size_t STRAGGLER_RATIO = 16;
+	const size_t STRAGGLER_STEPS = 256;
+
+	//lane masks are 16 bits, this makes one for the 32 bit arrays so blends stay branch free (and vectorize)
+	inline u32 Wide(u16 mask) { return static_cast<u32>(static_cast<i32>(static_cast<i16>(mask))); }
+
+	//the condition of a branch in one lane, signed ones compare N with O like the Cpu's do. counter is LOOP's register
+	inline bool Taken(OpCodes::OpCodeType op, u16 zn, u16 carry, u16 overflow, u16 counter)
+	{
+		const bool z = (zn == 0);
+		const bool n = (static_cast<i16>(zn) < 0);
+		const bool o = (overflow != 0);
+		switch (op)
+		{
+		case OpCodes::OP_JZ: return z;
+		case OpCodes::OP_JNZ: return !z;
+		case OpCodes::OP_JGT: return !z && (n == o);
+		case OpCodes::OP_JLT: return n != o;
+		case OpCodes::OP_JGE: return n == o;
+		case OpCodes::OP_JLE: return z || (n != o);
+		case OpCodes::OP_JC: return carry != 0;
+		case OpCodes::OP_JNC: return carry == 0;
+		case OpCodes::OP_JO: return o;
+		case OpCodes::OP_JN: return n;
+		default: return counter != 0;
+		}
+	}
+
+	//what Psw::setZN32 keeps of a 32 bit result
+	inline u16 ZN32(u32 val) { return static_cast<u16>((val >> 16) | ((val & 0xFFFF) != 0)); }
+};
+
+Lanes::Lanes( size_t maxLanes ) : maskSteps(0), jobs(nullptr), results(nullptr), left(0), decoderProgram(nullptr)
+{
+	maxLanes = std::max<size_t>(maxLanes,1);
+	stride = width = (maxLanes + WIDTH_ALIGN - 1) / WIDTH_ALIGN * WIDTH_ALIGN;
+
+	regs.resize(Registers::REG_COUNT * stride);
+	zn.resize(stride);
+	carry.resize(stride);
+	overflow.resize(stride);
+	iep.resize(stride);
+	sp.resize(stride);
+	alive.resize(stride);
+	mask.resize(stride);
+	count.resize(stride);
+	inputPos.resize(stride);
+	scratchA.resize(stride);
+	scratchB.resize(stride);
+	result.resize(stride);
+	newCarry.resize(stride);
+	newOverflow.resize(stride);
+
+	privates.resize(maxLanes);
+
+	scalar.io = &scalarIo;
+}
+
+void Lanes::load( const ByteVector& program )
+{
+	if (decoderProgram != &program)
+	{
+		decoder.reset();
+		decoder.mem.init(&program[0],program.size());
+		decoderProgram = &program;
+	}
+
+	//everyone starts out reading the image again
+	for (auto lane=privates.begin();lane!=privates.end();++lane)
+	{
+		for (auto it=lane->begin();it!=lane->end();++it)
+			freePages.push_back(it->index);
+		lane->clear();
+	}
+	anyPrivate.reset();
+}
+
+const u8* Lanes::lanePage( size_t lane, size_t page ) const
+{
+	if (anyPrivate[page])
+	{
+		const vector<PrivatePage>& own = privates[lane];
+		for (auto it=own.begin();it!=own.end();++it)
+		{
+			if (it->page == page)
+				return &pool[it->index * PAGE_SIZE];
+		}
+	}
+	return &decoder.mem.bytes[page * PAGE_SIZE];
+}
+
+u8* Lanes::privatePage( size_t lane, size_t page )
+{
+	vector<PrivatePage>& own = privates[lane];
+	for (auto it=own.begin();it!=own.end();++it)
+	{
+		if (it->page == page)
+			return &pool[it->index * PAGE_SIZE];
+	}
+
+	size_t index = pool.size() / PAGE_SIZE;
+	if (!freePages.empty())
+	{
+		index = freePages.back();
+		freePages.pop_back();
+	}
+	else
+		pool.resize(pool.size() + PAGE_SIZE);
+
+	memcpy(&pool[index * PAGE_SIZE],&decoder.mem.bytes[page * PAGE_SIZE],PAGE_SIZE);
+	own.push_back(PrivatePage(page,index));
+	anyPrivate.set(page);
+	return &pool[index * PAGE_SIZE];
+}
+
+u16 Lanes::readWord( size_t lane, size_t address ) const
+{
+	return static_cast<u16>(readByte(lane,address) | (readByte(lane,address + 1) << 8));
+}
+
+void Lanes::writeWord( size_t lane, size_t address, u16 value )
+{
+	//one at a time, the second privatePage() can move pool
+	privatePage(lane,address >> Memory::PAGE_BITS)[address & (PAGE_SIZE-1)] = static_cast<u8>(value);
+	privatePage(lane,(address + 1) >> Memory::PAGE_BITS)[(address + 1) & (PAGE_SIZE-1)] = static_cast<u8>(value >> 8);
+}
+
+void Lanes::readBlock( size_t lane, size_t address, size_t len, vector<u8>& out ) const
+{
+	out.resize(len);
+	for (size_t done=0;done<len;)
+	{
+		const size_t at = address + done;
+		const size_t chunk = std::min<size_t>(len - done,PAGE_SIZE - (at & (PAGE_SIZE-1)));
+		memcpy(&out[done],lanePage(lane,at >> Memory::PAGE_BITS) + (at & (PAGE_SIZE-1)),chunk);
+		done += chunk;
+	}
+}
+
+void Lanes::writeBlock( size_t lane, size_t address, const vector<u8>& data )
+{
+	for (size_t done=0;done<data.size();)
+	{
+		const size_t at = address + done;
+		const size_t chunk = std::min<size_t>(data.size() - done,PAGE_SIZE - (at & (PAGE_SIZE-1)));
+		memcpy(privatePage(lane,at >> Memory::PAGE_BITS) + (at & (PAGE_SIZE-1)),&data[done],chunk);
+		done += chunk;
+	}
+}
+
+void Lanes::run( const Batch::Job* jobs, Batch::Result* results, size_t num )
+{
+	this->jobs = jobs;
+	this->results = results;
+	load(*jobs[0].program);
+	const u64 budget = jobs[0].budget;
+	width = (num + WIDTH_ALIGN - 1) / WIDTH_ALIGN * WIDTH_ALIGN; //a short run doesn't pay for all the lanes
+
+	std::fill(regs.begin(),regs.end(),0);
+	std::fill(zn.begin(),zn.end(),0);
+	std::fill(carry.begin(),carry.end(),0);
+	std::fill(overflow.begin(),overflow.end(),0);
+	std::fill(count.begin(),count.end(),0);
+	std::fill(inputPos.begin(),inputPos.end(),0);
+	for (size_t lane=0;lane<width;lane++)
+	{
+		alive[lane] = (lane < num) ? NO_IEP : 0;
+		iep[lane] = 0;
+		sp[lane] = Memory::SIZE;
+	}
+	for (size_t lane=0;lane<num;lane++)
+		results[lane] = Batch::Result();
+	left = num;
+
+	//as long as the instructions the masked lanes execute don't branch apart, or reach the IEP of a lane that is waiting,
+	//target just follows them and mask stays the same, only then does it take passes over all the IEPs to pick the next
+	u32 target = 0;
+	u32 parked = NO_IEP; //lowest IEP of the live lanes that aren't in mask
+	bool pick = false;
+	size_t active = num;
+	for (size_t lane=0;lane<width;lane++)
+		mask[lane] = (lane < num) ? 0xFFFF : 0;
+	maskSteps = 0;
+
+	size_t lowSteps = 0;
+	for (u64 steps=0;left>0;steps++)
+	{
+		if (pick)
+		{
+			for (size_t lane=0;lane<width;lane++)
+				count[lane] += mask[lane] ? maskSteps : 0;
+			maskSteps = 0;
+
+			//lowest IEP goes first, so lanes that branched ahead wait for the others to catch up
+			target = NO_IEP;
+			for (size_t lane=0;lane<width;lane++)
+				target = std::min(target,iep[lane] | ~alive[lane]);
+			parked = NO_IEP;
+			active = 0;
+			for (size_t lane=0;lane<width;lane++)
+			{
+				u32 laneIEP = iep[lane] | ~alive[lane];
+				mask[lane] = (laneIEP == target) ? 0xFFFF : 0;
+				parked = std::min(parked,laneIEP | Wide(mask[lane]));
+				active += mask[lane] & 1;
+			}
+			pick = false;
+		}
+
+		//a few lanes in a long loop shouldn't keep all the others waiting, and paying for the whole width
+		lowSteps = (active * STRAGGLER_RATIO <= width) ? (lowSteps + 1) : 0;
+		if (lowSteps > STRAGGLER_STEPS)
+		{
+			evictMasked();
+			lowSteps = 0;
+			pick = true;
+			continue;
+		}
+
+		//a lane executes at most one instruction per step, so none can be out of budget before this
+		if (steps >= budget)
+		{
+			bool any = false;
+			for (size_t lane=0;lane<width;lane++)
+			{
+				if (mask[lane] && executed(lane) >= budget)
+					finish(lane,Cpu::Stop(Cpu::Stop::STOP_BUDGET,executed(lane),target));
+				any |= (mask[lane] != 0);
+			}
+			if (!any)
+			{
+				pick = true;
+				continue;
+			}
+		}
+
+		const Decoded* ins = nullptr;
+		try
+		{
+			ins = &decoder.fetchDecoded(target);
+		}
+		catch (const Cpu::InstructionException&) {}
+		if (!ins || ins->realIndex == Decoded::FAULT_INDEX) //the scalar cpu knows how to fault
+		{
+			evictMasked();
+			pick = true;
+			continue;
+		}
+
+		//lanes that wrote over this instruction have to run their own version of it
+		if (anyPrivate[target >> Memory::PAGE_BITS] || anyPrivate[(target + ins->len - 1) >> Memory::PAGE_BITS])
+		{
+			for (size_t lane=0;lane<width;lane++)
+			{
+				for (size_t i=0;mask[lane] && i<ins->len;i++)
+				{
+					if (readByte(lane,target + i) != decoder.mem.bytes[target + i])
+						evict(lane);
+				}
+			}
+		}
+
+		u32 next = execute(*ins,target);
+		maskSteps++;
+		if (next < parked) //NO_IEP never is
+			target = next;
+		else
+			pick = true;
+	}
+}
+
+const u16* Lanes::operand( u8 reg, const Decoded& ins, vector<u16>& scratch )
+{
+	if (reg != Registers::REG_CONSTANT)
+		return row(reg);
+
+	std::fill(scratch.begin(),scratch.begin() + width,ins.imm.u);
+	return &scratch[0];
+}
+
+const u16* Lanes::address( u8 reg, const Decoded& ins, vector<u16>& scratch )
+{
+	if (reg == Registers::REG_CONSTANT)
+		std::fill(scratch.begin(),scratch.begin() + width,ins.imm.u);
+	else
+	{
+		const u16* base = row(reg);
+		for (size_t lane=0;lane<width;lane++)
+			scratch[lane] = base[lane] + ins.imm.u;
+	}
+	return &scratch[0];
+}
+
+const u16* Lanes::indexed( u8 reg, const Decoded& ins, vector<u16>& scratch )
+{
+	const u16* base = row(reg);
+	const u16* index = row(ins.imm.u & 0x0F);
+	for (size_t lane=0;lane<width;lane++)
+		scratch[lane] = base[lane] + (index[lane] << (ins.imm.u >> 4));
+	return &scratch[0];
+}
+
+void Lanes::blend( u16* dst, const vector<u16>& val )
+{
+	for (size_t lane=0;lane<width;lane++)
+		dst[lane] = (val[lane] & mask[lane]) | (dst[lane] & ~mask[lane]);
+}
+
+void Lanes::setZN( u8 dst, const vector<u16>& val )
+{
+	blend(row(dst),val);
+	blend(&zn[0],val);
+	for (size_t lane=0;lane<width;lane++)
+		overflow[lane] &= ~mask[lane];
+}
+
+u32 Lanes::execute( const Decoded& ins, u32 currIEP )
+{
+	//same semantics as the Cpu handlers, with C and O worked out right away instead of lazily
+	const u32 next = currIEP + ins.len;
+	const u16* a;
+	const u16* b;
+	switch (ins.opcode())
+	{
+	case OpCodes::OP_ADD:
+		a = operand(ins.src1,ins,scratchA);
+		b = operand(ins.src2,ins,scratchB);
+		for (size_t lane=0;lane<width;lane++)
+		{
+			//C is bit 16 of the whole sum, O is both operands having a different sign than the result
+			u32 sum = static_cast<u32>(a[lane]) + b[lane] + carry[lane];
+			result[lane] = static_cast<u16>(sum);
+			newCarry[lane] = static_cast<u16>(sum >> 16);
+			newOverflow[lane] = static_cast<u16>(((a[lane] ^ result[lane]) & (b[lane] ^ result[lane])) >> 15);
+		}
+		setZN(ins.dst,result);
+		blend(&carry[0],newCarry);
+		blend(&overflow[0],newOverflow);
+		break;
+	case OpCodes::OP_SUB:
+	case OpCodes::OP_CMP:
+		{
+			//bit 16 of the difference is the borrow, O is the operands' signs differing and the result's not being src1's
+			const bool sub = (ins.opcode() == OpCodes::OP_SUB);
+			a = operand(ins.src1,ins,scratchA);
+			b = operand(ins.src2,ins,scratchB);
+			for (size_t lane=0;lane<width;lane++)
+			{
+				u32 diff = static_cast<u32>(a[lane]) - b[lane] - (sub ? carry[lane] : 0);
+				result[lane] = static_cast<u16>(diff);
+				newCarry[lane] = static_cast<u16>((diff >> 16) & 1);
+				newOverflow[lane] = static_cast<u16>(((a[lane] ^ b[lane]) & (a[lane] ^ result[lane])) >> 15);
+			}
+			if (sub)
+				setZN(ins.dst,result);
+			else
+				blend(&zn[0],result);
+			blend(&carry[0],newCarry);
+			blend(&overflow[0],newOverflow);
+		}
+		break;
+	case OpCodes::OP_SAR:
+	case OpCodes::OP_SAL:
+		a = operand(ins.src1,ins,scratchA);
+		b = operand(ins.src2,ins,scratchB);
+		if (ins.src2 == Registers::REG_CONSTANT && ins.imm.u < 16)
+		{
+			//the usual case, a count that's the same for every lane is a single vector shift
+			const u16 by = ins.imm.u;
+			for (size_t lane=0;lane<width;lane++)
+			{
+				i16 op1 = static_cast<i16>(a[lane]);
+				i16 shifted = (ins.opcode() == OpCodes::OP_SAR) ? static_cast<i16>(op1 >> by) : static_cast<i16>(op1 << by);
+				i16 back = (ins.opcode() == OpCodes::OP_SAR) ? static_cast<i16>(shifted << by) : static_cast<i16>(shifted >> by);
+				newCarry[lane] = (back != op1) ? 1 : 0;
+				result[lane] = shifted;
+			}
+		}
+		else
+		{
+			for (size_t lane=0;lane<width;lane++)
+			{
+				i16 op1 = static_cast<i16>(a[lane]);
+				i16 shifted = op1;
+				if (ins.opcode() == OpCodes::OP_SAR)
+					newCarry[lane] = ((shifted >>= b[lane]) << b[lane]) != op1;
+				else
+					newCarry[lane] = ((shifted <<= b[lane]) >> b[lane]) != op1;
+				result[lane] = shifted;
+			}
+		}
+		setZN(ins.dst,result);
+		blend(&carry[0],newCarry);
+		break;
+	case OpCodes::OP_AND:
+		a = operand(ins.src1,ins,scratchA);
+		b = operand(ins.src2,ins,scratchB);
+		for (size_t lane=0;lane<width;lane++)
+			result[lane] = a[lane] & b[lane];
+		setZN(ins.dst,result);
+		break;
+	case OpCodes::OP_OR:
+		a = operand(ins.src1,ins,scratchA);
+		b = operand(ins.src2,ins,scratchB);
+		for (size_t lane=0;lane<width;lane++)
+			result[lane] = a[lane] | b[lane];
+		setZN(ins.dst,result);
+		break;
+	case OpCodes::OP_NOT:
+		a = operand(ins.src1,ins,scratchA);
+		for (size_t lane=0;lane<width;lane++)
+			result[lane] = ~a[lane];
+		setZN(ins.dst,result);
+		break;
+	case OpCodes::OP_JMP:
+		a = address(ins.src1,ins,scratchA);
+		for (size_t lane=0;lane<width;lane++)
+			iep[lane] = (a[lane] & Wide(mask[lane])) | (iep[lane] & ~Wide(mask[lane]));
+		return (ins.src1 == Registers::REG_CONSTANT) ? ins.imm.u : NO_IEP;
+	case OpCodes::OP_JZ:
+	case OpCodes::OP_JGT:
+	case OpCodes::OP_JNZ:
+	case OpCodes::OP_JLT:
+	case OpCodes::OP_JGE:
+	case OpCodes::OP_JLE:
+	case OpCodes::OP_JC:
+	case OpCodes::OP_JNC:
+	case OpCodes::OP_JO:
+	case OpCodes::OP_JN:
+	case OpCodes::OP_LOOP:
+		{
+			a = address(ins.src1,ins,scratchA);
+			const OpCodes::OpCodeType op = ins.opcode();
+			u16* counter = row(ins.dst); //only LOOP has one, the others have 0 there
+			u16 anyTaken = 0, allTaken = 0xFFFF;
+			for (size_t lane=0;lane<width;lane++)
+			{
+				if (op == OpCodes::OP_LOOP)
+					counter[lane] -= mask[lane] & 1;
+				u16 taken = Taken(op,zn[lane],carry[lane],overflow[lane],counter[lane]) ? 0xFFFF : 0;
+				u32 to = (static_cast<u16>(currIEP + a[lane]) & Wide(taken)) | (next & ~Wide(taken));
+				iep[lane] = (to & Wide(mask[lane])) | (iep[lane] & ~Wide(mask[lane]));
+				anyTaken |= taken & mask[lane];
+				allTaken &= taken | ~mask[lane];
+			}
+
+			if (anyTaken == 0)
+				return next;
+			if (allTaken == 0xFFFF && ins.src1 == Registers::REG_CONSTANT)
+				return static_cast<u16>(currIEP + ins.imm.u);
+		}
+		return NO_IEP;
+	case OpCodes::OP_MOV:
+		address(ins.src1,ins,scratchA);
+		setZN(ins.dst,scratchA);
+		break;
+	case OpCodes::OP_LDR:
+	case OpCodes::OP_LDRX:
+		a = (ins.opcode() == OpCodes::OP_LDRX) ? indexed(ins.src1,ins,scratchA) : address(ins.src1,ins,scratchA);
+		for (size_t lane=0;lane<width;lane++)
+		{
+			if (!mask[lane])
+				continue;
+			if (a[lane] + sizeof(u16) > Memory::SIZE)
+			{
+				evict(lane);
+				continue;
+			}
+
+			u16 value = readWord(lane,a[lane]);
+			row(ins.dst)[lane] = value;
+			zn[lane] = value;
+			overflow[lane] = 0;
+		}
+		break;
+	case OpCodes::OP_STR:
+	case OpCodes::OP_STRX:
+		a = (ins.opcode() == OpCodes::OP_STRX) ? indexed(ins.dst,ins,scratchA) : address(ins.dst,ins,scratchA);
+		for (size_t lane=0;lane<width;lane++)
+		{
+			if (!mask[lane])
+				continue;
+			if (a[lane] + sizeof(u16) > Memory::SIZE)
+			{
+				evict(lane);
+				continue;
+			}
+
+			writeWord(lane,a[lane],row(ins.src1)[lane]);
+		}
+		break;
+	case OpCodes::OP_LDRP:
+		for (size_t lane=0;lane<width;lane++)
+		{
+			if (!mask[lane])
+				continue;
+
+			u16 at = row(ins.src1)[lane];
+			if (at + sizeof(u16) > Memory::SIZE)
+			{
+				evict(lane);
+				continue;
+			}
+
+			row(ins.src1)[lane] = at + sizeof(u16);
+			u16 value = readWord(lane,at);
+			row(ins.dst)[lane] = value;
+			zn[lane] = value;
+			overflow[lane] = 0;
+		}
+		break;
+	case OpCodes::OP_STRP:
+		for (size_t lane=0;lane<width;lane++)
+		{
+			if (!mask[lane])
+				continue;
+
+			u16 at = row(ins.dst)[lane];
+			if (at + sizeof(u16) > Memory::SIZE)
+			{
+				evict(lane);
+				continue;
+			}
+
+			writeWord(lane,at,row(ins.src1)[lane]);
+			row(ins.dst)[lane] = at + sizeof(u16);
+		}
+		break;
+	case OpCodes::OP_LDRB:
+	case OpCodes::OP_LDRSB:
+		{
+			a = address(ins.src1,ins,scratchA);
+			const bool sign = (ins.opcode() == OpCodes::OP_LDRSB);
+			for (size_t lane=0;lane<width;lane++)
+			{
+				if (!mask[lane])
+					continue;
+
+				u8 byte = readByte(lane,a[lane]); //a u16 address always has its byte
+				u16 value = sign ? static_cast<u16>(static_cast<i8>(byte)) : byte;
+				row(ins.dst)[lane] = value;
+				zn[lane] = value;
+				overflow[lane] = 0;
+			}
+		}
+		break;
+	case OpCodes::OP_STRB:
+		a = address(ins.dst,ins,scratchA);
+		for (size_t lane=0;lane<width;lane++)
+		{
+			if (mask[lane])
+				writeByte(lane,a[lane],static_cast<u8>(row(ins.src1)[lane]));
+		}
+		break;
+	case OpCodes::OP_ADD32:
+	case OpCodes::OP_SUB32:
+	case OpCodes::OP_CMP32:
+		{
+			const bool sub = (ins.opcode() != OpCodes::OP_ADD32);
+			const bool store = (ins.opcode() != OpCodes::OP_CMP32);
+			u16* low = row(ins.dst);
+			u16* high = row(ins.dst + 1);
+			for (size_t lane=0;lane<width;lane++)
+			{
+				if (!mask[lane])
+					continue;
+
+				u32 op1 = low[lane] | (static_cast<u32>(high[lane]) << 16);
+				u32 op2 = (ins.src1 == Registers::REG_CONSTANT) ? static_cast<u32>(static_cast<i32>(ins.imm.i)) :
+					(row(ins.src1)[lane] | (static_cast<u32>(row(ins.src1 + 1)[lane]) << 16));
+				u32 res = sub ? (op1 - op2) : (op1 + op2);
+				if (store)
+				{
+					low[lane] = static_cast<u16>(res);
+					high[lane] = static_cast<u16>(res >> 16);
+				}
+				zn[lane] = ZN32(res);
+				carry[lane] = (sub ? (op1 < op2) : (res < op1)) ? 1 : 0;
+				overflow[lane] = static_cast<u16>((sub ? ((op1 ^ op2) & (op1 ^ res)) : ((op1 ^ res) & (op2 ^ res))) >> 31);
+			}
+		}
+		break;
+	case OpCodes::OP_SAL32:
+	case OpCodes::OP_SAR32:
+		{
+			const bool left = (ins.opcode() == OpCodes::OP_SAL32);
+			b = operand(ins.src1,ins,scratchB);
+			u16* low = row(ins.dst);
+			u16* high = row(ins.dst + 1);
+			for (size_t lane=0;lane<width;lane++)
+			{
+				if (!mask[lane])
+					continue;
+
+				u32 val = low[lane] | (static_cast<u32>(high[lane]) << 16);
+				u32 res, back;
+				if (b[lane] >= 32)
+				{
+					res = left ? 0 : static_cast<u32>(static_cast<i32>(val) >> 31);
+					back = 0;
+				}
+				else if (left)
+				{
+					res = val << b[lane];
+					back = static_cast<u32>(static_cast<i32>(res) >> b[lane]);
+				}
+				else
+				{
+					res = static_cast<u32>(static_cast<i32>(val) >> b[lane]);
+					back = res << b[lane];
+				}
+				low[lane] = static_cast<u16>(res);
+				high[lane] = static_cast<u16>(res >> 16);
+				zn[lane] = ZN32(res);
+				carry[lane] = (back != val) ? 1 : 0;
+				overflow[lane] = 0;
+			}
+		}
+		break;
+	case OpCodes::OP_MEMCPY:
+	case OpCodes::OP_MEMSET:
+	case OpCodes::OP_MEMCMP:
+		{
+			//MEMCPY reads all of src before writing, which is what makes overlapping ranges work
+			const OpCodes::OpCodeType op = ins.opcode();
+			const u16* len = row(static_cast<u8>(ins.imm.u));
+			for (size_t lane=0;lane<width;lane++)
+			{
+				if (!mask[lane])
+					continue;
+
+				const u16 to = row(ins.dst)[lane];
+				const u16 from = row(ins.src1)[lane];
+				if (to + len[lane] > Memory::SIZE || (op != OpCodes::OP_MEMSET && from + len[lane] > Memory::SIZE))
+				{
+					evict(lane);
+					continue;
+				}
+
+				if (op == OpCodes::OP_MEMSET)
+				{
+					blockA.assign(len[lane],static_cast<u8>(from));
+					writeBlock(lane,to,blockA);
+				}
+				else if (op == OpCodes::OP_MEMCPY)
+				{
+					readBlock(lane,from,len[lane],blockA);
+					writeBlock(lane,to,blockA);
+				}
+				else
+				{
+					readBlock(lane,to,len[lane],blockA);
+					readBlock(lane,from,len[lane],blockB);
+					const int diff = blockA.empty() ? 0 : memcmp(&blockA[0],&blockB[0],blockA.size());
+					zn[lane] = static_cast<u16>((diff > 0) - (diff < 0));
+					overflow[lane] = 0;
+				}
+			}
+		}
+		break;
+	case OpCodes::OP_IN:
+		for (size_t lane=0;lane<width;lane++)
+		{
+			if (!mask[lane])
+				continue;
+
+			const vector<i16>& input = jobs[lane].input;
+			if (inputPos[lane] >= input.size())
+			{
+				finish(lane,Cpu::Stop(Cpu::Stop::STOP_IO_WAIT,executed(lane),currIEP));
+				continue;
+			}
+
+			u16 value = static_cast<u16>(input[inputPos[lane]++]);
+			row(ins.dst)[lane] = value;
+			zn[lane] = value;
+			overflow[lane] = 0;
+		}
+		break;
+	case OpCodes::OP_OUT:
+		for (size_t lane=0;lane<width;lane++)
+		{
+			if (mask[lane])
+				results[lane].output.push_back(static_cast<i16>(row(ins.src1)[lane]));
+		}
+		break;
+	case OpCodes::OP_CLC:
+		for (size_t lane=0;lane<width;lane++)
+			carry[lane] &= ~mask[lane];
+		break;
+	case OpCodes::OP_STC:
+		for (size_t lane=0;lane<width;lane++)
+			carry[lane] |= mask[lane] & 1;
+		break;
+	case OpCodes::OP_NC:
+		for (size_t lane=0;lane<width;lane++)
+			carry[lane] ^= mask[lane] & 1;
+		break;
+	case OpCodes::OP_MOVF:
+		for (size_t lane=0;lane<width;lane++)
+			result[lane] = (zn[lane] == 0) | (overflow[lane] << 1) | (carry[lane] << 2) | ((static_cast<i16>(zn[lane]) < 0) << 3);
+		blend(row(ins.dst),result);
+		break;
+	case OpCodes::OP_MOVTSP:
+		a = row(ins.src1);
+		for (size_t lane=0;lane<width;lane++)
+			sp[lane] = (a[lane] & Wide(mask[lane])) | (sp[lane] & ~Wide(mask[lane]));
+		break;
+	case OpCodes::OP_MOVFSP:
+		for (size_t lane=0;lane<width;lane++)
+			result[lane] = static_cast<u16>(sp[lane]);
+		blend(row(ins.dst),result);
+		break;
+	case OpCodes::OP_CALL:
+		a = address(ins.src1,ins,scratchA);
+		for (size_t lane=0;lane<width;lane++)
+		{
+			if (!mask[lane])
+				continue;
+
+			//like FlowCall the stack stops at 0, so the push is always in range
+			sp[lane] = (sp[lane] >= sizeof(u16)) ? (sp[lane] - sizeof(u16)) : 0;
+			writeWord(lane,sp[lane],static_cast<u16>(next));
+			iep[lane] = a[lane];
+		}
+		return (ins.src1 == Registers::REG_CONSTANT) ? ins.imm.u : NO_IEP;
+	case OpCodes::OP_RET:
+		for (size_t lane=0;lane<width;lane++)
+		{
+			if (!mask[lane])
+				continue;
+			if (sp[lane] + sizeof(u16) > Memory::SIZE)
+			{
+				evict(lane);
+				continue;
+			}
+
+			iep[lane] = readWord(lane,sp[lane]);
+			sp[lane] += sizeof(u16);
+		}
+		return NO_IEP;
+	case OpCodes::OP_PUSH:
+		for (size_t lane=0;lane<width;lane++)
+		{
+			if (!mask[lane])
+				continue;
+
+			sp[lane] = (sp[lane] >= sizeof(u16)) ? (sp[lane] - sizeof(u16)) : 0;
+			writeWord(lane,sp[lane],row(ins.src1)[lane]);
+		}
+		break;
+	case OpCodes::OP_POP:
+		for (size_t lane=0;lane<width;lane++)
+		{
+			if (!mask[lane])
+				continue;
+			if (sp[lane] + sizeof(u16) > Memory::SIZE)
+			{
+				evict(lane);
+				continue;
+			}
+
+			row(ins.dst)[lane] = readWord(lane,sp[lane]);
+			sp[lane] += sizeof(u16);
+		}
+		break;
+	case OpCodes::OP_HLT:
+		for (size_t lane=0;lane<width;lane++)
+		{
+			if (mask[lane])
+				finish(lane,Cpu::Stop(Cpu::Stop::STOP_HALT,executed(lane)+1,next));
+		}
+		return NO_IEP;
+	default:
+		evictMasked();
+		return NO_IEP;
+	}
+
+	for (size_t lane=0;lane<width;lane++)
+		iep[lane] = (next & Wide(mask[lane])) | (iep[lane] & ~Wide(mask[lane]));
+	return next;
+}
+
+void Lanes::finish( size_t lane, const Cpu::Stop& stop )
+{
+	Batch::Result& res = results[lane];
+	res.stop = stop;
+	for (size_t r=0;r<Registers::REG_COUNT;r++)
+		res.regs[r] = row(static_cast<u8>(r))[lane];
+	res.sp = sp[lane];
+
+	alive[lane] = 0;
+	mask[lane] = 0;
+	left--;
+}
+
+void Lanes::evictMasked()
+{
+	for (size_t lane=0;lane<width;lane++)
+	{
+		if (mask[lane])
+			evict(lane);
+	}
+}
+
+void Lanes::evict( size_t lane )
+{
+	scalar.reset();
+	memcpy(scalar.mem.bytes,decoder.mem.bytes,Memory::SIZE);
+	for (auto it=privates[lane].begin();it!=privates[lane].end();++it)
+		memcpy(&scalar.mem.bytes[it->page * PAGE_SIZE],&pool[it->index * PAGE_SIZE],PAGE_SIZE);
+	for (size_t r=0;r<Registers::REG_COUNT;r++)
+		scalar.regs[r] = Cpu::Op(row(static_cast<u8>(r))[lane]);
+	scalar.psw.setZN(Cpu::Op(zn[lane]));
+	scalar.psw.setC(carry[lane] != 0);
+	scalar.psw.setO(overflow[lane] != 0);
+	scalar.mem.iep = iep[lane];
+	scalar.mem.sp = sp[lane];
+
+	Batch::Result& res = results[lane];
+	scalarIo.input = jobs[lane].input;
+	scalarIo.inputPos = inputPos[lane];
+	scalarIo.output.swap(res.output);
+
+	u64 budget = jobs[lane].budget;
+	res.stop = scalar.run((budget == Cpu::NO_BUDGET) ? budget : (budget - executed(lane)));
+	res.stop.count += executed(lane);
+	if (res.stop.reason == Cpu::Stop::STOP_FAULT)
+	{
+		try
+		{
+			scalar.throwIfFault(res.stop);
+		}
+		catch(const Cpu::CpuException& e)
+		{
+			res.error = e.toString();
+		}
+	}
+
+	for (size_t r=0;r<Registers::REG_COUNT;r++)
+		res.regs[r] = scalar.regs[r].u;
+	res.sp = scalar.mem.sp;
+	res.output.swap(scalarIo.output);
+	scalarIo.output.clear();
+
+	alive[lane] = 0;
+	mask[lane] = 0;
+	left--;
+}
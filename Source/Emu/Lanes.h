@@ -0,0 +1,82 @@
+#pragma once
+
+#include "Cpu.h"
+#include "Batch.h"
+#include "IoDevice.h"
+#include <bitset>
+
+//one program, many inputs at once: every register is an array across lanes (structure of arrays), and all the lanes
+//at the lowest IEP execute that instruction together in plain loops over those arrays that the compiler turns into SIMD,
+//with the other lanes masked out. Lanes share the program's memory pages and only get their own copy of the ones they write.
+//A lane that does anything unusual (faults, executes code it modified) is moved to a scalar Cpu and finished there.
+class Lanes
+{
+public:
+	enum
+	{
+		WIDTH_ALIGN = 16, //lane count gets padded to this, so the loops have no remainder at any vector width
+		PAGES = Cpu::Memory::SIZE >> Cpu::Memory::PAGE_BITS,
+		PAGE_SIZE = 1 << Cpu::Memory::PAGE_BITS
+	};
+
+	Lanes(size_t maxLanes);
+
+	//runs num jobs that all have the same program and budget, num is at most maxLanes
+	void run(const Batch::Job* jobs, Batch::Result* results, size_t num);
+private:
+	u16* row(u8 reg) { return &regs[reg*stride]; }
+	const u16* operand(u8 reg, const Cpu::Decoded& ins, vector<u16>& scratch);
+	const u16* address(u8 reg, const Cpu::Decoded& ins, vector<u16>& scratch);
+	const u16* indexed(u8 reg, const Cpu::Decoded& ins, vector<u16>& scratch); //base + index * scale
+	void blend(u16* dst, const vector<u16>& val); //dst = val where mask is set
+	void setZN(u8 dst, const vector<u16>& val); //blend into the dst register and zn, and clear O
+	const u8* lanePage(size_t lane, size_t page) const; //its own copy or the image
+	u8* privatePage(size_t lane, size_t page); //makes its own copy on first use
+	u8 readByte(size_t lane, size_t address) const { return lanePage(lane,address >> Cpu::Memory::PAGE_BITS)[address & (PAGE_SIZE-1)]; }
+	u16 readWord(size_t lane, size_t address) const; //the two bytes can be on different pages
+	void writeWord(size_t lane, size_t address, u16 value);
+	void writeByte(size_t lane, size_t address, u8 value) { privatePage(lane,address >> Cpu::Memory::PAGE_BITS)[address & (PAGE_SIZE-1)] = value; }
+	void readBlock(size_t lane, size_t address, size_t len, vector<u8>& out) const; //page by page, the range has to be in memory
+	void writeBlock(size_t lane, size_t address, const vector<u8>& data);
+	void load(const ByteVector& program);
+	u32 execute(const Cpu::Decoded& ins, u32 currIEP); //returns where all the lanes go next, ~0 if they could have split up
+	void finish(size_t lane, const Cpu::Stop& stop);
+	void evict(size_t lane); //finishes it on the scalar cpu, from the instruction at its IEP
+	void evictMasked();
+	u64 executed(size_t lane) const { return count[lane] + (mask[lane] ? maskSteps : 0); }
+
+	size_t stride; //maxLanes rounded up, what the arrays are sized for
+	size_t width; //lanes in the current run rounded up, what the loops go over
+	vector<u16> regs; //[REG_COUNT][stride]
+	vector<u16> zn, carry, overflow; //Psw per lane, what setZN was given and the C and O flags (0 or 1)
+	vector<u32> iep, sp;
+	vector<u32> alive; //all ones for lanes still running
+	vector<u16> mask; //all ones for lanes executing the current instruction
+	vector<u64> count; //instructions executed, except the last maskSteps
+	u64 maskSteps; //steps executed since mask last changed, by all the lanes in it
+	vector<size_t> inputPos;
+	vector<u16> scratchA, scratchB, result, newCarry, newOverflow;
+	vector<u8> blockA, blockB; //what MEMCPY, MEMSET and MEMCMP read or write for a lane
+
+	//memory is copy on write, all lanes read the program image in decoder until they write (STR or a CALL push) to a page
+	struct PrivatePage
+	{
+		PrivatePage(size_t page, size_t index) : page(static_cast<u32>(page)), index(static_cast<u32>(index)) {}
+
+		u32 page; //guest page number
+		u32 index; //into pool
+	};
+	vector<vector<PrivatePage>> privates; //per lane, usually just the stack page
+	std::bitset<PAGES> anyPrivate; //pages some lane has its own copy of, the others can skip looking
+	vector<u8> pool; //PAGE_SIZE bytes per private page
+	vector<u32> freePages; //indexes into pool no lane has
+
+	const Batch::Job* jobs;
+	Batch::Result* results;
+	size_t left; //lanes still alive
+
+	Cpu decoder; //holds the unmodified program image the lanes share, decodes for all of them
+	const ByteVector* decoderProgram;
+	Cpu scalar; //where evicted lanes finish
+	VectorIo scalarIo;
+};
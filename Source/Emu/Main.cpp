@@ -2,19 +2,307 @@
 #include <fstream>
 #include "Common/Types.h"
 #include "Cpu.h"
+#include "IoDevice.h"
+#include "Profiler.h"
+#include "Trace.h"
+#include "Debugger.h"
+#include "Batch.h"
+#include "Checkpoint.h"
+#include "Journal.h"
+#include <csignal>
+#include <cstdlib>
+#include <memory>
+#include <chrono>
 
-int main(int argc, const char* argv[])
+#include <boost/program_options.hpp>
+namespace po=boost::program_options;
+
+namespace
 {
-	if (argc != 2)
+	const Tracer* InterruptTrace = nullptr;
+
+	void DumpTraceAndExit(int sig)
 	{
-		std::cout << "Usage: Emu objectCode.o" << std::endl;
-		return -1;
+		InterruptTrace->dump();
+		std::_Exit(128 + sig);
+	}
+
+	//what the run loop below does between slices of running, besides counting
+	struct Session
+	{
+		Session() : io(nullptr), checkpointer(nullptr), interval(0), journalIo(nullptr), recorder(nullptr), replayer(nullptr) {}
+
+		CountingIo* io; //what the cpu has
+		Checkpointer* checkpointer;
+		double interval; //seconds between checkpoints
+		JournalIo* journalIo; //when recording or replaying, IN stops the run until it gets its value from one of these
+		Recorder* recorder;
+		Replayer* replayer;
+	};
+
+	//runs in slices, so it can stop at an instruction boundary to checkpoint every interval seconds or to snapshot
+	//every so many instructions into the journal. done is what ran before (when resuming), budget counts those too
+	Cpu::Stop RunSliced(Cpu& cpu, const string& engine, u64 budget, u64 done, Session& session)
+	{
+		const u64 SLICE = 1 << 20; //a few ms, the clock only gets looked at between them
+		auto last = std::chrono::steady_clock::now();
+		for (;;)
+		{
+			u64 slice = (budget == Cpu::NO_BUDGET) ? SLICE : std::min(SLICE,budget - done);
+			if (session.recorder)
+				slice = std::min(slice,session.recorder->nextSnapshot() - done);
+
+			Cpu::Stop stop;
+			if (engine == "jit")
+				stop = cpu.runJit(slice);
+			else if (engine == "unchecked")
+				stop = cpu.runUnchecked(slice);
+			else if (engine == "threaded")
+				stop = cpu.run(slice);
+			else
+				stop = cpu.runStepped(slice);
+
+			done += stop.count;
+			stop.count = done;
+			if (session.recorder && done == session.recorder->nextSnapshot())
+				session.recorder->snapshot(cpu,done,session.io->inputs);
+
+			if (stop.reason == Cpu::Stop::STOP_IO_WAIT && session.journalIo)
+			{
+				i16 value;
+				bool haveValue;
+				if (session.recorder)
+				{
+					haveValue = session.journalIo->output.in(stop.iep,session.journalIo->wanted,value);
+					if (haveValue)
+						session.recorder->input(done,value);
+				}
+				else
+					haveValue = session.replayer->input(done,value);
+
+				if (haveValue)
+				{
+					session.journalIo->supply(value);
+					continue;
+				}
+			}
+
+			if (stop.reason != Cpu::Stop::STOP_BUDGET || done == budget)
+			{
+				//out of budget, one more so it can go on from there with a bigger one
+				if (session.checkpointer && stop.reason == Cpu::Stop::STOP_BUDGET)
+				{
+					session.io->flush();
+					session.checkpointer->capture(cpu,done,session.io->inputs,true);
+				}
+				return stop;
+			}
+
+			if (session.checkpointer && std::chrono::duration<double>(std::chrono::steady_clock::now() - last).count() >= session.interval)
+			{
+				session.io->flush(); //whatever the checkpoint says was output should be
+				session.checkpointer->capture(cpu,done,session.io->inputs);
+				last = std::chrono::steady_clock::now();
+			}
+		}
 	}
+};
+
+int main(int argc, const char* argv[])
+{
+	string fileName;
+	string engineName;
+	u64 budget;
+	string ioName, ioInName, ioOutName;
+	string profileName, listingName;
+	string traceName, decodeName;
+	bool debug = false;
+	string batchName;
+	size_t numThreads;
+	size_t laneWidth;
+	size_t traceSize;
+	string checkpointName, resumeName;
+	double checkpointEvery;
+	string recordName, replayName;
+	u64 snapshotEvery, replayFrom;
+
+	//options parsing
+	{
+		po::options_description generic("Options");
+		generic.add_options()
+			("help,h", "produce help message")
+			("engine,e", po::value<string>(&engineName)->default_value("threaded"), "execution engine: threaded, jit (native code for hot blocks), unchecked (threaded without the per instruction checks, for programs the load time verifier passes), reference (one execute() call per instruction) or lanes (--batch only, runs jobs of the same program side by side in SIMD lanes)")
+			("budget,b", po::value<u64>(&budget)->default_value(Cpu::NO_BUDGET,"unlimited"), "stop after executing this many instructions")
+			("io", po::value<string>(&ioName)->default_value("interactive"), "IN/OUT values: interactive (prompts), text (decimal, one per line) or binary (little endian words), the last two are buffered")
+			("in-file,i", po::value<string>(&ioInName), "read IN values from this file instead of stdin")
+			("out-file,o", po::value<string>(&ioOutName), "write OUT values to this file instead of stdout")
+			("profile,p", po::value<string>(&profileName), "count executions per address and write a hot spot report to this file (threaded engine only)")
+			("listing,l", po::value<string>(&listingName), "assembler listing (.txt) of the program, so the profile report and debugger show labels and source lines")
+			("debug,d", po::bool_switch(&debug), "start stopped and read debugger commands (break, watch, continue, step...) from stdin, IN values come from there too")
+			("trace,t", po::value<string>(&traceName), "keep the last --trace-size executed instructions and write them to this file on HLT, fault or Ctrl+C (threaded engine only)")
+			("trace-size", po::value<size_t>(&traceSize)->default_value(Tracer::DEFAULT_RECORDS), "number of instructions the trace keeps")
+			("decode-trace", po::value<string>(&decodeName), "print a file written by --trace as text and exit")
+			("batch", po::value<string>(&batchName), "run every job in this manifest (lines of: objectFile budget|- [IN values...]) and print one JSON line of results per job")
+			("threads,j", po::value<size_t>(&numThreads)->default_value(0,"one per core"), "threads --batch runs jobs on")
+			("lane-width", po::value<size_t>(&laneWidth)->default_value(Batch::DEFAULT_LANES), "most jobs the lanes engine runs side by side")
+			("checkpoint", po::value<string>(&checkpointName), "save the whole machine state to this file every --checkpoint-every seconds (and when the budget runs out)")
+			("checkpoint-every", po::value<double>(&checkpointEvery)->default_value(60), "seconds between checkpoints")
+			("resume", po::value<string>(&resumeName), "start from a --checkpoint file of the same program instead of the beginning, skipping the IN values it already consumed (OUT values after it are repeated)")
+			("record", po::value<string>(&recordName), "write every IN value and the instruction count it was read at to this journal, so the run can be repeated with --replay")
+			("snapshot-every", po::value<u64>(&snapshotEvery)->default_value(1000000000), "instructions between the machine snapshots --record puts in the journal (0 for none), --replay-from starts at one")
+			("replay", po::value<string>(&replayName), "take IN values from this --record journal instead of --io, at the instruction counts they were recorded at")
+			("replay-from", po::value<u64>(&replayFrom)->default_value(0), "start the replay at this instruction count, from the closest snapshot before it (OUT values until then are dropped)")
+			;
+
+		po::options_description hidden("");
+		hidden.add_options()
+			("input-file", po::value<string>(&fileName), "object code file");
+
+		po::options_description cmdline_options;
+		cmdline_options.add(generic).add(hidden);
+
+		po::positional_options_description positionals;
+		positionals.add("input-file", 1);
+
+		po::variables_map vm;
+		try
+		{
+			po::store(po::command_line_parser(argc, argv).options(cmdline_options).positional(positionals).run(), vm);
+			po::notify(vm);
+		}
+		catch(const po::error& e)
+		{
+			std::cerr << e.what() << std::endl;
+			return -1;
+		}
+
+		if (!decodeName.empty())
+		{
+			std::ifstream decodeFile(decodeName,std::ios::binary);
+			if (!decodeFile.is_open())
+			{
+				std::cerr << "Error opening trace file " << decodeName << std::endl;
+				return -1;
+			}
+			if (!Tracer::decode(decodeFile,std::cout))
+			{
+				std::cerr << decodeName << " is not a trace file" << std::endl;
+				return -2;
+			}
+			return 0;
+		}
 
-	string fileName = argv[1];
+		if (!batchName.empty())
+		{
+			if (engineName != "threaded" && engineName != "jit" && engineName != "unchecked" && engineName != "reference" && engineName != "lanes")
+			{
+				std::cerr << "Unknown engine " << engineName << std::endl;
+				return -1;
+			}
+
+			std::ifstream manifest(batchName);
+			if (!manifest.is_open())
+			{
+				std::cerr << "Error opening manifest " << batchName << std::endl;
+				return -1;
+			}
+
+			Batch batch;
+			if (!batch.load(manifest,std::cerr))
+				return -2;
+
+			std::ios::sync_with_stdio(false);
+			Batch::Engine engine = Batch::ENGINE_REFERENCE;
+			if (engineName == "jit")
+				engine = Batch::ENGINE_JIT;
+			else if (engineName == "threaded")
+				engine = Batch::ENGINE_THREADED;
+			else if (engineName == "unchecked")
+				engine = Batch::ENGINE_UNCHECKED;
+			else if (engineName == "lanes")
+				engine = Batch::ENGINE_LANES;
+			batch.run(engine,numThreads,laneWidth);
+			batch.write(std::cout);
+			return 0;
+		}
+
+		if (vm.count("help") || !vm.count("input-file"))
+		{
+			std::cout << "Usage: Emu [options] objectCode.o" << std::endl;
+			std::cout << generic << std::endl;
+			return -1;
+		}
+
+		if (engineName == "lanes")
+		{
+			std::cerr << "The lanes engine needs --batch" << std::endl;
+			return -1;
+		}
+		if (engineName != "threaded" && engineName != "jit" && engineName != "unchecked" && engineName != "reference")
+		{
+			std::cerr << "Unknown engine " << engineName << std::endl;
+			return -1;
+		}
+		if (!profileName.empty() && engineName != "threaded")
+		{
+			std::cerr << "Profiling needs the threaded engine" << std::endl;
+			return -1;
+		}
+		if (!traceName.empty() && engineName != "threaded")
+		{
+			std::cerr << "Tracing needs the threaded engine" << std::endl;
+			return -1;
+		}
+		if (!traceName.empty() && !profileName.empty())
+		{
+			std::cerr << "Can't trace and profile at the same time" << std::endl;
+			return -1;
+		}
+		if (debug && (engineName != "threaded" || !profileName.empty() || !traceName.empty()))
+		{
+			std::cerr << "Debugging needs the threaded engine, without profiling or tracing" << std::endl;
+			return -1;
+		}
+		if ((!checkpointName.empty() || !resumeName.empty()) && (debug || !profileName.empty() || !traceName.empty()))
+		{
+			std::cerr << "Checkpointing and resuming can't be combined with debugging, profiling or tracing" << std::endl;
+			return -1;
+		}
+		if ((!recordName.empty() || !replayName.empty()) && (debug || !profileName.empty() || !traceName.empty()))
+		{
+			std::cerr << "Recording and replaying can't be combined with debugging, profiling or tracing" << std::endl;
+			return -1;
+		}
+		if (!replayName.empty() && (!recordName.empty() || !resumeName.empty() || !checkpointName.empty()))
+		{
+			std::cerr << "Replaying can't be combined with recording, checkpointing or resuming" << std::endl;
+			return -1;
+		}
+		if (!recordName.empty() && !resumeName.empty())
+		{
+			std::cerr << "Recording has to start from the beginning, not --resume" << std::endl;
+			return -1;
+		}
+		if (!checkpointName.empty() && !(checkpointEvery > 0))
+		{
+			std::cerr << "--checkpoint-every has to be more than 0" << std::endl;
+			return -1;
+		}
+		if (!listingName.empty() && profileName.empty() && !debug)
+		{
+			std::cerr << "Listing is only used with --profile or --debug" << std::endl;
+			return -1;
+		}
+		if (ioName != "interactive" && ioName != "text" && ioName != "binary")
+		{
+			std::cerr << "Unknown io " << ioName << std::endl;
+			return -1;
+		}
+	}
+	std::ios::sync_with_stdio(false); //nothing uses stdio, lets the buffered io read std::cin in bulk
 
 	ByteVector objectCode;
-	std::ifstream inFile(argv[1],std::ios::binary);
+	std::ifstream inFile(fileName,std::ios::binary);
 	if (!inFile.is_open())
 	{
 		std::cerr << "Error opening input file " << fileName << std::endl;
@@ -38,26 +326,244 @@ int main(int argc, const char* argv[])
 		std::cerr << "Input file " << fileName << " is zero-length!" << std::endl;
 		return -2;
 	}
-	
+
 	inFile.close();
 
+	std::ifstream ioInFile;
+	std::ofstream ioOutFile;
+	if (!ioInName.empty())
+	{
+		ioInFile.open(ioInName,std::ios::binary);
+		if (!ioInFile.is_open())
+		{
+			std::cerr << "Error opening input file " << ioInName << std::endl;
+			return -1;
+		}
+	}
+	if (!ioOutName.empty())
+	{
+		ioOutFile.open(ioOutName,std::ios::binary);
+		if (!ioOutFile.is_open())
+		{
+			std::cerr << "Error opening output file " << ioOutName << std::endl;
+			return -1;
+		}
+	}
+	std::istream& ioIn = ioInFile.is_open() ? static_cast<std::istream&>(ioInFile) : std::cin;
+	std::ostream& ioOut = ioOutFile.is_open() ? static_cast<std::ostream&>(ioOutFile) : std::cout;
+
+	std::unique_ptr<IoDevice> io;
+	if (ioName == "text")
+		io.reset(new TextIo(ioIn,ioOut));
+	else if (ioName == "binary")
+		io.reset(new BinaryIo(ioIn,ioOut));
+	else
+		io.reset(new InteractiveIo(ioIn,ioOut));
+
 	Cpu cpuCtx;
+	cpuCtx.io = io.get();
 	cpuCtx.mem.init(&objectCode[0],objectCode.size());
 
-	bool failed = false;
-	for (;;)
+	u64 resumedCount = 0;
+	Session session;
+	std::unique_ptr<JournalIo> journalIo;
+	std::unique_ptr<CountingIo> countingIo;
+	if (!recordName.empty() || !replayName.empty())
+	{
+		journalIo.reset(new JournalIo(*io));
+		session.journalIo = journalIo.get();
+	}
+	if (!checkpointName.empty() || !resumeName.empty() || journalIo)
+	{
+		countingIo.reset(new CountingIo(journalIo ? *journalIo : *io));
+		cpuCtx.io = session.io = countingIo.get();
+	}
+	if (!resumeName.empty())
+	{
+		std::ifstream resumeFile(resumeName,std::ios::binary);
+		if (!resumeFile.is_open())
+		{
+			std::cerr << "Error opening checkpoint file " << resumeName << std::endl;
+			return -1;
+		}
+
+		Checkpointer::State state;
+		if (!Checkpointer::load(resumeFile,objectCode,state))
+		{
+			std::cerr << resumeName << " is not a checkpoint of " << fileName << std::endl;
+			return -2;
+		}
+		Checkpointer::apply(state,cpuCtx);
+		resumedCount = state.count;
+
+		//the same input has to be given again, what the program already read is passed over
+		i16 skippedValue;
+		for (u64 i=0;i<state.inputs;i++)
+		{
+			if (!io->in(state.iep,Registers::REG_R0,skippedValue))
+			{
+				std::cerr << "Input ended before the " << state.inputs << " values " << resumeName << " already consumed" << std::endl;
+				return -2;
+			}
+		}
+		countingIo->inputs = state.inputs;
+	}
+
+	std::ifstream replayFile;
+	Replayer replayer;
+	if (!replayName.empty())
+	{
+		replayFile.open(replayName,std::ios::binary);
+		if (!replayFile.is_open())
+		{
+			std::cerr << "Error opening journal " << replayName << std::endl;
+			return -1;
+		}
+		if (!replayer.load(replayFile,objectCode,std::cerr))
+			return -2;
+
+		resumedCount = replayer.seek(replayFile,replayFrom,cpuCtx);
+		session.replayer = &replayer;
+	}
+
+	std::unique_ptr<Recorder> recorder;
+	if (!recordName.empty())
+	{
+		recorder.reset(new Recorder(objectCode,snapshotEvery));
+		if (!recorder->open(recordName))
+		{
+			std::cerr << "Error opening journal " << recordName << std::endl;
+			return -1;
+		}
+		session.recorder = recorder.get();
+	}
+
+	Listing listing;
+	bool haveListing = false;
+	if (!listingName.empty())
+	{
+		std::ifstream listingFile(listingName);
+		haveListing = listingFile.is_open() && listing.load(listingFile);
+		if (!haveListing)
+			std::cerr << "Couldn't read listing from " << listingName << ", using plain addresses" << std::endl;
+	}
+
+	if (debug)
+	{
+		Debugger debugger(cpuCtx,haveListing ? &listing : nullptr);
+		debugger.run(std::cin,std::cout);
+		return 0;
+	}
+
+	std::unique_ptr<Profiler> profiler;
+	if (!profileName.empty())
+		profiler.reset(new Profiler());
+
+	std::unique_ptr<Tracer> tracer;
+	if (!traceName.empty())
+	{
+		tracer.reset(new Tracer(cpuCtx,traceSize));
+		if (!tracer->openDump(traceName))
+		{
+			std::cerr << "Error opening trace file " << traceName << std::endl;
+			return -1;
+		}
+		InterruptTrace = tracer.get();
+		std::signal(SIGINT,DumpTraceAndExit);
+	}
+
+	std::unique_ptr<Checkpointer> checkpointer;
+	if (!checkpointName.empty())
+	{
+		checkpointer.reset(new Checkpointer(objectCode,checkpointName));
+		session.checkpointer = checkpointer.get();
+		session.interval = checkpointEvery;
+	}
+
+	//said up front, it only decides which engine runs
+	if (engineName == "unchecked" && !cpuCtx.verify())
+		std::cerr << "Not verified, running checked: " << cpuCtx.verified.reason << std::endl;
+
+	Cpu::Stop stop;
+	if (journalIo && replayFrom > resumedCount && replayFrom < budget)
+	{
+		//from the snapshot to where it was asked to start, quietly
+		journalIo->muted = true;
+		stop = RunSliced(cpuCtx,engineName,replayFrom,resumedCount,session);
+		journalIo->muted = false;
+		resumedCount = stop.count;
+		if (stop.reason == Cpu::Stop::STOP_BUDGET)
+			stop = RunSliced(cpuCtx,engineName,budget,resumedCount,session);
+	}
+	else if (countingIo)
+		stop = RunSliced(cpuCtx,engineName,budget,resumedCount,session);
+	else if (tracer)
+		stop = cpuCtx.runTraced(*tracer,budget);
+	else if (profiler)
+		stop = cpuCtx.runProfiled(*profiler,budget);
+	else if (engineName == "jit")
+		stop = cpuCtx.runJit(budget);
+	else if (engineName == "unchecked")
+		stop = cpuCtx.runUnchecked(budget);
+	else if (engineName == "threaded" && ioName != "interactive")
+	{
+		//nothing here restores a snapshot, so the stripped core with the io calls inlined does
+		Cpu::NoInstrument none;
+		if (ioName == "text")
+			stop = cpuCtx.runWith<Cpu::TextPolicy>(budget,none);
+		else
+			stop = cpuCtx.runWith<Cpu::BinaryPolicy>(budget,none);
+	}
+	else if (engineName == "threaded")
+		stop = cpuCtx.run(budget);
+	else
+		stop = cpuCtx.runStepped(budget);
+
+	if (tracer)
+	{
+		std::signal(SIGINT,SIG_DFL);
+		if (!tracer->dump())
+			std::cerr << "Error writing trace file " << traceName << std::endl;
+	}
+
+	if (checkpointer)
+		checkpointer->report(std::cerr);
+	if (recorder)
+		recorder->report(std::cerr);
+	if (!replayer.error.empty())
+		std::cerr << replayer.error << std::endl;
+
+	if (profiler)
+	{
+		std::ofstream profileFile(profileName);
+		if (profileFile.is_open())
+			profiler->report(profileFile,haveListing ? &listing : nullptr);
+		else
+			std::cerr << "Error opening profile file " << profileName << std::endl;
+	}
+
+	bool failed = true;
+	switch (stop.reason)
 	{
+	case Cpu::Stop::STOP_HALT:
+		failed = false;
+		break;
+	case Cpu::Stop::STOP_FAULT:
 		try
 		{
-			if (cpuCtx.execute() == false)
-				break;
+			cpuCtx.throwIfFault(stop);
 		}
 		catch(const Cpu::CpuException& e)
 		{
-			failed = true;
 			std::cerr << e.toString() << std::endl;
-			break;
 		}
+		break;
+	case Cpu::Stop::STOP_IO_WAIT:
+		std::cerr << "Ran out of input after " << stop.count << " instructions" << std::endl;
+		break;
+	default:
+		std::cerr << "Stopped after " << stop.count << " instructions" << std::endl;
+		break;
 	}
 	if (!failed)
 	{
@@ -71,4 +577,4 @@ int main(int argc, const char* argv[])
 	}
 
 	return 0;
-}
\ No newline at end of file
+}
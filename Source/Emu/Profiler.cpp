@@ -0,0 +1,228 @@
+#include "Profiler.h"
+#include <algorithm>
+#include <iomanip>
+#include <cctype>
+#include <cstdlib>
+#include <stdio.h>
+
+namespace
+{
+	string Hex(size_t val)
+	{
+		char hexPos[16] = {0};
+		sprintf(hexPos,"0x%04x",static_cast<u32>(val));
+		return hexPos;
+	}
+
+	string Percent(u64 part, u64 total)
+	{
+		char percent[16] = {0};
+		sprintf(percent,"%6.2f%%",(total != 0) ? (100.0 * part / total) : 0.0);
+		return percent;
+	}
+
+	string Trim(const string& str)
+	{
+		size_t first = 0, last = str.length();
+		while (first < last && isspace(static_cast<u8>(str[first])))
+			first++;
+		while (last > first && isspace(static_cast<u8>(str[last-1])))
+			last--;
+		return str.substr(first,last-first);
+	}
+
+	//addresses with a nonzero value, biggest value first
+	vector<size_t> Ranked(const vector<u64>& a, const vector<u64>& b)
+	{
+		vector<size_t> addrs;
+		for (size_t i=0;i<a.size();i++)
+		{
+			if (a[i] + b[i] != 0)
+				addrs.push_back(i);
+		}
+		std::stable_sort(addrs.begin(),addrs.end(),[&](size_t x, size_t y) { return a[x] + b[x] > a[y] + b[y]; });
+		return addrs;
+	}
+};
+
+bool Listing::load( std::istream& in )
+{
+	string file, text;
+	while (std::getline(in,text))
+	{
+		if (text.compare(0,8,"//FILE: ") == 0)
+		{
+			file = Trim(text.substr(8));
+			continue;
+		}
+
+		//instruction //(lineNum @ 0xaddr) = bytes
+		size_t meta = text.rfind(" //(");
+		if (meta == string::npos)
+			continue;
+		size_t addrPos = text.find(" @ 0x",meta);
+		if (addrPos == string::npos) //nothing got assembled from this line
+			continue;
+
+		Line line;
+		line.file = file;
+		line.lineNum = strtoul(text.c_str()+meta+4,nullptr,10);
+		size_t address = strtoul(text.c_str()+addrPos+5,nullptr,16);
+
+		string code = text.substr(0,meta);
+		if (!code.empty() && !isspace(static_cast<u8>(code[0])))
+		{
+			size_t colon = code.find(':');
+			if (colon != string::npos)
+			{
+				line.label = Trim(code.substr(0,colon));
+				code = code.substr(colon+1);
+			}
+		}
+		line.text = Trim(code);
+
+		if (!line.label.empty())
+			labels[address] = line.label;
+		if (lines.find(address) == lines.end() || lines[address].text.empty())
+			lines[address] = line;
+	}
+	return !lines.empty();
+}
+
+const Listing::Line* Listing::at( size_t address ) const
+{
+	auto it = lines.find(address);
+	return (it != lines.end()) ? &it->second : nullptr;
+}
+
+const std::pair<const size_t,string>* Listing::labelFor( size_t address ) const
+{
+	auto it = labels.upper_bound(address);
+	if (it == labels.begin())
+		return nullptr;
+
+	--it;
+	return &(*it);
+}
+
+string Listing::location( size_t address ) const
+{
+	auto label = labelFor(address);
+	if (!label)
+		return "";
+	if (label->first == address)
+		return label->second;
+
+	char offset[16] = {0};
+	sprintf(offset,"+0x%x",static_cast<u32>(address - label->first));
+	return label->second + offset;
+}
+
+bool Listing::find( const string& label, size_t& address ) const
+{
+	for (auto it=labels.begin();it!=labels.end();++it)
+	{
+		if (it->second == label)
+		{
+			address = it->first;
+			return true;
+		}
+	}
+	return false;
+}
+
+Profiler::Profiler() : counts(Cpu::Memory::SIZE + Cpu::Memory::GUARD_SIZE,0),
+	taken(Cpu::Memory::SIZE,0), notTaken(Cpu::Memory::SIZE,0), loads(Cpu::Memory::SIZE,0), stores(Cpu::Memory::SIZE,0) {}
+
+void Profiler::report( std::ostream& out, const Listing* listing, size_t maxRows ) const
+{
+	u64 total = 0;
+	for (auto it=counts.begin();it!=counts.end();++it)
+		total += *it;
+	out << "Executed " << total << " instructions" << std::endl;
+
+	auto describe = [&](size_t address) -> string
+	{
+		if (!listing)
+			return "";
+
+		string descr = listing->location(address);
+		const Listing::Line* line = listing->at(address);
+		if (line)
+			descr += " " + line->file + ":" + std::to_string(static_cast<u64>(line->lineNum)) + " " + line->text;
+		return descr;
+	};
+
+	vector<u64> none(counts.size(),0);
+	vector<size_t> hot = Ranked(counts,none);
+	out << std::endl << "Hot spots:" << std::endl;
+	out << std::setw(12) << "count" << "        " << "address" << std::endl;
+	for (size_t i=0;i<hot.size() && i<maxRows;i++)
+	{
+		size_t address = hot[i];
+		out << std::setw(12) << counts[address] << " " << Percent(counts[address],total) << " " << Hex(address) << " " << describe(address);
+		if (address < taken.size() && taken[address] + notTaken[address] != 0)
+			out << " (taken " << taken[address] << " / " << notTaken[address] << ")";
+		out << std::endl;
+	}
+
+	//whole labels, so loops show up as one line, local labels of different files stay apart
+	if (listing)
+	{
+		const size_t NO_LABEL = ~size_t(0);
+		map<size_t,u64> perLabel;
+		for (size_t i=0;i<hot.size();i++)
+		{
+			auto label = listing->labelFor(hot[i]);
+			perLabel[label ? label->first : NO_LABEL] += counts[hot[i]];
+		}
+		vector<std::pair<u64,size_t>> sorted;
+		for (auto it=perLabel.begin();it!=perLabel.end();++it)
+			sorted.push_back(std::make_pair(it->second,it->first));
+		std::stable_sort(sorted.begin(),sorted.end(),[](const std::pair<u64,size_t>& a, const std::pair<u64,size_t>& b) { return a.first > b.first; });
+
+		out << std::endl << "Hot labels:" << std::endl;
+		for (size_t i=0;i<sorted.size() && i<maxRows;i++)
+		{
+			out << std::setw(12) << sorted[i].first << " " << Percent(sorted[i].first,total) << " ";
+			if (sorted[i].second == NO_LABEL)
+			{
+				out << "(no label)" << std::endl;
+				continue;
+			}
+
+			out << Hex(sorted[i].second) << " " << listing->location(sorted[i].second);
+			const Listing::Line* line = listing->at(sorted[i].second);
+			if (line)
+				out << " " << line->file;
+			out << std::endl;
+		}
+	}
+
+	vector<size_t> branches = Ranked(taken,notTaken);
+	if (!branches.empty())
+	{
+		out << std::endl << "Branches:" << std::endl;
+		out << std::setw(12) << "taken" << std::setw(12) << "not taken" << " address" << std::endl;
+		for (size_t i=0;i<branches.size() && i<maxRows;i++)
+		{
+			size_t address = branches[i];
+			out << std::setw(12) << taken[address] << std::setw(12) << notTaken[address] << " " << Hex(address) << " " << describe(address) << std::endl;
+		}
+	}
+
+	vector<size_t> accessed = Ranked(loads,stores);
+	if (!accessed.empty())
+	{
+		out << std::endl << "Memory accesses (LDR/STR target):" << std::endl;
+		out << std::setw(12) << "loads" << std::setw(12) << "stores" << " address" << std::endl;
+		for (size_t i=0;i<accessed.size() && i<maxRows;i++)
+		{
+			size_t address = accessed[i];
+			out << std::setw(12) << loads[address] << std::setw(12) << stores[address] << " " << Hex(address);
+			if (listing)
+				out << " " << listing->location(address);
+			out << std::endl;
+		}
+	}
+}
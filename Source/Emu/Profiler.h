@@ -0,0 +1,48 @@
+#pragma once
+
+#include "Cpu.h"
+#include <ostream>
+#include <istream>
+
+//what the assembler listing (.txt) says about each address
+class Listing
+{
+public:
+	struct Line
+	{
+		string file;
+		size_t lineNum;
+		string label; //empty if the line doesn't have one
+		string text; //the instruction as assembled
+	};
+
+	bool load(std::istream& in); //false if nothing in there looked like a listing
+
+	const Line* at(size_t address) const; //line assembled at exactly this address
+	const std::pair<const size_t,string>* labelFor(size_t address) const; //nearest label at or before it, null if none
+	string location(size_t address) const; //that label, plus offset
+	bool find(const string& label, size_t& address) const; //first place that label is defined
+private:
+	map<size_t,Line> lines;
+	map<size_t,string> labels;
+};
+
+//counts for Cpu::runProfiled, all indexed by address
+class Profiler
+{
+public:
+	Profiler();
+
+	//hooks the profiled engine calls
+	inline void executed(size_t iep) { counts[iep]++; }
+	inline void retired(const Cpu::Decoded&) {}
+	inline void branch(size_t iep, bool isTaken) { (isTaken ? taken : notTaken)[iep]++; }
+	inline void load(u16 address) { loads[address]++; }
+	inline void store(u16 address) { stores[address]++; }
+
+	void report(std::ostream& out, const Listing* listing = nullptr, size_t maxRows = 30) const;
+private:
+	vector<u64> counts;
+	vector<u64> taken, notTaken;
+	vector<u64> loads, stores;
+};
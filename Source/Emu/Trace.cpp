@@ -0,0 +1,140 @@
+#include "Trace.h"
+#include <stdio.h>
+#include <fcntl.h>
+#ifdef _WIN32
+#include <io.h>
+#define open _open
+#define write _write
+#define close _close
+#define O_BINARY_ONLY _O_BINARY
+#else
+#include <unistd.h>
+#define O_BINARY_ONLY 0
+#endif
+
+namespace
+{
+	const char Magic[4] = {'S','C','T','1'};
+
+	string HexWord(u16 val)
+	{
+		char hexPos[16] = {0};
+		sprintf(hexPos,"0x%04x",static_cast<u32>(val));
+		return hexPos;
+	}
+
+	//write() until all of it is out, returns false on the first error
+	bool WriteAll(int fd, const void* data, size_t len)
+	{
+		const char* at = static_cast<const char*>(data);
+		while (len > 0)
+		{
+			int done = write(fd,at,static_cast<unsigned int>(len));
+			if (done <= 0)
+				return false;
+
+			at += done;
+			len -= done;
+		}
+		return true;
+	}
+};
+
+Tracer::Tracer( const Cpu& cpu, size_t numRecords ) : cpu(cpu), written(0)
+{
+	size_t capacity = 1;
+	while (capacity < numRecords)
+		capacity <<= 1;
+
+	ring.resize(capacity);
+	mask = capacity-1;
+	current = &ring[0];
+	fd = -1;
+}
+
+Tracer::~Tracer()
+{
+	if (fd >= 0)
+		close(fd);
+}
+
+bool Tracer::openDump( const string& fileName )
+{
+	if (fd >= 0)
+		close(fd);
+
+	fd = open(fileName.c_str(),O_WRONLY|O_CREAT|O_TRUNC|O_BINARY_ONLY,0644);
+	return fd >= 0;
+}
+
+bool Tracer::dump() const
+{
+	if (fd < 0)
+		return false;
+
+	u64 count = written.load(std::memory_order_acquire);
+	u64 capacity = ring.size();
+
+	Header header;
+	memcpy(header.magic,Magic,sizeof(header.magic));
+	header.recordSize = sizeof(Record);
+	header.executed = count;
+	header.capacity = capacity;
+	if (!WriteAll(fd,&header,sizeof(header)))
+		return false;
+
+	//oldest record is where the next one would go once the ring has wrapped
+	u64 start = (count > capacity) ? (count & mask) : 0;
+	u64 kept = (count > capacity) ? capacity : count;
+	u64 firstPart = std::min(kept,capacity-start);
+	if (!WriteAll(fd,&ring[start],firstPart*sizeof(Record)))
+		return false;
+
+	return WriteAll(fd,&ring[0],(kept-firstPart)*sizeof(Record));
+}
+
+bool Tracer::decode( std::istream& in, std::ostream& out )
+{
+	Header header;
+	if (!in.read(reinterpret_cast<char*>(&header),sizeof(header)) || memcmp(header.magic,Magic,sizeof(Magic)) != 0 || header.recordSize != sizeof(Record))
+		return false;
+
+	u64 kept = std::min(header.executed,header.capacity);
+	u64 num = header.executed - kept;
+	out << "Last " << kept << " of " << header.executed << " executed instructions" << std::endl;
+
+	Record rec;
+	for (u64 i=0;i<kept && in.read(reinterpret_cast<char*>(&rec),sizeof(rec));i++,num++)
+	{
+		out << num << "\t" << HexWord(rec.iep) << "\t";
+
+		//same tables the decoder uses
+		u8 index = OpCodes::decodeIndex(rec.instr[0]);
+		if (index == OpCodes::INVALID_INDEX)
+		{
+			out << "?? " << HexWord(static_cast<u16>(rec.instr[0] << 8 | rec.instr[1])) << std::endl;
+			continue;
+		}
+
+		const OpCodes::Info& info = OpCodes::Table[index];
+		u8 fields[OpCodes::FIELD_COUNT];
+		OpCodes::decodeFields(info,rec.instr[0],rec.instr[1],fields);
+		Registers::RegisterType dst = static_cast<Registers::RegisterType>(fields[OpCodes::FIELD_DST]);
+
+		out << info.name;
+		if (info.flags & OpCodes::FLAG_CONDITIONAL)
+			out << (rec.value ? " taken" : " not taken");
+		else if (info.flags & OpCodes::FLAG_STORE)
+			out << " [" << HexWord(rec.address) << "]";
+		else if (info.flags & OpCodes::FLAG_LOAD)
+		{
+			if (info.flags & OpCodes::FLAG_WRITES_DST) //MEMCMP only sets the flags
+				out << " " << Registers::toString(dst) << " = " << HexWord(rec.value);
+			out << " [" << HexWord(rec.address) << "]";
+		}
+		else if (info.flags & OpCodes::FLAG_WRITES_DST)
+			out << " " << Registers::toString(dst) << " = " << HexWord(rec.value);
+		out << std::endl;
+	}
+	return true;
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "Cpu.h"
+#include <atomic>
+#include <istream>
+#include <ostream>
+
+//the last instructions Cpu::runTraced executed, packed into a fixed ring that just gets overwritten,
+//so it can stay on for whole runs and still have what led up to a fault
+class Tracer
+{
+public:
+	struct Record
+	{
+		u16 iep;
+		u8 instr[2]; //first two bytes of the instruction, as they were in memory
+		u16 value; //destination register after it ran, or 1/0 for taken/not taken JZ and JGT
+		u16 address; //LDR/STR target, dst of a block instruction
+	};
+	static_assert(sizeof(Record) == 8, "Records are packed");
+
+	enum { DEFAULT_RECORDS = 64 * 1024 };
+
+	Tracer(const Cpu& cpu, size_t numRecords = DEFAULT_RECORDS); //rounded up to a power of two
+	~Tracer();
+
+	//hooks the traced engine calls, the same ones Profiler has
+	inline void executed(size_t iep)
+	{
+		u64 pos = written.load(std::memory_order_relaxed);
+		current = &ring[pos & mask];
+		current->iep = static_cast<u16>(iep);
+		if (iep < Cpu::Memory::SIZE)
+			memcpy(current->instr,&cpu.mem.bytes[iep],sizeof(current->instr));
+		else
+			current->instr[0] = current->instr[1] = 0;
+		current->value = 0;
+		current->address = 0;
+		written.store(pos+1,std::memory_order_release); //a dump from a signal handler sees complete records before this one
+	}
+	inline void retired(const Cpu::Decoded& ins) { current->value = cpu.regs[ins.dst].u; }
+	inline void branch(size_t, bool isTaken) { current->value = isTaken ? 1 : 0; }
+	inline void load(u16 address) { current->address = address; }
+	inline void store(u16 address) { current->address = address; }
+
+	bool openDump(const string& fileName); //opened up front, so dump() doesn't have to
+	//writes the header and the records oldest first with plain write() calls, so it's fine to call from a signal handler
+	bool dump() const;
+	//turns what dump wrote into one line of text per record, false if it wasn't a trace
+	static bool decode(std::istream& in, std::ostream& out);
+private:
+	struct Header
+	{
+		char magic[4];
+		u32 recordSize;
+		u64 executed; //records in the file are the last min(executed,capacity) of these
+		u64 capacity;
+	};
+
+	const Cpu& cpu;
+	vector<Record> ring;
+	u64 mask;
+	std::atomic<u64> written;
+	Record* current;
+	int fd;
+};